@@ -0,0 +1,73 @@
+//
+// Compiles hot functions on worker threads while the interpreter keeps running them.
+//
+
+#include "CompileQueue.h"
+#include "Optimizer.h"
+#include <chrono>
+
+CompileQueue::CompileQueue(int threads) {
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(thread(&CompileQueue::work, this));
+    }
+}
+
+CompileQueue::~CompileQueue() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        jobs.clear();
+    }
+    ready.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+void CompileQueue::push(const shared_ptr<CompileJob> &job) {
+    {
+        lock_guard<mutex> guard(lock);
+        jobs.push_back(job);
+    }
+    ready.notify_one();
+}
+
+void CompileQueue::work() {
+    while (true) {
+        shared_ptr<CompileJob> job;
+        {
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+        }
+        compileJob(*job);
+    }
+}
+
+// tokenize and compile one job, on whatever thread calls it. the tokens are the worker's own, the callees
+// bodies are shared with the interpreter and only read
+void compileJob(CompileJob &job) {
+    auto start = chrono::steady_clock::now();
+    if (job.source) {
+        job.body = Lex(job.source, job.sourceBegin, job.sourceEnd);
+        if (job.optimize) {
+            Optimizer optimizer;
+            optimizer.run(job.body);
+        }
+    }
+    auto resolve = [&](const string &name, JITCallee &callee) {
+        auto it = job.callees.find(name);
+        if (it == job.callees.end()) {
+            return false;
+        }
+        callee = it->second;
+        return true;
+    };
+    job.code = jitCompile(job.name, job.params, job.body, resolve, job.inlineBudget);
+    job.compileNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    job.done.store(true, memory_order_release);
+}
@@ -0,0 +1,69 @@
+//
+// Compiles hot functions on worker threads while the interpreter keeps running them.
+//
+
+#ifndef TINYJS_COMPILEQUEUE_H
+#define TINYJS_COMPILEQUEUE_H
+
+#include "Lex.h"
+#include "JIT.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+using namespace std;
+
+// one function handed to the compile threads. everything in it is filled in on the main thread before
+// it is pushed, a worker only reads it and sets code, compileNs and then done
+struct CompileJob {
+    string name;
+    vector<string> params;
+
+    //the body's { ... } in the source, tokenized by the worker; nullptr to compile body instead
+    shared_ptr<const Source> source;
+    int sourceBegin = 0;
+    int sourceEnd = 0;
+    bool optimize = false;
+    Lex body;
+
+    //every name the body (and what gets inlined into it) calls, as it resolved when the job was made
+    map<string, JITCallee> callees;
+    int inlineBudget = 0;
+
+    JITFunction *code = nullptr; //the job's until installed, installCompiled takes it
+    long long compileNs = 0;
+    atomic<bool> done{false};
+
+    //code never installed goes with the job
+    ~CompileJob() {
+        delete code;
+    }
+};
+
+class CompileQueue {
+public:
+    explicit CompileQueue(int threads);
+
+    //finishes the job being compiled, drops the ones still waiting
+    ~CompileQueue();
+
+    void push(const shared_ptr<CompileJob> &job);
+
+private:
+    mutex lock;
+    condition_variable ready;
+    deque<shared_ptr<CompileJob>> jobs;
+    vector<thread> workers;
+    bool stopping = false;
+
+    void work();
+};
+
+void compileJob(CompileJob &job);
+
+#endif //TINYJS_COMPILEQUEUE_H
@@ -0,0 +1,360 @@
+//
+// Runs scripts on one thread around what they wait for: jobs, timers and file descriptors.
+//
+
+#include "EventLoop.h"
+#include <algorithm>
+#include <stdint.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TINYJS_POSIX 1
+#include <poll.h>
+#include <unistd.h>
+#else
+#include <thread>
+#endif
+
+// a var held by a pending callback, let go when the callback is dropped
+static shared_ptr<Var> hold(Var *var) {
+    return shared_ptr<Var>(var->ref(), [](Var *v) { v->unref(); });
+}
+
+EventLoop::~EventLoop() {
+    //callbacks hold vars of the interpreters, they go first
+    timers.clear();
+    deadlines.clear();
+    readers.clear();
+    //an async call returns undefined once its script is terminated, so every task runs to its end
+    while (!tasks.empty()) {
+        Task *task = *tasks.begin();
+        task->interpreter->terminate();
+        if (task->waiting) {
+            wake(task);
+        }
+        turn(task);
+        ready.clear();
+        jobs.clear();
+    }
+    //so are the workers started here, which are then waited for
+    for (auto &channel: channels) {
+        if (channel.second.worker) {
+            channel.second.worker->terminate();
+        }
+    }
+    channels.clear();
+}
+
+Interpreter *EventLoop::add(const string &file) {
+    auto interpreter = new Interpreter(file);
+    interpreters.emplace_back(interpreter);
+    install(interpreter);
+    ready.push_back(spawn(interpreter, [interpreter] { interpreter->execute(); }));
+    return interpreter;
+}
+
+void EventLoop::addAsync(const string &name, const AsyncFunction &start) {
+    asyncs.push_back(make_pair(name, start));
+}
+
+int EventLoop::setTimer(long long ms, const function<void()> &fire) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(max(0LL, ms));
+    int id = ++lastTimer;
+    timers[make_pair(deadline, id)] = fire;
+    deadlines[id] = deadline;
+    return id;
+}
+
+void EventLoop::clearTimer(int id) {
+    auto it = deadlines.find(id);
+    if (it != deadlines.end()) {
+        timers.erase(make_pair(it->second, id));
+        deadlines.erase(it);
+    }
+}
+
+void EventLoop::whenReadable(int fd, const function<void()> &ready) {
+    readers.push_back(make_pair(fd, ready));
+}
+
+int EventLoop::connect(const shared_ptr<Port> &in, const shared_ptr<Port> &out) {
+    int id = ++lastChannel;
+    channels[id] = Channel{in, out, nullptr};
+    return id;
+}
+
+bool EventLoop::run() {
+    while (true) {
+        //the tasks ready now, each followed by the jobs it queued. the ones that get ready meanwhile wait for
+        //the next round, after timers and descriptors were looked at
+        for (size_t n = ready.size(); n > 0 && !ready.empty(); n--) {
+            Task *task = ready.front();
+            ready.pop_front();
+            turn(task);
+            runJobs();
+        }
+        runJobs();
+        if (ready.empty() && timers.empty() && readers.empty()) {
+            if (waiting) {
+                cout << "error: " << waiting << " tasks wait for something that never comes" << endl;
+                return false;
+            }
+            return true;
+        }
+        waitForEvents(ready.empty());
+    }
+}
+
+EventLoop::Task *EventLoop::spawn(Interpreter *interpreter, const function<void()> &body) {
+    auto task = new Task{interpreter, new Fiber(body, stackSize), false};
+    tasks.insert(task);
+    stats.tasks++;
+    return task;
+}
+
+// run task until it returns or suspends. one that used up its slice is ready again right away
+void EventLoop::turn(Task *task) {
+    current = task;
+    stats.turns++;
+    bool finished = task->interpreter->runOn(task->fiber);
+    current = nullptr;
+    if (finished) {
+        tasks.erase(task);
+        delete task->fiber;
+        delete task;
+    } else if (!task->waiting) {
+        ready.push_back(task);
+    }
+}
+
+void EventLoop::runJobs() {
+    while (!jobs.empty()) {
+        Task *task = jobs.front();
+        jobs.pop_front();
+        turn(task);
+    }
+}
+
+void EventLoop::wake(Task *task) {
+    task->waiting = false;
+    waiting--;
+    ready.push_back(task);
+}
+
+// suspend the task calling an async function until done is called, done may also be called before start
+// returns. the result is the value of the call
+Var *EventLoop::callAsync(Interpreter &interpreter, const AsyncFunction &start, const vector<Var *> &args) {
+    struct Pending {
+        Task *task;
+        bool completed;
+        Var *result;
+    };
+    auto pending = make_shared<Pending>(Pending{current, false, nullptr});
+    start(args, [this, pending](Var *result) {
+        if (pending->completed) {
+            return;
+        }
+        pending->completed = true;
+        pending->result = result;
+        if (pending->task && pending->task->waiting) {
+            wake(pending->task);
+        }
+    });
+    if (!pending->completed) {
+        if (!current || current->interpreter != &interpreter) {
+            cout << "error: an async function is only called from a task of its event loop" << endl;
+            pending->task = nullptr;
+            return nullptr;
+        }
+        Task *task = current;
+        task->waiting = true;
+        waiting++;
+        stats.maxWaiting = max(stats.maxWaiting, waiting);
+        if (!interpreter.await()) {
+            //the script is being terminated: the call gives undefined, a result coming later is dropped
+            task->waiting = false;
+            waiting--;
+        }
+    }
+    pending->task = nullptr;
+    return pending->result;
+}
+
+void EventLoop::install(Interpreter *interpreter) {
+    interpreter->addNative("setTimeout", [this](Interpreter &in, const vector<Var *> &args) -> Var * {
+        if (args.empty() || !args[0]->isFunction()) {
+            cout << "error: setTimeout takes a function and a delay in ms" << endl;
+            return nullptr;
+        }
+        auto func = hold(args[0]);
+        Interpreter *target = &in;
+        long long ms = args.size() > 1 ? args[1]->getInt() : 0;
+        return new Var(setTimer(ms, [this, func, target] {
+            ready.push_back(spawn(target, [func, target] { target->call(func.get(), {}); }));
+        }));
+    });
+    interpreter->addNative("clearTimeout", [this](Interpreter &, const vector<Var *> &args) -> Var * {
+        if (!args.empty()) {
+            clearTimer(args[0]->getInt());
+        }
+        return nullptr;
+    });
+    interpreter->addNative("queueMicrotask", [this](Interpreter &in, const vector<Var *> &args) -> Var * {
+        if (args.empty() || !args[0]->isFunction()) {
+            cout << "error: queueMicrotask takes a function" << endl;
+            return nullptr;
+        }
+        auto func = hold(args[0]);
+        Interpreter *target = &in;
+        jobs.push_back(spawn(target, [func, target] { target->call(func.get(), {}); }));
+        return nullptr;
+    });
+    interpreter->addNative("worker", [this](Interpreter &in, const vector<Var *> &args) -> Var * {
+        if (args.empty() || !args[0]->isString()) {
+            cout << "error: worker takes the file of a script" << endl;
+            return nullptr;
+        }
+        bool jit = in.jit;
+        auto worker = new Worker(args[0]->getString(), [jit](Interpreter &interpreter) {
+            interpreter.jit = jit;
+        });
+        int id = connect(worker->outbox, worker->inbox);
+        channels[id].worker.reset(worker);
+        return new Var(id);
+    });
+    interpreter->addNative("postMessage", [this](Interpreter &, const vector<Var *> &args) -> Var * {
+        Channel *to = channel(args);
+        if (!to) {
+            return nullptr;
+        }
+        Var undefined;
+        Var *value = args.size() > 1 ? args[1] : &undefined;
+        //transfer moves the arrays of plain values the message holds
+        bool transfer = args.size() > 2 && args[2]->getBool();
+        unique_ptr<Message> message(new Message());
+        message->write(value, transfer ? Message::arraysIn(value) : vector<Var *>());
+        return new Var(to->out->send(move(message)));
+    });
+    interpreter->addNative("closePort", [this](Interpreter &, const vector<Var *> &args) -> Var * {
+        Channel *to = channel(args);
+        if (to) {
+            to->out->close();
+        }
+        return nullptr;
+    });
+
+    vector<pair<string, AsyncFunction>> all = {
+            {"sleep", [this](const vector<Var *> &args, const function<void(Var *)> &done) {
+                setTimer(args.empty() ? 0 : args[0]->getInt(), [done] { done(nullptr); });
+            }},
+            {"read", [this](const vector<Var *> &args, const function<void(Var *)> &done) {
+#if TINYJS_POSIX
+                int fd = args.empty() ? -1 : args[0]->getInt();
+                if (fd < 0) {
+                    //poll() skips a negative fd, the read would be waited for forever
+                    cout << "error: read needs a file descriptor" << endl;
+                    done(nullptr);
+                    return;
+                }
+                whenReadable(fd, [fd, done] {
+                    char buffer[65536];
+                    ssize_t n = ::read(fd, buffer, sizeof(buffer));
+                    done(new Var(string(buffer, (size_t) max((ssize_t) 0, n))));
+                });
+#else
+                done(new Var(string()));
+#endif
+            }},
+            {"receiveMessage", [this](const vector<Var *> &args, const function<void(Var *)> &done) {
+                Channel *from = channel(args);
+                if (from) {
+                    receive(from->in, done);
+                } else {
+                    done(nullptr);
+                }
+            }}
+    };
+    all.insert(all.end(), asyncs.begin(), asyncs.end());
+    for (auto &async: all) {
+        AsyncFunction start = async.second;
+        interpreter->addNative(async.first, [this, start](Interpreter &in, const vector<Var *> &args) {
+            return callAsync(in, start, args);
+        });
+    }
+}
+
+// the ports of the id in args[0]
+EventLoop::Channel *EventLoop::channel(const vector<Var *> &args) {
+    auto found = channels.find(args.empty() ? 0 : args[0]->getInt());
+    if (found == channels.end()) {
+        cout << "error: there are no ports with this id" << endl;
+        return nullptr;
+    }
+    return &found->second;
+}
+
+// the next message of port, once there is one. undefined once the port is closed and read to its end
+void EventLoop::receive(const shared_ptr<Port> &port, const function<void(Var *)> &done) {
+    //closed before looking: every message sent is queued by then
+    bool closed = port->closed();
+    auto message = port->take();
+    if (message) {
+        done(message->read());
+    } else if (closed) {
+        done(nullptr);
+    } else if (port->fd() >= 0) {
+        whenReadable(port->fd(), [this, port, done] {
+            port->drain();
+            receive(port, done);
+        });
+    } else {
+        setTimer(1, [this, port, done] { receive(port, done); });
+    }
+}
+
+// fire the timers that are due and the readers whose descriptor is readable. with block, first wait for
+// the next of them
+void EventLoop::waitForEvents(bool block) {
+    int timeout = block ? -1 : 0;
+    if (block && !timers.empty()) {
+        auto left = timers.begin()->first.first - chrono::steady_clock::now();
+        //rounded up, a timer never fires early
+        long long ms = (chrono::duration_cast<chrono::microseconds>(left).count() + 999) / 1000;
+        timeout = (int) max(0LL, min(ms, (long long) INT32_MAX));
+    }
+#if TINYJS_POSIX
+    if (!readers.empty() || timeout != 0) {
+        vector<pollfd> fds;
+        for (auto &reader: readers) {
+            fds.push_back(pollfd{reader.first, POLLIN, 0});
+        }
+        stats.polls++;
+        if (::poll(fds.data(), fds.size(), timeout) > 0) {
+            vector<function<void()>> fire;
+            vector<pair<int, function<void()>>> rest;
+            for (size_t i = 0; i < readers.size(); i++) {
+                if (fds[i].revents) {
+                    fire.push_back(move(readers[i].second));
+                } else {
+                    rest.push_back(move(readers[i]));
+                }
+            }
+            readers.swap(rest);
+            for (auto &f: fire) {
+                f();
+            }
+        }
+    }
+#else
+    if (timeout > 0) {
+        this_thread::sleep_for(chrono::milliseconds(timeout));
+    }
+#endif
+    auto now = chrono::steady_clock::now();
+    while (!timers.empty() && timers.begin()->first.first <= now) {
+        auto fire = move(timers.begin()->second);
+        deadlines.erase(timers.begin()->first.second);
+        timers.erase(timers.begin());
+        stats.timers++;
+        fire();
+    }
+}
@@ -0,0 +1,119 @@
+//
+// Runs scripts on one thread around what they wait for: jobs, timers and file descriptors.
+//
+
+#ifndef TINYJS_EVENTLOOP_H
+#define TINYJS_EVENTLOOP_H
+
+#include "Interpreter.h"
+#include "Fiber.h"
+#include "Worker.h"
+#include <deque>
+#include <map>
+#include <unordered_set>
+#include <memory>
+#include <functional>
+#include <chrono>
+
+using namespace std;
+
+// an async host function: start what args ask for, then call done with the result (nullptr for undefined)
+// on the loop's thread, right away or later from a timer or a file descriptor callback. the script calling
+// it is suspended until then, and the loop runs other scripts
+typedef function<void(const vector<Var *> &args, const function<void(Var *result)> &done)> AsyncFunction;
+
+struct EventLoopStats {
+    long long tasks = 0; //scripts, jobs and timer callbacks started
+    long long turns = 0; //times one of them was run or resumed
+    long long timers = 0; //fired
+    long long polls = 0;
+    long long maxWaiting = 0; //tasks suspended in async calls at once, at most
+};
+
+// every script, job (queueMicrotask) and timer callback is a task with a stack of its own. a task runs until
+// it returns, calls an async function or uses up its slice (Interpreter::sliceNs). after each task the jobs
+// it queued run; once no task is ready the loop waits in poll() for the next timer or readable descriptor
+class EventLoop {
+public:
+    EventLoop() { };
+
+    //tasks still waiting are terminated and unwound, workers started by the scripts terminated and joined
+    ~EventLoop();
+
+    //the script in file, run by run(). its globals get setTimeout(f, ms), clearTimeout(id),
+    //queueMicrotask(f), the async sleep(ms) and read(fd), the functions of addAsync, and those for ports:
+    //worker(file) starts a Worker and gives the id of the ports to it, postMessage(id, value, transfer)
+    //sends a clone of value, with its arrays of plain values moved instead when transfer is true, the async
+    //receiveMessage(id) gives the next message (undefined once the other side is done) and closePort(id)
+    //ends the sending side. set the interpreter up (jit, budgets) before run()
+    Interpreter *add(const string &file);
+
+    //an async function for the scripts added after
+    void addAsync(const string &name, const AsyncFunction &start);
+
+    //for the host: fire on the loop's thread after ms, or once fd is readable (or closed)
+    int setTimer(long long ms, const function<void()> &fire);
+
+    void clearTimer(int id);
+
+    void whenReadable(int fd, const function<void()> &ready);
+
+    //ports for the scripts: receiveMessage(id) reads from in, postMessage(id, ...) sends on out
+    int connect(const shared_ptr<Port> &in, const shared_ptr<Port> &out);
+
+    //run until nothing is ready or waited for. false when tasks are left waiting on nothing
+    bool run();
+
+    size_t stackSize = 1 << 20; //of each task, only the pages it touches are backed
+    EventLoopStats stats;
+
+private:
+    struct Task {
+        Interpreter *interpreter;
+        Fiber *fiber;
+        bool waiting;
+    };
+
+    vector<unique_ptr<Interpreter>> interpreters;
+    vector<pair<string, AsyncFunction>> asyncs;
+
+    unordered_set<Task *> tasks;
+    deque<Task *> ready;
+    deque<Task *> jobs;
+    Task *current = nullptr;
+    long long waiting = 0;
+
+    //by deadline, then by id so timers due at once fire in the order they were set
+    map<pair<chrono::steady_clock::time_point, int>, function<void()>> timers;
+    map<int, chrono::steady_clock::time_point> deadlines;
+    int lastTimer = 0;
+    vector<pair<int, function<void()>>> readers;
+
+    struct Channel {
+        shared_ptr<Port> in;
+        shared_ptr<Port> out;
+        unique_ptr<Worker> worker; //started by a script
+    };
+    map<int, Channel> channels;
+    int lastChannel = 0;
+
+    Task *spawn(Interpreter *interpreter, const function<void()> &body);
+
+    void turn(Task *task);
+
+    void runJobs();
+
+    void wake(Task *task);
+
+    void install(Interpreter *interpreter);
+
+    Var *callAsync(Interpreter &interpreter, const AsyncFunction &start, const vector<Var *> &args);
+
+    Channel *channel(const vector<Var *> &args);
+
+    void receive(const shared_ptr<Port> &port, const function<void(Var *)> &done);
+
+    void waitForEvents(bool block);
+};
+
+#endif //TINYJS_EVENTLOOP_H
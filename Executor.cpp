@@ -0,0 +1,143 @@
+//
+// Runs many scripts on a pool of threads, each with an isolate it keeps between jobs.
+//
+
+#include "Executor.h"
+#include <algorithm>
+#include <iomanip>
+
+Executor::Executor(int threads, const function<void(Interpreter &)> &setup) {
+    if (threads <= 0) {
+        threads = max(1, (int) thread::hardware_concurrency());
+    }
+    started = chrono::steady_clock::now();
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(new Worker());
+        if (setup) {
+            setup(*workers.back()->isolate.interpreter);
+        }
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->runner = thread(&Executor::run, this, i);
+    }
+}
+
+Executor::~Executor() {
+    wait();
+    {
+        lock_guard<mutex> guard(idleLock);
+        stopping = true;
+    }
+    work.notify_all();
+    for (auto &worker: workers) {
+        worker->runner.join();
+    }
+}
+
+future<string> Executor::submit(const string &file, const string &input) {
+    auto result = make_shared<promise<string>>();
+    submit(file, input, [result](const string &value) {
+        result->set_value(value);
+    });
+    return result->get_future();
+}
+
+void Executor::submit(const string &file, const string &input, const function<void(const string &result)> &done) {
+    Worker &worker = *workers[next.fetch_add(1, memory_order_relaxed) % workers.size()];
+    pending.fetch_add(1);
+    {
+        lock_guard<mutex> guard(worker.lock);
+        worker.jobs.push_back(ExecutorJob{file, input, done});
+    }
+    {
+        lock_guard<mutex> guard(idleLock);
+        queued.fetch_add(1);
+    }
+    work.notify_one();
+}
+
+void Executor::wait() {
+    unique_lock<mutex> guard(idleLock);
+    finished.wait(guard, [this] { return pending.load() == 0; });
+}
+
+// the oldest job of the worker's own queue, else the newest of the first other queue that has one
+bool Executor::take(size_t index, ExecutorJob &job) {
+    for (size_t i = 0; i < workers.size(); i++) {
+        Worker &victim = *workers[(index + i) % workers.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (victim.jobs.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            job = move(victim.jobs.front());
+            victim.jobs.pop_front();
+        } else {
+            job = move(victim.jobs.back());
+            victim.jobs.pop_back();
+            workers[index]->stolen.fetch_add(1, memory_order_relaxed);
+        }
+        queued.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+void Executor::run(size_t index) {
+    Worker &worker = *workers[index];
+    while (true) {
+        ExecutorJob job;
+        if (take(index, job)) {
+            auto start = chrono::steady_clock::now();
+            worker.isolate.execute(job.file, job.input);
+            string result = worker.isolate.global("result");
+            worker.busyNs.fetch_add(chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - start).count(), memory_order_relaxed);
+            worker.ran.fetch_add(1, memory_order_relaxed);
+            if (job.done) {
+                job.done(result);
+            }
+            if (pending.fetch_sub(1) == 1) {
+                lock_guard<mutex> guard(idleLock);
+                finished.notify_all();
+            }
+            continue;
+        }
+        unique_lock<mutex> guard(idleLock);
+        work.wait(guard, [this] { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0) {
+            return;
+        }
+    }
+}
+
+vector<WorkerStats> Executor::stats() {
+    double elapsedNs = (double) chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - started).count();
+    vector<WorkerStats> all;
+    for (auto &worker: workers) {
+        WorkerStats s;
+        s.jobs = worker->ran.load(memory_order_relaxed);
+        s.stolen = worker->stolen.load(memory_order_relaxed);
+        s.busyNs = worker->busyNs.load(memory_order_relaxed);
+        {
+            lock_guard<mutex> guard(worker->lock);
+            s.queued = worker->jobs.size();
+        }
+        s.utilization = elapsedNs > 0 ? s.busyNs / elapsedNs : 0;
+        all.push_back(s);
+    }
+    return all;
+}
+
+void Executor::report(ostream &os) {
+    os << left << setw(8) << "worker" << right << setw(10) << "jobs" << setw(10) << "stolen" << setw(12)
+    << "busy(ms)" << setw(8) << "util" << setw(8) << "queued" << endl;
+    os << fixed << setprecision(3);
+    auto all = stats();
+    for (size_t i = 0; i < all.size(); i++) {
+        os << left << setw(8) << i << right << setw(10) << all[i].jobs << setw(10) << all[i].stolen << setw(12)
+        << all[i].busyNs / 1e6 << setw(7) << (int) (all[i].utilization * 100) << "%" << setw(8) << all[i].queued
+        << endl;
+    }
+}
@@ -0,0 +1,89 @@
+//
+// Runs many scripts on a pool of threads, each with an isolate it keeps between jobs.
+//
+
+#ifndef TINYJS_EXECUTOR_H
+#define TINYJS_EXECUTOR_H
+
+#include "Isolate.h"
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <chrono>
+
+using namespace std;
+
+// a script to run with its input, done gets the global result as a string
+struct ExecutorJob {
+    string file;
+    string input;
+    function<void(const string &result)> done;
+};
+
+struct WorkerStats {
+    long long jobs = 0;
+    long long stolen = 0; //of those, taken from the queue of another worker
+    long long busyNs = 0;
+    size_t queued = 0; //waiting in its queue now
+    double utilization = 0; //busy time over the time since the executor started
+};
+
+// a worker has a queue of its own and a reused isolate: it runs its own jobs oldest first and, once its queue
+// is empty, steals the newest job of another. a script a worker ran before is neither lexed nor compiled again
+class Executor {
+public:
+    //threads workers, 0 for one per core. setup is called with the interpreter of each isolate before its
+    //first job, to turn on the JIT and such
+    explicit Executor(int threads = 0, const function<void(Interpreter &)> &setup = nullptr);
+
+    //runs every job submitted, then stops the workers
+    ~Executor();
+
+    //run file with the global input set to input, over globals of its own. the result is the global result,
+    //empty when the script set none
+    future<string> submit(const string &file, const string &input = "");
+
+    //the same, done is called with the result on the worker that ran the job
+    void submit(const string &file, const string &input, const function<void(const string &result)> &done);
+
+    //returns once every job submitted so far has run
+    void wait();
+
+    vector<WorkerStats> stats();
+
+    void report(ostream &os);
+
+private:
+    struct Worker {
+        mutex lock;
+        deque<ExecutorJob> jobs;
+        Isolate isolate;
+        thread runner;
+        atomic<long long> ran{0};
+        atomic<long long> stolen{0};
+        atomic<long long> busyNs{0};
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    atomic<size_t> next{0}; //the worker the next job is queued on, round robin
+
+    //queued counts the jobs in any queue, pending the ones not finished yet. queued only goes up under idleLock,
+    //so a worker checking it there before sleeping cannot miss a job
+    mutex idleLock;
+    condition_variable work;
+    condition_variable finished;
+    atomic<long long> queued{0};
+    atomic<long long> pending{0};
+    bool stopping = false;
+    chrono::steady_clock::time_point started;
+
+    void run(size_t index);
+
+    bool take(size_t index, ExecutorJob &job);
+};
+
+#endif //TINYJS_EXECUTOR_H
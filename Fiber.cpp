@@ -0,0 +1,100 @@
+//
+// A function run on a stack of its own, that can stop halfway and be resumed later on the same thread.
+//
+
+#include "Fiber.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FIBER_CONTEXTS 1
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define FIBER_CONTEXTS 0
+#endif
+
+static thread_local Fiber *running = nullptr;
+
+Fiber::Fiber(const function<void()> &body, size_t stackSize) : body(body) {
+#if FIBER_CONTEXTS
+    //the lowest page stays unmapped, an overflow faults instead of writing over whatever is below
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    mappedSize = (stackSize + page - 1) / page * page + page;
+#ifdef MAP_NORESERVE
+    //only the pages a fiber touches are backed, thousands of them can wait with big stacks
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#endif
+    stack = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (stack == MAP_FAILED) {
+        stack = nullptr;
+        return;
+    }
+    mprotect(stack, page, PROT_NONE);
+
+    auto ctx = new ucontext_t();
+    getcontext(ctx);
+    ctx->uc_stack.ss_sp = (char *) stack + page;
+    ctx->uc_stack.ss_size = mappedSize - page;
+    ctx->uc_link = nullptr;
+    makecontext(ctx, &Fiber::start, 0);
+    context = ctx;
+    caller = new ucontext_t();
+#endif
+}
+
+Fiber::~Fiber() {
+#if FIBER_CONTEXTS
+    delete (ucontext_t *) context;
+    delete (ucontext_t *) caller;
+    if (stack) {
+        munmap(stack, mappedSize);
+    }
+#endif
+}
+
+bool Fiber::resume() {
+    if (finished) {
+        return true;
+    }
+#if FIBER_CONTEXTS
+    if (context) {
+        outer = running;
+        running = this;
+        swapcontext((ucontext_t *) caller, (ucontext_t *) context);
+        running = outer;
+        return finished;
+    }
+#endif
+    //no stack of its own: run to the end
+    body();
+    finished = true;
+    return true;
+}
+
+void Fiber::suspend() {
+#if FIBER_CONTEXTS
+    if (running == this) {
+        swapcontext((ucontext_t *) context, (ucontext_t *) caller);
+    }
+#endif
+}
+
+Fiber *Fiber::current() {
+    return running;
+}
+
+bool Fiber::supported() {
+    return FIBER_CONTEXTS != 0;
+}
+
+// the bottom of every fiber's stack: run body, then switch back for good
+void Fiber::start() {
+#if FIBER_CONTEXTS
+    Fiber *self = running;
+    self->body();
+    self->finished = true;
+    setcontext((ucontext_t *) self->caller);
+#endif
+}
@@ -0,0 +1,46 @@
+//
+// A function run on a stack of its own, that can stop halfway and be resumed later on the same thread.
+//
+
+#ifndef TINYJS_FIBER_H
+#define TINYJS_FIBER_H
+
+#include <functional>
+#include <stddef.h>
+
+using namespace std;
+
+// resume() runs body until it calls suspend() or returns, on the thread calling resume(). without POSIX
+// contexts resume() runs body to the end and suspend() does nothing
+class Fiber {
+public:
+    explicit Fiber(const function<void()> &body, size_t stackSize = 8 << 20);
+
+    //a fiber that did not finish is dropped with its stack, whatever body still held is not freed
+    ~Fiber();
+
+    //true once body returned
+    bool resume();
+
+    //called by body, back to the resume() that ran it
+    void suspend();
+
+    bool finished = false;
+
+    //the fiber running on this thread, nullptr on a thread's own stack
+    static Fiber *current();
+
+    static bool supported();
+
+private:
+    function<void()> body;
+    void *stack = nullptr;
+    size_t mappedSize = 0;
+    void *context = nullptr; //the fiber's ucontext_t
+    void *caller = nullptr; //the one resume() came from
+    Fiber *outer = nullptr; //the fiber resume() was called on, if any
+
+    static void start();
+};
+
+#endif //TINYJS_FIBER_H
@@ -4,75 +4,382 @@
 
 #include "Interpreter.h"
 #include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <iterator>
 #include <assert.h>
 
 using namespace std;
 
+#if defined(TINYJS_COMPUTED_GOTO) && TINYJS_COMPUTED_GOTO && defined(__GNUC__)
+#define USE_COMPUTED_GOTO 1
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+
+// statement kinds, the dispatcher maps the first token of a statement to one of them
+enum STATEMENT_OP {
+    OP_INVALID,
+    OP_EXPRESSION,
+    OP_BLOCK,
+    OP_EMPTY,
+    OP_VAR,
+    OP_IF,
+    OP_WHILE,
+    OP_FOR,
+    OP_RETURN,
+    OP_FUNCTION,
+    OP_EOF,
+    OP_BREAK,
+    OP_CONTINUE,
+    OP_COUNT
+};
+
+static vector<unsigned char> buildStatementOps() {
+    vector<unsigned char> ops(TK_EOF + 1, OP_INVALID);
+    ops[TK_IDENTIFIER] = ops[TK_DEC_INT] = ops[TK_HEX_INT] = ops[TK_OCTAL_INT] = OP_EXPRESSION;
+    ops[TK_FLOAT] = ops[TK_STRING] = ops[TK_MINUS] = ops[TK_THIS] = OP_EXPRESSION;
+    ops[TK_L_LARGE_BRACKET] = OP_BLOCK;
+    ops[TK_SEMICOLON] = OP_EMPTY;
+    ops[TK_VAR] = OP_VAR;
+    ops[TK_IF] = OP_IF;
+    ops[TK_WHILE] = OP_WHILE;
+    ops[TK_FOR] = OP_FOR;
+    ops[TK_RETURN] = OP_RETURN;
+    ops[TK_FUNCTION] = OP_FUNCTION;
+    ops[TK_EOF] = OP_EOF;
+    ops[TK_BREAK] = OP_BREAK;
+    ops[TK_CONTINUE] = OP_CONTINUE;
+    return ops;
+}
+
+static const vector<unsigned char> statementOps = buildStatementOps();
+
 void Interpreter::execute() {
-    lex = new Lex(this->code);
-    lex->getNextToken();
+    if (forked) {
+        cout << "error: an interpreter that was forked only serves as the heap of its forks" << endl;
+        return;
+    }
+    startBudget();
     scopes.clear();
     scopes.push_back(root);
+    currentFunction = nullptr;
+    runningCompiled = false;
+    lastSwitch = chrono::steady_clock::now();
+    if (stream) {
+        //each run of complete statements is executed before the next one is read
+        StatementStream statements;
+        while (!terminated) {
+            auto piece = Source::readStatements(stream, statements);
+            if (!piece) {
+                break;
+            }
+            run(piece);
+        }
+    } else {
+        run(source);
+    }
+    chargeTime();
+}
+
+RUN_RESULTS Interpreter::start() {
+    if (mainFiber) {
+        cout << "error: the script was started already, resume it" << endl;
+        return RUN_SUSPENDED;
+    }
+    mainFiber = new Fiber([this] { execute(); });
+    return resume();
+}
+
+RUN_RESULTS Interpreter::resume() {
+    if (mainFiber) {
+        if (!runOn(mainFiber)) {
+            return RUN_SUSPENDED;
+        }
+        delete mainFiber;
+        mainFiber = nullptr;
+    }
+    return terminated ? RUN_TERMINATED : RUN_FINISHED;
+}
+
+bool Interpreter::runOn(Fiber *task) {
+    Fiber *outer = fiber;
+    fiber = task;
+    bool finished = task->resume();
+    fiber = outer;
+    return finished;
+}
+
+bool Interpreter::await() {
+    if (!fiber || terminating.load(memory_order_relaxed)) {
+        return false;
+    }
+    suspendTask();
+    return true;
+}
+
+// switch away from the task on fiber. what the interpreter holds for it is put aside, so other calls can run
+// on the interpreter meanwhile, and put back once the task is resumed
+void Interpreter::suspendTask() {
+    chargeTime();
+    Fiber *task = fiber;
+    Lex *oriLex = lex;
+    vector<Var *> oriScopes;
+    oriScopes.swap(scopes);
+    vector<InductionLoop *> oriInduction;
+    oriInduction.swap(inductionLoops);
+    vector<LoopInvariants *> oriInvariants;
+    oriInvariants.swap(invariantLoops);
+    FunctionInfo *oriFunction = currentFunction;
+    bool oriCompiled = runningCompiled;
+
+    task->suspend();
+
+    lex = oriLex;
+    scopes.swap(oriScopes);
+    currentScopes();
+    inductionLoops.swap(oriInduction);
+    invariantLoops.swap(oriInvariants);
+    currentFunction = oriFunction;
+    runningCompiled = oriCompiled;
+    lastSwitch = chrono::steady_clock::now();
+}
+
+// a run gets whole slices and its hard limits from the start
+void Interpreter::startBudget() {
+    ops = 0;
+    sliceStartOps = 0;
+    runNs = 0;
+    terminated = false;
+    terminating.store(false, memory_order_relaxed);
+    pollChunk = sliceNs || maxNs ? 1 : 1 << 14;
+    sliceStart = chunkStart = chrono::steady_clock::now();
+    poll.countdown = pollRefill = 0;
+}
+
+// the slow path of a preemption point: take what the countdown counted, then terminate the run, suspend it
+// or count down again, to the closest of the next chunk and the budgets
+bool Interpreter::budgetLeft() {
+    static const long long chunkNs = 50000;
+    ops += pollRefill - poll.countdown;
+    poll.countdown = pollRefill = 0;
+    if (terminated) {
+        return false;
+    }
+    bool timed = sliceNs || maxNs;
+    long long ran = 0;
+    if (timed) {
+        auto now = chrono::steady_clock::now();
+        ran = chrono::duration_cast<chrono::nanoseconds>(now - sliceStart).count();
+        long long chunkRan = chrono::duration_cast<chrono::nanoseconds>(now - chunkStart).count();
+        //ops cost anything from a nanosecond in machine code to a walk over a long array, so the chunk
+        //follows what the last one took, growing at most twofold
+        pollChunk = max(1LL, min(min(1024LL, pollChunk * 2), pollChunk * chunkNs / max(1LL, chunkRan)));
+        chunkStart = now;
+    }
+    if (terminating.load(memory_order_relaxed) || (maxOps && ops > maxOps) || (maxNs && runNs + ran > maxNs)) {
+        terminated = true;
+        return false;
+    }
+    if (fiber && ((sliceOps && ops - sliceStartOps > sliceOps) || (sliceNs && ran >= sliceNs))) {
+        suspendTask();
+        runNs += ran;
+        sliceStart = chunkStart = chrono::steady_clock::now();
+        sliceStartOps = ops - 1; //the op that found the slice used up is the first of the next one
+        if (terminating.load(memory_order_relaxed)) {
+            terminated = true;
+            return false;
+        }
+    }
+    long long next = pollChunk;
+    if (maxOps) {
+        next = min(next, maxOps - ops);
+    }
+    if (fiber && sliceOps) {
+        next = min(next, sliceStartOps + sliceOps - ops);
+    }
+    poll.countdown = pollRefill = max(0LL, next);
+    return true;
+}
+
+int64_t Interpreter::pollExpired(JITPoll *poll) {
+    return ((Interpreter *) poll->context)->budgetLeft() ? 0 : 1;
+}
+
+void Interpreter::execute(const string &file) {
+    if (forked || parent) {
+        cout << "error: a fork, and the interpreter it was forked from, run no other script" << endl;
+        return;
+    }
+    open(file);
+    execute();
+}
+
+void Interpreter::open(const string &file) {
+    if (file == "-") {
+        stream = stdin;
+        source = nullptr;
+    } else {
+        stream = nullptr;
+        source = Source::map(file);
+    }
+}
+
+// the tokens of a script with the same source as piece, nullptr for one not run here yet
+Lex *Interpreter::ranBefore(const shared_ptr<const Source> &piece) {
+    auto range = scripts.equal_range((size_t) piece->length());
+    for (auto it = range.first; it != range.second; ++it) {
+        //the same source run again, as execute() does, needs no compare
+        if (it->second->source == piece) {
+            return it->second;
+        }
+        if (memcmp(it->second->source->data(), piece->data(), (size_t) piece->length()) == 0) {
+            return it->second;
+        }
+    }
+    return nullptr;
+}
+
+// lex and run a piece of the script in the global scope
+void Interpreter::run(const shared_ptr<const Source> &piece) {
+    lex = load(piece);
+    lex->getNextToken();
     STATE state = RUNNING;
-    while (lex->token.type != TK_EOF) {
-        statement(state);
+    statement(state, TK_EOF);
+}
+
+// the tokens of piece, ready to run: the ones of an earlier run, or lexed and optimized now. they are never
+// freed, functions and loops keep pointing into them
+Lex *Interpreter::load(const shared_ptr<const Source> &piece) {
+    Lex *tokens = stream ? nullptr : ranBefore(piece);
+    if (tokens) {
+        tokens->reset();
+    } else {
+        //the pieces of a stream are not cached, the same input is not expected twice
+        bool cached = !cacheDir.empty() && !stream;
+        tokens = cached ? loadCachedTokens(cacheDir, piece, optimize, cacheStats, optimizerStats) : nullptr;
+        if (!tokens) {
+            tokens = new Lex(piece);
+            Optimizer optimizer;
+            if (optimize) {
+                optimizer.run(*tokens);
+                optimizerStats.foldedExpressions += optimizer.stats.foldedExpressions;
+                optimizerStats.foldedNodes += optimizer.stats.foldedNodes;
+                optimizerStats.deadBranches += optimizer.stats.deadBranches;
+            }
+            if (cached) {
+                storeCachedTokens(cacheDir, *tokens, optimize, cacheStats, optimizer.stats);
+            }
+        }
+        if (!stream) {
+            scripts.insert(make_pair((size_t) piece->length(), tokens));
+        }
+    }
+    return tokens;
+}
+
+void Interpreter::compile() {
+    if (stream || !source) {
+        cout << "error: only a script of a file or a string can be compiled ahead of its run" << endl;
+        return;
     }
+    load(source);
 }
 
-void Interpreter::statement(STATE &state) {
-    if (lex->token.type == TK_IDENTIFIER ||
-        lex->token.type == TK_DEC_INT ||
-        lex->token.type == TK_HEX_INT ||
-        lex->token.type == TK_OCTAL_INT ||
-        lex->token.type == TK_FLOAT ||
-        lex->token.type == TK_STRING ||
-        lex->token.type == TK_MINUS || lex->token.type == TK_THIS) {
-        eval(state);
+// execute one statement, or with an end token, every statement up to it.
+// with USE_COMPUTED_GOTO each handler jumps straight to the handler of the next statement
+void Interpreter::statement(STATE &state, TOKEN_TYPES end) {
+    if (end != TK_NOT_VALID && (lex->token.type == end || lex->token.type == TK_EOF)) {
+        return;
+    }
+
+#if USE_COMPUTED_GOTO
+    static void *const handlers[OP_COUNT] = {
+        &&op_INVALID, &&op_EXPRESSION, &&op_BLOCK, &&op_EMPTY, &&op_VAR, &&op_IF, &&op_WHILE, &&op_FOR,
+        &&op_RETURN, &&op_FUNCTION, &&op_EOF, &&op_BREAK, &&op_CONTINUE
+    };
+#define STATEMENT_CASE(op) op_##op
+#define DISPATCH() goto *handlers[statementOps[lex->token.type]]
+#define NEXT_STATEMENT() \
+    do { \
+        if (end == TK_NOT_VALID || lex->token.type == end || lex->token.type == TK_EOF) return; \
+        DISPATCH(); \
+    } while (0)
+
+    DISPATCH();
+#else
+#define STATEMENT_CASE(op) case OP_##op
+#define NEXT_STATEMENT() break
+
+    for (;;) {
+        switch (statementOps[lex->token.type]) {
+#endif
+    STATEMENT_CASE(EXPRESSION): {
+        if (state == RUNNING || !skipOperand(SKIP_STATEMENT)) {
+            if (!fusedUpdate(state)) {
+                eval(state);
+            }
+        }
         lex->match(TK_SEMICOLON);
-    } else if (lex->token.type == TK_L_LARGE_BRACKET) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(BLOCK): {
         block(state);
-    } else if (lex->token.type == TK_SEMICOLON) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(EMPTY): {
         lex->match(TK_SEMICOLON);
-    } else if (lex->token.type == TK_VAR) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(VAR): {
         lex->match(TK_VAR);
         string varName = lex->token.value;
         lex->match(TK_IDENTIFIER);
 
-        auto scope = scopes.back();
-        auto v = scope->findChild(varName);
+        auto v = scopes.back()->findChild(varName);
         if (lex->token.type == TK_ASSIGN) {
             lex->match(TK_ASSIGN);
             auto item = eval(state);
             if (v == nullptr) {
-                scope->addUniqueChild(varName, item->var);
+                own(scopes.back())->addUniqueChild(varName, item->var);
             } else {
-                v->replaceWith(item->var);
+                writable(v)->replaceWith(item->var);
             }
         } else if (lex->token.type == TK_SEMICOLON) {
             if (v == nullptr) {
-                scope->addUniqueChild(varName, new Var());
+                own(scopes.back())->addUniqueChild(varName, new Var());
             }
         }
 
         lex->match(TK_SEMICOLON);
-    } else if (lex->token.type == TK_IF) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(IF): {
         lex->match(TK_IF);
-        lex->match(TK_L_BRACKET);
-        auto cond = eval(state);
+        bool cond = false;
+        if (state != RUNNING && lex->token.match > lex->posNow - 1 && lex->token.match < lex->tokenEnd) {
+            lex->jumpTo(lex->token.match);
+        } else {
+            lex->match(TK_L_BRACKET);
+            cond = condition(state);
+        }
         lex->match(TK_R_BRACKET);
         STATE skipping = SKIPPING;
-        statement(state == RUNNING && cond->var->getBool() ? state : skipping);
+        statement(state == RUNNING && cond ? state : skipping);
         if (lex->token.type == TK_ELSE) {
             lex->match(TK_ELSE);
-            statement(state == RUNNING && cond->var->getBool() ? skipping : state);
+            statement(state == RUNNING && cond ? skipping : state);
         }
-    } else if (lex->token.type == TK_WHILE) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(WHILE): {
+        auto loopBegin = lex->posNow - 1;
         lex->match(TK_WHILE);
 
         lex->match(TK_L_BRACKET);
 
         auto condStart = lex->posNow;
-        auto cond = eval(state);
+        bool cond = condition(state);
         auto condLex = lex->getSubLex(condStart);
 
         lex->match(TK_R_BRACKET);
@@ -84,7 +391,33 @@ void Interpreter::statement(STATE &state) {
 
         if (state == RUNNING) {
             auto oriLex = lex;
-            while (state == RUNNING && cond->var->getBool()) {
+            LoopInfo *loop = jit ? getLoopInfo(loopBegin, lex->posNow - 1) : nullptr;
+            LoopInvariants *invariants = getInvariants(loopBegin, lex->posNow - 1);
+            if (invariants) {
+                invariants->values.clear();
+                invariantLoops.push_back(invariants);
+            }
+            while (state == RUNNING && cond) {
+                if (!checkpoint(state)) {
+                    break;
+                }
+                if (currentFunction) {
+                    currentFunction->backEdges++;
+                }
+                if (loop && ++loop->backEdges >= tierUpBackEdges) {
+                    auto osr = enterCompiledLoop(loop);
+                    if (osr == OSR_FINISHED) {
+                        break;
+                    }
+                    loop = nullptr;
+                    if (osr == OSR_BAILED_OUT) {
+                        lex = condLex;
+                        lex->reset();
+                        lex->getNextToken();
+                        cond = condition(state);
+                        continue;
+                    }
+                }
                 lex = bodyLex;
                 lex->reset();
                 lex->getNextToken();
@@ -95,24 +428,29 @@ void Interpreter::statement(STATE &state) {
                 lex = condLex;
                 lex->reset();
                 lex->getNextToken();
-                cond = eval(state);
+                cond = condition(state);
             }
             if (state == BREAKING) {
                 state = RUNNING;
             }
+            if (invariants) {
+                invariantLoops.pop_back();
+            }
             lex = oriLex;
         }
         delete condLex;
         delete bodyLex;
-
-    } else if (lex->token.type == TK_FOR) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(FOR): {
+        auto loopBegin = lex->posNow - 1;
         lex->match(TK_FOR);
         lex->match(TK_L_BRACKET);
 
         statement(state);
 
         auto condStart = lex->posNow;
-        auto cond = eval(state);
+        bool cond = condition(state);
         auto condLex = lex->getSubLex(condStart);
 
         lex->match(TK_SEMICOLON);
@@ -132,7 +470,37 @@ void Interpreter::statement(STATE &state) {
 
         if (state == RUNNING) {
             auto oriLex = lex;
-            while (state == RUNNING && cond->var->getBool()) {
+            LoopInfo *loop = jit ? getLoopInfo(loopBegin, lex->posNow - 1) : nullptr;
+            LoopInvariants *invariants = getInvariants(loopBegin, lex->posNow - 1);
+            if (invariants) {
+                invariants->values.clear();
+                invariantLoops.push_back(invariants);
+            }
+            InductionLoop *induction = cond ? findInduction(condLex, updateLex, bodyLex) : nullptr;
+            if (induction) {
+                inductionLoops.push_back(induction);
+            }
+            while (state == RUNNING && cond) {
+                if (!checkpoint(state)) {
+                    break;
+                }
+                if (currentFunction) {
+                    currentFunction->backEdges++;
+                }
+                if (loop && ++loop->backEdges >= tierUpBackEdges) {
+                    auto osr = enterCompiledLoop(loop);
+                    if (osr == OSR_FINISHED) {
+                        break;
+                    }
+                    loop = nullptr;
+                    if (osr == OSR_BAILED_OUT) {
+                        lex = condLex;
+                        lex->reset();
+                        lex->getNextToken();
+                        cond = condition(state);
+                        continue;
+                    }
+                }
                 lex = bodyLex;
                 lex->reset();
                 lex->getNextToken();
@@ -141,27 +509,41 @@ void Interpreter::statement(STATE &state) {
                     state = RUNNING;
                 }
 
+                if (induction && state == RUNNING && inductionStep(induction, cond)) {
+                    continue;
+                }
+
                 lex = updateLex;
                 lex->reset();
                 lex->getNextToken();
-                eval(state);
+                if (!fusedUpdate(state)) {
+                    eval(state);
+                }
 
                 lex = condLex;
                 lex->reset();
                 lex->getNextToken();
-                cond = eval(state);
+                cond = condition(state);
             }
             if (state == BREAKING) {
                 state = RUNNING;
             }
+            if (invariants) {
+                invariantLoops.pop_back();
+            }
+            if (induction) {
+                inductionLoops.pop_back();
+                delete induction;
+            }
             lex = oriLex;
         }
 
         delete condLex;
         delete updateLex;
         delete bodyLex;
-
-    } else if (lex->token.type == TK_RETURN) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(RETURN): {
         lex->match(TK_RETURN);
         shared_ptr<VarLink> ret = nullptr;
         if (lex->token.type != TK_SEMICOLON) {
@@ -170,32 +552,151 @@ void Interpreter::statement(STATE &state) {
         if (state == RUNNING) {
             auto retVar = scopes.back()->findChild(JS_RETURN_VAR);
             assert(retVar != nullptr);
-            retVar->replaceWith(ret);
+            writable(retVar)->replaceWith(ret);
             state = SKIPPING;
         }
         lex->match(TK_SEMICOLON);
-    } else if (lex->token.type == TK_FUNCTION) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(FUNCTION): {
         lex->match(TK_FUNCTION);
 
         string name = lex->token.value;
         auto func = parseFuncDefinition(false);
-        scopes.back()->addUniqueChild(name, func);
-
-    } else if (lex->token.type == TK_EOF) {
-
-    } else if (lex->token.type == TK_BREAK) {
+        own(scopes.back())->addUniqueChild(name, func);
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(EOF): {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(BREAK): {
         lex->match(TK_BREAK);
         if (state == RUNNING) {
             state = BREAKING;
         }
-    } else if (lex->token.type == TK_CONTINUE) {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(CONTINUE): {
         lex->match(TK_CONTINUE);
         if (state == RUNNING) {
             state = CONTINUE;
         }
-    } else {
+        NEXT_STATEMENT();
+    }
+    STATEMENT_CASE(INVALID): {
         assert(0);
+        NEXT_STATEMENT();
+    }
+#if !USE_COMPUTED_GOTO
+        }
+        if (end == TK_NOT_VALID || lex->token.type == end || lex->token.type == TK_EOF) {
+            return;
+        }
     }
+#endif
+#undef STATEMENT_CASE
+#undef NEXT_STATEMENT
+#ifdef DISPATCH
+#undef DISPATCH
+#endif
+}
+
+// evaluate an if/while/for condition, `id <op> id|int` runs as one fused compare-and-branch
+bool Interpreter::condition(STATE &state) {
+    if (lex->token.fused == FUSED_CMP_BRANCH && state == RUNNING) {
+        auto lhs = findVar(lex->token.value);
+        const Token &op = (*lex->tokens)[lex->posNow];
+        const Token &rhsTk = (*lex->tokens)[lex->posNow + 1];
+        int rhs = 0;
+        bool intRhs = false;
+        if (rhsTk.type == TK_IDENTIFIER) {
+            auto r = findVar(rhsTk.value);
+            if (r && r->var->isInt()) {
+                rhs = r->var->getInt();
+                intRhs = true;
+            }
+        } else {
+            rhs = rhsTk.getIntData();
+            intRhs = true;
+        }
+        if (lhs && lhs->var->isInt() && intRhs) {
+            int a = lhs->var->getInt();
+            bool result = false;
+            switch (op.type) {
+                case TK_LESS:
+                    result = a < rhs;
+                    break;
+                case TK_L_EQUAL:
+                    result = a <= rhs;
+                    break;
+                case TK_GREATER:
+                    result = a > rhs;
+                    break;
+                case TK_G_EQUAL:
+                    result = a >= rhs;
+                    break;
+                case TK_EQUAL:
+                    result = a == rhs;
+                    break;
+                default:
+                    result = a != rhs;
+            }
+            for (int i = 0; i < 3; i++) {
+                lex->getNextToken();
+            }
+            return result;
+        }
+    }
+    auto cond = eval(state);
+    return state == RUNNING && cond->var->getBool();
+}
+
+// id++, id--, id += x, id -= x, id = id + x and id = id - x on integers, in place when the value is not shared
+bool Interpreter::fusedUpdate(STATE &state) {
+    if (lex->token.fused == FUSED_NONE || lex->token.fused == FUSED_CMP_BRANCH || state != RUNNING) {
+        return false;
+    }
+    auto target = findVar(lex->token.value);
+    if (!target || !target->var->isInt()) {
+        return false;
+    }
+
+    int length, delta;
+    const Token *op;
+    if (lex->token.fused == FUSED_INC) {
+        op = &(*lex->tokens)[lex->posNow];
+        length = 2;
+        delta = 1;
+    } else {
+        int opIdx = lex->token.fused == FUSED_OP_ASSIGN ? lex->posNow : lex->posNow + 2;
+        op = &(*lex->tokens)[opIdx];
+        Token operand = (*lex->tokens)[opIdx + 1];
+        length = opIdx + 2 - (lex->posNow - 1);
+        if (operand.type == TK_IDENTIFIER) {
+            auto v = findVar(operand.value);
+            if (!v || !v->var->isInt()) {
+                return false;
+            }
+            delta = v->var->getInt();
+        } else {
+            delta = operand.getIntData();
+        }
+    }
+    if (op->type == TK_MINUS_MINUS || op->type == TK_MINUS_EQUAL || op->type == TK_MINUS) {
+        delta = -delta;
+    }
+
+    int value = target->var->getInt() + delta;
+    target = writable(target);
+    if (target->var->getRefNum() == 1 && !target->var->frozen) {
+        target->var->setInt(value);
+    } else {
+        target->replaceWith(new Var(value));
+    }
+    for (int i = 0; i < length; i++) {
+        lex->getNextToken();
+    }
+    return true;
 }
 
 // handle =, +=, -=
@@ -206,6 +707,7 @@ shared_ptr<VarLink> Interpreter::eval(STATE &state) {
         lex->match(op);
         auto rhs = eval(state);
         if (state == RUNNING) {
+            lhs = writable(lhs);
             if (op == TK_ASSIGN) {
                 lhs->replaceWith(rhs);
             } else {
@@ -226,9 +728,13 @@ shared_ptr<VarLink> Interpreter::ternary(STATE &state) {
             if (lhs->var->getBool()) {
                 lhs = logic(state);
                 lex->match(TK_COLON);
-                logic(skipping);
+                if (!skipOperand(SKIP_LOGIC)) {
+                    logic(skipping);
+                }
             } else {
-                logic(skipping);
+                if (!skipOperand(SKIP_LOGIC)) {
+                    logic(skipping);
+                }
                 lex->match(TK_COLON);
                 lhs = logic(state);
             }
@@ -261,13 +767,16 @@ shared_ptr<VarLink> Interpreter::logic(STATE &state) {
             }
         }
 
+        if (shortCircuit && skipOperand(SKIP_COMPARE)) {
+            continue;
+        }
         STATE skipping = SKIPPING;
         auto rhs = compare(shortCircuit ? skipping : state);
 
         if (state == RUNNING && !shortCircuit) {
             if (getBool) {
                 lhs->replaceWith(new Var(lhs->var->getBool()));
-                rhs->replaceWith(new Var(rhs->var->getBool()));
+                rhs = make_shared<VarLink>(new Var(rhs->var->getBool()));
             }
             lhs->replaceWith(lhs->var->mathOp(rhs->var, op));
         }
@@ -337,7 +846,7 @@ shared_ptr<VarLink> Interpreter::expression(STATE &state) {
             }
         } else {
             if (state == RUNNING) {
-                auto post = lhs;
+                auto post = writable(lhs);
                 lhs = make_shared<VarLink>(lhs->var->copyThis(), lhs->name);
                 Var one(1);
                 post->replaceWith(post->var->mathOp(&one, op == TK_PLUS_PLUS ? TK_PLUS : TK_MINUS));
@@ -386,10 +895,25 @@ shared_ptr<VarLink> Interpreter::unary(STATE &state) {
 
 // handle (...), primitive value, {...}(json format), var access/function call, array declaration, function declaration
 shared_ptr<VarLink> Interpreter::factor(STATE &state) {
+    int start = lex->posNow - 1;
+    LoopInvariants *invariant = state == RUNNING && !invariantLoops.empty() ? invariantLoop(start) : nullptr;
+    if (invariant) {
+        auto value = invariant->values.find(start);
+        if (value != invariant->values.end()) {
+            bool group = lex->token.type == TK_L_BRACKET;
+            lex->jumpTo(invariant->ends[start]);
+            //(...) gives a value of its own each time, a.b the link of the property itself
+            return group ? make_shared<VarLink>(value->second->var) : value->second;
+        }
+    }
+
     if (lex->token.type == TK_L_BRACKET) {
         lex->match(TK_L_BRACKET);
         auto ret = eval(state);
         lex->match(TK_R_BRACKET);
+        if (invariant && state == RUNNING) {
+            invariant->values[start] = ret;
+        }
         return ret;
     } else if (lex->token.type == TK_DEC_INT || lex->token.type == TK_HEX_INT || lex->token.type == TK_OCTAL_INT ||
                lex->token.type == TK_FLOAT) {
@@ -427,7 +951,7 @@ shared_ptr<VarLink> Interpreter::factor(STATE &state) {
         auto ret = state == RUNNING ? findVar(lex->token.value) : make_shared<VarLink>(new Var());
         auto id = lex->token.type;
         if (state == RUNNING && !ret) {
-            ret = root->addUniqueChild(lex->token.value, new Var());
+            ret = own(root)->addUniqueChild(lex->token.value, new Var());
         }
 
         bool child = false;
@@ -452,34 +976,44 @@ shared_ptr<VarLink> Interpreter::factor(STATE &state) {
 
                 lex = originLex;
                 scopes = originScopes;
+                currentScopes();
 
                 return ret;
             } else if (lex->token.type == TK_DOT) { // . means record access
                 if (!child && ret->var->isObject() && id != TK_THIS) {
-                    ret = ret->var->findChild(JS_THIS_VAR);
+                    ret = current(ret->var)->findChild(JS_THIS_VAR);
                 }
                 child = true;
                 lex->match(TK_DOT);
                 if (state == RUNNING) {
                     auto varName = lex->token.value;
                     if (varName == "length") {
-                        ret = make_shared<VarLink>(new Var(ret->var->getArrayLength()));
+                        ret = make_shared<VarLink>(new Var(current(ret->var)->getArrayLength()));
                     } else {
-                        ret = ret->var->findChildOrCreate(varName);
+                        ret = member(ret->var, varName);
                     }
                     lex->match(TK_IDENTIFIER);
                 }
             } else if (lex->token.type == TK_L_SQUARE_BRACKET) { // [ means array access
                 lex->match(TK_L_SQUARE_BRACKET);
 
-                auto idx = eval(state);
-                if (state == RUNNING) {
-                    ret = ret->var->findChildOrCreate(idx->var->getString());
+                auto element = state == RUNNING && !inductionLoops.empty() ? inductionElement(current(ret->var)) : nullptr;
+                if (element) {
+                    ret = element;
+                    lex->match(TK_IDENTIFIER);
+                } else {
+                    auto idx = eval(state);
+                    if (state == RUNNING) {
+                        ret = member(ret->var, idx->var->getString());
+                    }
                 }
                 lex->match(TK_R_SQUARE_BRACKET);
             }
 
         }
+        if (invariant && state == RUNNING) {
+            invariant->values[start] = ret;
+        }
         return ret;
     } else if (lex->token.type == TK_L_SQUARE_BRACKET) { // [ means array declaration
         lex->match(TK_L_SQUARE_BRACKET);
@@ -488,7 +1022,7 @@ shared_ptr<VarLink> Interpreter::factor(STATE &state) {
         if (state == RUNNING && !ret) {
             ret = make_shared<VarLink>(new Var("", VAR_ARRAY), lex->token.value);
         }
-        Var *var = ret->var;
+        Var *var = own(ret->var);
 
         int index = 0;
         shared_ptr<VarLink> item;
@@ -531,6 +1065,7 @@ shared_ptr<VarLink> Interpreter::factor(STATE &state) {
 
         lex = originLex;
         scopes = originScopes;
+        currentScopes();
 
         return ret;
     }
@@ -545,12 +1080,18 @@ Var *Interpreter::newObject(STATE &state, shared_ptr<VarLink> func, Var *args) {
         num->var->getInt() << " now." << endl;
         return nullptr;
     }
+    if (terminated || (state == RUNNING && !checkpoint(state))) {
+        state = SKIPPING;
+        Var *ret = new Var();
+        ret->addChild(JS_THIS_VAR, new Var());
+        return ret;
+    }
 
     scopes.clear();
     auto funcScope = func->var->findChild(JS_SCOPE)->var;
     int number = func->var->findChild(JS_SCOPE_NUM)->var->getInt();
     for (int i = 0; i < number; i++) {
-        scopes.push_back(funcScope->findChild(to_string(i))->var);
+        scopes.push_back(current(funcScope->findChild(to_string(i))->var));
     }
 
     Var *scope = new Var();
@@ -575,15 +1116,29 @@ Var *Interpreter::newObject(STATE &state, shared_ptr<VarLink> func, Var *args) {
 
     }
 
-    string code = func->var->findChild(JS_FUNCBODY_VAR)->var->getString();
-    lex = new Lex(code);
+    FunctionInfo *info = getFunctionInfo(func->var);
+    FunctionInfo *oriFunction = currentFunction;
+    chargeTime();
+    currentFunction = info;
+    if (state == RUNNING) {
+        info->calls++;
+    }
+
+    Lex *code = functionBody(info);
+    Lex body(*code, code->tokenBegin, code->tokenEnd);
+    lex = &body;
     lex->getNextToken();
 
+    vector<InductionLoop *> oriInduction;
+    oriInduction.swap(inductionLoops);
     auto oriState = state;
-    while (lex->token.type != TK_EOF) {
-        statement(state);
-    }
-    state = oriState;
+    statement(state, TK_EOF);
+    //a terminated run skips on in the caller
+    state = terminated ? SKIPPING : oriState;
+    inductionLoops.swap(oriInduction);
+
+    chargeTime();
+    currentFunction = oriFunction;
 
     Var *ret = new Var();
     ret->addChild(JS_THIS_VAR, scope->findChild(JS_THIS_VAR)->var);
@@ -650,6 +1205,7 @@ Var *Interpreter::parseArguments(STATE &state) {
 }
 
 Var *Interpreter::parseFuncDefinition(bool assign) {
+    string name = assign ? "" : lex->token.value;
     auto func = new Var();
     func->type = VAR_FUNCTION;
 
@@ -684,27 +1240,84 @@ Var *Interpreter::parseFuncDefinition(bool assign) {
 
     func->addChild(JS_ARGC_VAR, new Var(count));
     func->addChild(JS_ARGV_VAR, args);
-    func->addChild(JS_FUNCBODY_VAR, new Var(lex->getFunctionBody()));
+
+    int bodyStart = lex->posNow - 1;
+    auto key = make_pair((const vector<Token> *) lex->tokens.get(), bodyStart);
+    Token bodyToken = lex->token;
+    lex->skipFunctionBody();
+
+    auto id = functionIds.find(key);
+    if (id == functionIds.end()) {
+        auto info = new FunctionInfo();
+        info->name = name;
+        for (int i = 0; i < count; i++) {
+            info->params.push_back(args->findChild(to_string(i))->var->getString());
+        }
+        if (bodyToken.type == TK_FUNCTION_BODY) {
+            info->source = lex->source;
+            info->sourceBegin = bodyToken.pos;
+            info->sourceEnd = bodyToken.end + 1;
+        } else {
+            info->body = new Lex(*lex, bodyStart, lex->posNow - 1);
+        }
+        id = functionIds.insert(make_pair(key, (int) functions.size())).first;
+        functions.push_back(info);
+    }
+    func->addChild(JS_FUNCINFO_VAR, new Var(id->second));
     return func;
 }
 
 Var *Interpreter::callFunction(STATE &state, shared_ptr<VarLink> func, Var *args) {
     auto num = args->findChild(JS_ARGC_VAR);
     auto funcNum = func->var->findChild(JS_ARGC_VAR);
+    if (funcNum->var->getInt() < 0) {
+        return callNative(state, func->var, args);
+    }
     if (num->var->getInt() != funcNum->var->getInt()) {
         cout << "error: expected number of arguments is " << funcNum->var->getInt() << ".But it's " <<
         num->var->getInt() << " now." << endl;
         return nullptr;
     }
+    if (terminated || (state == RUNNING && !checkpoint(state))) {
+        state = SKIPPING;
+        return new Var();
+    }
+
+    FunctionInfo *info = getFunctionInfo(func->var);
+    FunctionInfo *oriFunction = currentFunction;
+    chargeTime();
+    currentFunction = info;
+
+    if (state == RUNNING) {
+        info->calls++;
+        if (jit) {
+            tierUp(info, func->var);
+        }
+        if (info->tier == TIER_JIT) {
+            runningCompiled = true;
+            Var *ret = callCompiled(info, func->var, args);
+            chargeTime();
+            runningCompiled = false;
+            if (!ret && terminated) {
+                state = SKIPPING;
+                ret = new Var();
+            }
+            if (ret) {
+                currentFunction = oriFunction;
+                return ret;
+            }
+        }
+    }
 
     scopes.clear();
     auto funcScope = func->var->findChild(JS_SCOPE)->var;
     int number = func->var->findChild(JS_SCOPE_NUM)->var->getInt();
     for (int i = 0; i < number; i++) {
-        scopes.push_back(funcScope->findChild(to_string(i))->var);
+        scopes.push_back(current(funcScope->findChild(to_string(i))->var));
     }
 
-    Var *scope = new Var();
+    //functions made in the call hold on to it, it goes with the last of them
+    Var *scope = (new Var())->ref();
     scopes.push_back(scope);
     scope->addChild(JS_RETURN_VAR, new Var());
 
@@ -723,33 +1336,112 @@ Var *Interpreter::callFunction(STATE &state, shared_ptr<VarLink> func, Var *args
         }
     }
 
-    string code = func->var->findChild(JS_FUNCBODY_VAR)->var->getString();
-    lex = new Lex(code);
+    Lex *code = functionBody(info);
+    Lex body(*code, code->tokenBegin, code->tokenEnd);
+    lex = &body;
     lex->getNextToken();
 
+    vector<InductionLoop *> oriInduction;
+    oriInduction.swap(inductionLoops);
     auto oriState = state;
-    while (lex->token.type != TK_EOF) {
-        statement(state);
-    }
-    state = oriState;
+    statement(state, TK_EOF);
+    //a terminated run skips on in the caller
+    state = terminated ? SKIPPING : oriState;
+    inductionLoops.swap(oriInduction);
+
+    chargeTime();
+    currentFunction = oriFunction;
 
     Var *ret;
     if (scope->findChild(JS_RETURN_VAR)->var->isFunction()) {
         ret = scope->findChild(JS_RETURN_VAR)->var;
     } else {
         ret = scope->findChild(JS_RETURN_VAR)->var->copyThis();
-        delete scope;
+        scope->unref();
     }
     return ret;
 
 }
 
+// a call of a host function, made only when running. it may suspend the task it runs on (see await)
+Var *Interpreter::callNative(STATE &state, Var *func, Var *args) {
+    if (terminated || state != RUNNING || !checkpoint(state)) {
+        return new Var();
+    }
+    int index = func->findChild(JS_NATIVE_VAR)->var->getInt();
+    if (index < 0 || index >= (int) natives.size()) {
+        //a host function of another interpreter, e.g. one a snapshot was saved from
+        cout << "error: host function " << index << " is not registered with this interpreter" << endl;
+        return new Var();
+    }
+    auto inArgus = args->findChild(JS_ARGV_VAR)->var;
+    int n = args->findChild(JS_ARGC_VAR)->var->getInt();
+    vector<Var *> argv;
+    for (int i = 0; i < n; i++) {
+        argv.push_back(inArgus->findChild(to_string(i))->var);
+    }
+    Var *ret = natives[index](*this, argv);
+    if (terminated) {
+        state = SKIPPING;
+    }
+    return ret ? ret : new Var();
+}
+
+void Interpreter::addNative(const string &name, const NativeFunction &native) {
+    auto func = new Var();
+    func->type = VAR_FUNCTION;
+    func->addChild(JS_ARGC_VAR, new Var(-1));
+    func->addChild(JS_NATIVE_VAR, new Var((int) natives.size()));
+    natives.push_back(native);
+    own(root)->addUniqueChild(name, func);
+}
+
+shared_ptr<VarLink> Interpreter::call(Var *func, const vector<Var *> &args) {
+    Var *argv = (new Var())->ref();
+    auto params = argv->addChild(JS_ARGV_VAR, new Var());
+    for (size_t i = 0; i < args.size(); i++) {
+        params->var->addChild(to_string(i), args[i]);
+    }
+    argv->addChild(JS_ARGC_VAR, new Var((int) args.size()));
+
+    Var *ret = nullptr;
+    if (func->isFunction()) {
+        auto originLex = lex;
+        auto originScopes = scopes;
+        STATE state = RUNNING;
+        ret = callFunction(state, make_shared<VarLink>(func), argv);
+        lex = originLex;
+        scopes = originScopes;
+        currentScopes();
+    } else {
+        cout << "error: " << func->getString() << " is not a function" << endl;
+    }
+    argv->unref();
+    return make_shared<VarLink>(ret ? ret : new Var());
+}
+
+shared_ptr<VarLink> Interpreter::execute(Var *func, const vector<Var *> &args) {
+    startBudget();
+    scopes.clear();
+    scopes.push_back(root);
+    currentFunction = nullptr;
+    runningCompiled = false;
+    lastSwitch = chrono::steady_clock::now();
+    auto ret = call(func, args);
+    chargeTime();
+    return ret;
+}
+
 void Interpreter::block(STATE &state) {
+    int close = lex->token.match;
+    if (state != RUNNING && close > lex->posNow - 1 && close < lex->tokenEnd) {
+        lex->jumpTo(close);
+        lex->match(TK_R_LARGE_BRACKET);
+        return;
+    }
     lex->match(TK_L_LARGE_BRACKET);
     if (state == RUNNING) {
-        while (lex->token.type != TK_EOF && lex->token.type != TK_R_LARGE_BRACKET) {
-            statement(state);
-        }
+        statement(state, TK_R_LARGE_BRACKET);
         lex->match(TK_R_LARGE_BRACKET);
     } else {
         int bracket = 1;
@@ -764,6 +1456,704 @@ void Interpreter::block(STATE &state) {
     }
 }
 
+FunctionInfo *Interpreter::getFunctionInfo(Var *func) {
+    return functionInfo(func->findChild(JS_FUNCINFO_VAR)->var->getInt());
+}
+
+// the tokens of a function body, a pre-parsed one is tokenized (and optimized) here on its first call
+Lex *Interpreter::functionBody(FunctionInfo *info) {
+    if (!info->body) {
+        auto start = chrono::steady_clock::now();
+        info->body = new Lex(info->source, info->sourceBegin, info->sourceEnd);
+        if (optimize) {
+            Optimizer optimizer;
+            optimizer.run(*info->body);
+            optimizerStats.foldedExpressions += optimizer.stats.foldedExpressions;
+            optimizerStats.foldedNodes += optimizer.stats.foldedNodes;
+            optimizerStats.deadBranches += optimizer.stats.deadBranches;
+        }
+        info->parseNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+    return info->body;
+}
+
+// promote a function to machine code once it is hot enough, cold functions never pay for compiling
+void Interpreter::tierUp(FunctionInfo *info, Var *func) {
+    if (info->tier == TIER_COMPILING) {
+        installCompiled(info);
+        return;
+    }
+    if (info->tier != TIER_INTERPRETER || (info->calls < tierUpCalls && info->backEdges < tierUpBackEdges)) {
+        return;
+    }
+    if (compileThreads > 0) {
+        queueCompile(info, func);
+        return;
+    }
+    auto start = chrono::steady_clock::now();
+    auto resolve = [&](const string &name, JITCallee &callee) {
+        return calleeOf(closureBinding(func, name), callee);
+    };
+    info->jitCode = jitCompile(info->name, info->params, *functionBody(info), resolve, inlineBudget);
+    info->tier = info->jitCode ? TIER_JIT : TIER_NOT_COMPILABLE;
+    info->compileNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    lastSwitch = chrono::steady_clock::now();
+}
+
+// hand a hot function to the compile threads, the interpreter keeps running it until the code is installed
+void Interpreter::queueCompile(FunctionInfo *info, Var *func) {
+    if (!compileQueue) {
+        compileQueue = new CompileQueue(compileThreads);
+    }
+    auto job = make_shared<CompileJob>();
+    job->name = info->name;
+    job->params = info->params;
+    if (info->source) {
+        job->source = info->source;
+        job->sourceBegin = info->sourceBegin;
+        job->sourceEnd = info->sourceEnd;
+        job->optimize = optimize;
+    } else {
+        job->body = *info->body;
+    }
+    job->inlineBudget = inlineBudget;
+
+    //the workers cannot look names up in the scopes, so the callees are resolved here: every name the body
+    //calls, and the names called by the ones small enough to be inlined
+    vector<const Lex *> bodies{functionBody(info)};
+    while (!bodies.empty()) {
+        const Lex *body = bodies.back();
+        bodies.pop_back();
+        for (int i = body->tokenBegin; i + 1 < body->tokenEnd; i++) {
+            const Token &tk = (*body->tokens)[i];
+            if (tk.type != TK_IDENTIFIER || (*body->tokens)[i + 1].type != TK_L_BRACKET ||
+                job->callees.count(tk.value)) {
+                continue;
+            }
+            JITCallee callee;
+            if (calleeOf(closureBinding(func, tk.value), callee)) {
+                job->callees[tk.value] = callee;
+                if (callee.body->tokenEnd - callee.body->tokenBegin <= inlineBudget) {
+                    bodies.push_back(callee.body);
+                }
+            }
+        }
+    }
+
+    info->compileJob = job;
+    info->tier = TIER_COMPILING;
+    compileQueue->push(job);
+}
+
+// switch to the code of a finished background compile, done is only set once the code is complete
+void Interpreter::installCompiled(FunctionInfo *info) {
+    CompileJob *job = info->compileJob.get();
+    if (!job->done.load(memory_order_acquire)) {
+        return;
+    }
+    info->jitCode = job->code;
+    job->code = nullptr;
+    info->tier = info->jitCode ? TIER_JIT : TIER_NOT_COMPILABLE;
+    info->compileNs += job->compileNs;
+    info->compileJob.reset();
+}
+
+// run the machine code of a function, nullptr when the guards fail or it bails out
+Var *Interpreter::callCompiled(FunctionInfo *info, Var *func, Var *args) {
+    JITFunction *code = info->jitCode;
+
+    vector<int64_t> argv(code->argc);
+    auto inArgus = args->findChild(JS_ARGV_VAR)->var;
+    for (int i = 0; i < code->argc; i++) {
+        auto arg = inArgus->findChild(to_string(i))->var;
+        if (!arg->isInt()) {
+            return nullptr;
+        }
+        argv[i] = arg->getInt();
+    }
+
+    // the compiled calls go straight to this code, so the name has to resolve to this function
+    if (code->selfCalls && closureBinding(func, info->name) != func) {
+        return nullptr;
+    }
+    // and inlined callees have to be the ones that were compiled in
+    for (auto &site: code->inlined) {
+        JITCallee callee;
+        if (!calleeOf(closureBinding(func, site.name), callee) || callee.binding != site.binding) {
+            return nullptr;
+        }
+    }
+
+    int64_t result;
+    if (!code->call(argv.data(), result, &poll)) {
+        return nullptr;
+    }
+    if (code->resultType == JIT_BOOL) {
+        return new Var(result != 0);
+    }
+    return new Var((int) result);
+}
+
+// what name resolves to in the scopes func was defined in, nullptr if nothing
+Var *Interpreter::closureBinding(Var *func, const string &name) {
+    auto funcScope = func->findChild(JS_SCOPE)->var;
+    int number = func->findChild(JS_SCOPE_NUM)->var->getInt();
+    for (int i = number - 1; i >= 0; i--) {
+        auto v = current(funcScope->findChild(to_string(i))->var)->findChild(name);
+        if (v) {
+            return v->var;
+        }
+    }
+    return nullptr;
+}
+
+// describe a function to the JIT for inlining, bound to its FunctionInfo: every function object of
+// one literal runs the same code
+bool Interpreter::calleeOf(Var *func, JITCallee &callee) {
+    if (!func || !func->isFunction() || !func->findChild(JS_FUNCINFO_VAR)) {
+        return false;
+    }
+    FunctionInfo *info = getFunctionInfo(func);
+    callee.params = info->params;
+    callee.body = functionBody(info);
+    callee.binding = info;
+    return true;
+}
+
+LoopInfo *Interpreter::getLoopInfo(int begin, int end) {
+    auto key = make_pair((const vector<Token> *) lex->tokens.get(), begin);
+    auto it = loopIds.find(key);
+    if (it != loopIds.end()) {
+        return loops[it->second];
+    }
+    auto loop = new LoopInfo();
+    loop->loop = new Lex(*lex, begin, end);
+    loopIds[key] = (int) loops.size();
+    loops.push_back(loop);
+    return loop;
+}
+
+// on-stack replacement: jump into the machine code of a hot loop between two iterations.
+// the variables are read out of the scopes into the compiled frame and written back when it exits
+OSR_RESULTS Interpreter::enterCompiledLoop(LoopInfo *loop) {
+    if (loop->tier == TIER_INTERPRETER) {
+        //every name in the loop that holds an int or bool now, the types are checked again on every entry
+        set<string> seen;
+        for (int i = loop->loop->tokenBegin; i < loop->loop->tokenEnd; i++) {
+            const Token &tk = (*loop->loop->tokens)[i];
+            if (tk.type != TK_IDENTIFIER || !seen.insert(tk.value).second) {
+                continue;
+            }
+            auto v = findVar(tk.value);
+            if (v && (v->var->isInt() || v->var->isBoolean())) {
+                loop->names.push_back(tk.value);
+                loop->types.push_back(v->var->isInt() ? JIT_INT : JIT_BOOL);
+            }
+        }
+        auto start = chrono::steady_clock::now();
+        auto resolve = [&](const string &name, JITCallee &callee) {
+            auto v = findVar(name);
+            return v && calleeOf(v->var, callee);
+        };
+        loop->jitCode = jitCompileLoop(*loop->loop, loop->names, loop->types, resolve, inlineBudget);
+        loop->tier = loop->jitCode ? TIER_JIT : TIER_NOT_COMPILABLE;
+        if (currentFunction) {
+            currentFunction->compileNs +=
+                    chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        }
+    }
+    if (loop->tier != TIER_JIT) {
+        return OSR_NOT_ENTERED;
+    }
+
+    for (auto &site: loop->jitCode->inlined) {
+        auto v = findVar(site.name);
+        JITCallee callee;
+        if (!v || !calleeOf(v->var, callee) || callee.binding != site.binding) {
+            return OSR_NOT_ENTERED;
+        }
+    }
+
+    vector<shared_ptr<VarLink>> links;
+    vector<int64_t> values;
+    for (size_t i = 0; i < loop->names.size(); i++) {
+        auto v = findVar(loop->names[i]);
+        if (!v || (loop->types[i] == JIT_INT ? !v->var->isInt() : !v->var->isBoolean())) {
+            return OSR_NOT_ENTERED;
+        }
+        links.push_back(v);
+        values.push_back(loop->types[i] == JIT_INT ? v->var->getInt() : v->var->getBool());
+    }
+
+    loop->entries++;
+    chargeTime();
+    bool oriCompiled = runningCompiled;
+    runningCompiled = true;
+    int64_t unused;
+    bool finished = loop->jitCode->call(values.data(), unused, &poll);
+    chargeTime();
+    runningCompiled = oriCompiled;
+
+    for (size_t i = 0; i < links.size(); i++) {
+        auto var = links[i]->var;
+        if (loop->types[i] == JIT_BOOL) {
+            if (var->getBool() != (values[i] != 0)) {
+                writable(links[i])->replaceWith(new Var(values[i] != 0));
+            }
+        } else if (var->getInt() != (int) values[i]) {
+            if (var->getRefNum() == 1 && !var->frozen) {
+                var->setInt((int) values[i]);
+            } else {
+                writable(links[i])->replaceWith(new Var((int) values[i]));
+            }
+        }
+    }
+    return finished ? OSR_FINISHED : OSR_BAILED_OUT;
+}
+
+// recognize for (...; i <op> limit; i++ / i-- / i += c / i -= c) with an int counter and an int literal,
+// int variable or array.length limit. nullptr when the loop does not have that shape
+InductionLoop *Interpreter::findInduction(Lex *condLex, Lex *updateLex, Lex *bodyLex) {
+    const vector<Token> &tk = *lex->tokens;
+    int c = condLex->tokenBegin, cn = condLex->tokenEnd - c;
+    int u = updateLex->tokenBegin, un = updateLex->tokenEnd - u;
+    if (cn < 3 || tk[c].type != TK_IDENTIFIER || un < 2 || tk[u].type != TK_IDENTIFIER ||
+        tk[u].value != tk[c].value) {
+        return nullptr;
+    }
+    TOKEN_TYPES op = tk[c + 1].type;
+    if (op != TK_LESS && op != TK_L_EQUAL && op != TK_GREATER && op != TK_G_EQUAL && op != TK_N_EQUAL) {
+        return nullptr;
+    }
+
+    int step;
+    if (un == 2 && (tk[u + 1].type == TK_PLUS_PLUS || tk[u + 1].type == TK_MINUS_MINUS)) {
+        step = tk[u + 1].type == TK_PLUS_PLUS ? 1 : -1;
+    } else if (un == 3 && (tk[u + 1].type == TK_PLUS_EQUAL || tk[u + 1].type == TK_MINUS_EQUAL) &&
+               tk[u + 2].type == TK_DEC_INT) {
+        step = tk[u + 1].type == TK_PLUS_EQUAL ? tk[u + 2].getIntData() : -tk[u + 2].getIntData();
+    } else {
+        return nullptr;
+    }
+
+    const Token &limit = tk[c + 2];
+    bool limitIsLength = false;
+    if (cn == 5 && limit.type == TK_IDENTIFIER && tk[c + 3].type == TK_DOT && tk[c + 4].value == "length") {
+        limitIsLength = true;
+    } else if (cn != 3 || (limit.type != TK_IDENTIFIER && limit.type != TK_DEC_INT && limit.type != TK_HEX_INT &&
+                           limit.type != TK_OCTAL_INT)) {
+        return nullptr;
+    }
+
+    //a var or function with either name in the body could shadow the links taken here
+    string name = tk[c].value;
+    bool counterFixed = true;
+    for (int i = bodyLex->tokenBegin; i < bodyLex->tokenEnd; i++) {
+        TOKEN_TYPES type = tk[i].type;
+        if ((type == TK_VAR || type == TK_FUNCTION) && i + 1 < bodyLex->tokenEnd &&
+            (tk[i + 1].value == name || (limit.type == TK_IDENTIFIER && tk[i + 1].value == limit.value))) {
+            return nullptr;
+        }
+        if (type == TK_NEW || type == TK_FUNCTION || type == TK_PLUS_PLUS || type == TK_MINUS_MINUS ||
+            (type == TK_L_BRACKET && i > bodyLex->tokenBegin && (tk[i - 1].type == TK_IDENTIFIER ||
+                                                                tk[i - 1].type == TK_R_SQUARE_BRACKET ||
+                                                                tk[i - 1].type == TK_R_BRACKET)) ||
+            //a store to the limit could make it another, shorter array after the condition ran
+            (type == TK_IDENTIFIER && (tk[i].value == name || (limit.type == TK_IDENTIFIER &&
+                                                               tk[i].value == limit.value)) &&
+             i + 1 < bodyLex->tokenEnd &&
+             (tk[i + 1].type == TK_ASSIGN || tk[i + 1].type == TK_PLUS_EQUAL || tk[i + 1].type == TK_MINUS_EQUAL))) {
+            counterFixed = false;
+        }
+    }
+
+    auto counter = findVar(name);
+    if (!counter || !counter->var->isInt()) {
+        return nullptr;
+    }
+    auto loop = new InductionLoop();
+    loop->name = name;
+    loop->counter = counter;
+    loop->step = step;
+    loop->start = counter->var->getInt();
+    loop->compare = op;
+    loop->limitIsLength = limitIsLength;
+    loop->counterFixed = counterFixed;
+    if (limit.type == TK_IDENTIFIER) {
+        loop->limit = findVar(limit.value);
+        if (!loop->limit) {
+            delete loop;
+            return nullptr;
+        }
+    } else {
+        loop->limitValue = limit.getIntData();
+    }
+    return loop;
+}
+
+bool Interpreter::inductionLimit(InductionLoop *loop, int &limit) {
+    if (!loop->limit) {
+        limit = loop->limitValue;
+        return true;
+    }
+    loop->limit = currentLink(loop->limit);
+    Var *v = current(loop->limit->var);
+    if (loop->limitIsLength) {
+        if (!v->isArray()) {
+            return false;
+        }
+        if (loop->limitArray != v || loop->limitLastChild != v->lastChild) {
+            loop->limitArray = v;
+            loop->limitLastChild = v->lastChild;
+            loop->limitLength = v->getArrayLength();
+        }
+        limit = loop->limitLength;
+        return true;
+    }
+    if (!v->isInt()) {
+        return false;
+    }
+    limit = v->getInt();
+    return true;
+}
+
+// the update and the condition of an induction loop on unboxed ints, false to take the generic path
+bool Interpreter::inductionStep(InductionLoop *loop, bool &cond) {
+    loop->counter = currentLink(loop->counter);
+    Var *v = loop->counter->var;
+    int limit;
+    if (!v->isInt() || !inductionLimit(loop, limit)) {
+        return false;
+    }
+    int value = v->getInt() + loop->step;
+    if (v->getRefNum() == 1 && !v->frozen) {
+        v->setInt(value);
+    } else {
+        loop->counter = writable(loop->counter);
+        loop->counter->replaceWith(new Var(value));
+    }
+    switch (loop->compare) {
+        case TK_LESS:
+            cond = value < limit;
+            break;
+        case TK_L_EQUAL:
+            cond = value <= limit;
+            break;
+        case TK_GREATER:
+            cond = value > limit;
+            break;
+        case TK_G_EQUAL:
+            cond = value >= limit;
+            break;
+        default:
+            cond = value != limit;
+    }
+    return true;
+}
+
+// array[counter] inside an induction loop: the element straight from a snapshot of the array,
+// nullptr when the generic path has to look it up (or create it)
+shared_ptr<VarLink> Interpreter::inductionElement(Var *array) {
+    if (lex->token.type != TK_IDENTIFIER || lex->posNow >= lex->tokenEnd ||
+        (*lex->tokens)[lex->posNow].type != TK_R_SQUARE_BRACKET || !array->isArray()) {
+        return nullptr;
+    }
+    InductionLoop *loop = nullptr;
+    for (int i = (int) inductionLoops.size() - 1; i >= 0 && !loop; i--) {
+        if (inductionLoops[i]->name == lex->token.value) {
+            loop = inductionLoops[i];
+        }
+    }
+    if (!loop || !loop->counter->var->isInt()) {
+        return nullptr;
+    }
+
+    ArraySnapshot *snapshot = nullptr;
+    for (auto &a: loop->arrays) {
+        if (a.array == array) {
+            snapshot = &a;
+        }
+    }
+    if (!snapshot || snapshot->lastChild != array->lastChild) {
+        if (!snapshot) {
+            loop->arrays.push_back(ArraySnapshot());
+            snapshot = &loop->arrays.back();
+            snapshot->array = array;
+        }
+        snapshot->lastChild = array->lastChild;
+        snapshot->elements.assign(array->getArrayLength(), nullptr);
+        for (auto link = array->firstChild; link; link = link->nextSibling) {
+            int idx = atoi(link->name.c_str());
+            if (idx >= 0 && to_string(idx) == link->name) {
+                snapshot->elements[idx] = link;
+            }
+        }
+        //counter starts at >= 0, only goes up, and stops before limit.length
+        snapshot->inRange = loop->counterFixed && loop->limitIsLength && loop->compare == TK_LESS &&
+                            loop->step > 0 && loop->start >= 0;
+    }
+
+    int idx = loop->counter->var->getInt();
+    bool inRange = snapshot->inRange && loop->limit->var == array;
+    if (!inRange && (idx < 0 || idx >= (int) snapshot->elements.size())) {
+        return nullptr;
+    }
+    return snapshot->elements[idx];
+}
+
+static bool isStoreOp(TOKEN_TYPES type) {
+    return type == TK_ASSIGN || type == TK_PLUS_EQUAL || type == TK_MINUS_EQUAL || type == TK_PLUS_PLUS ||
+           type == TK_MINUS_MINUS;
+}
+
+// what a parenthesized invariant may hold besides names: literals and operators without side effects
+static bool isPure(TOKEN_TYPES type) {
+    switch (type) {
+        case TK_DEC_INT:
+        case TK_HEX_INT:
+        case TK_OCTAL_INT:
+        case TK_FLOAT:
+        case TK_STRING:
+        case TK_TRUE:
+        case TK_FALSE:
+        case TK_PLUS:
+        case TK_MINUS:
+        case TK_MULTIPLY:
+        case TK_DIVIDE:
+        case TK_MOD:
+        case TK_BITWISE_AND:
+        case TK_BITWISE_OR:
+        case TK_BITWISE_XOR:
+        case TK_AND_AND:
+        case TK_OR_OR:
+        case TK_EQUAL:
+        case TK_N_EQUAL:
+        case TK_TYPEEQUAL:
+        case TK_N_TYPEEQUAL:
+        case TK_LESS:
+        case TK_GREATER:
+        case TK_L_EQUAL:
+        case TK_G_EQUAL:
+        case TK_L_SHIFT:
+        case TK_R_SHIFT:
+        case TK_NOT:
+        case TK_BITWISE_NOT:
+        case TK_QUESTION_MARK:
+        case TK_COLON:
+        case TK_L_BRACKET:
+        case TK_R_BRACKET:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// the loop invariants of the while/for in tokens [begin, end), nullptr when it has none.
+// the loop is given up on as soon as it calls or news anything, since that can store anywhere
+LoopInvariants *Interpreter::getInvariants(int begin, int end) {
+    auto key = make_pair((const vector<Token> *) lex->tokens.get(), begin);
+    auto it = invariantSites.find(key);
+    if (it != invariantSites.end()) {
+        return it->second;
+    }
+    invariantSites[key] = nullptr;
+
+    const vector<Token> &tk = *lex->tokens;
+    auto type = [&](int i) { return i >= begin && i < end ? tk[i].type : TK_NOT_VALID; };
+
+    //the stores of the loop: names assigned, properties assigned through a dot, anything through [...]
+    set<string> storedNames, storedProps;
+    bool elementStores = false;
+    for (int i = begin; i < end; i++) {
+        TOKEN_TYPES prev = type(i - 1), next = type(i + 1);
+        bool indexed = prev == TK_IDENTIFIER || prev == TK_THIS || prev == TK_R_SQUARE_BRACKET;
+        if (tk[i].type == TK_NEW || tk[i].type == TK_FUNCTION ||
+            (tk[i].type == TK_L_BRACKET && (indexed || prev == TK_R_BRACKET)) ||
+            (tk[i].type == TK_L_SQUARE_BRACKET && !indexed) || //[a, ...] adds elements to a
+            (tk[i].type == TK_R_BRACKET && isStoreOp(next))) {
+            return nullptr;
+        }
+        if (tk[i].type == TK_VAR && next == TK_IDENTIFIER) {
+            storedNames.insert(tk[i + 1].value);
+        } else if (tk[i].type == TK_IDENTIFIER && isStoreOp(next)) {
+            (prev == TK_DOT ? storedProps : storedNames).insert(tk[i].value);
+        } else if (tk[i].type == TK_R_SQUARE_BRACKET && isStoreOp(next)) {
+            elementStores = true;
+        }
+    }
+
+    auto loop = new LoopInvariants();
+    for (int i = begin; i < end; i++) {
+        TOKEN_TYPES prev = type(i - 1);
+        if ((tk[i].type == TK_IDENTIFIER || tk[i].type == TK_THIS) && prev != TK_DOT && prev != TK_VAR &&
+            type(i + 1) == TK_DOT && !storedNames.count(tk[i].value)) {
+            //name.prop.prop: the link of the last property stays the same while no name before it is
+            //reassigned; .length also changes with any element or property stored
+            int j = i;
+            bool invariant = true;
+            while (type(j + 1) == TK_DOT && type(j + 2) == TK_IDENTIFIER) {
+                if (j > i && (storedProps.count(tk[j].value) || elementStores || tk[j].value == "length")) {
+                    invariant = false;
+                }
+                j += 2;
+            }
+            TOKEN_TYPES next = type(j + 1);
+            if (tk[j].value == "length" && (elementStores || !storedProps.empty())) {
+                invariant = false;
+            }
+            if (invariant && j > i && next != TK_DOT && next != TK_L_SQUARE_BRACKET && next != TK_L_BRACKET &&
+                !isStoreOp(next)) {
+                loop->ends[i] = j + 1;
+            }
+            i = j;
+        } else if (tk[i].type == TK_L_BRACKET && prev != TK_IF && prev != TK_WHILE && prev != TK_FOR) {
+            //(expression) over literals and names the loop never stores to
+            int depth = 0, names = 0, j = i;
+            bool invariant = true;
+            for (; j < end; j++) {
+                TOKEN_TYPES t = tk[j].type;
+                if (t == TK_L_BRACKET) {
+                    depth++;
+                } else if (t == TK_R_BRACKET && --depth == 0) {
+                    break;
+                } else if (t == TK_IDENTIFIER) {
+                    TOKEN_TYPES next = type(j + 1);
+                    if (storedNames.count(tk[j].value) || next == TK_DOT || next == TK_L_SQUARE_BRACKET ||
+                        next == TK_L_BRACKET) {
+                        invariant = false;
+                    }
+                    names++;
+                } else if (!isPure(t)) {
+                    invariant = false;
+                }
+            }
+            //(name) alone is not worth it, a findVar is all it costs
+            if (invariant && j < end && names && j - i > 2) {
+                loop->ends[i] = j + 1;
+            }
+        }
+    }
+    if (loop->ends.empty()) {
+        delete loop;
+        return nullptr;
+    }
+    invariantSites[key] = loop;
+    return loop;
+}
+
+// the outermost running loop the expression starting at token index is invariant in
+LoopInvariants *Interpreter::invariantLoop(int index) {
+    for (auto loop: invariantLoops) {
+        if (loop->ends.count(index)) {
+            return loop;
+        }
+    }
+    return nullptr;
+}
+
+// step over the expression starting at the current token without walking it: up to the first token
+// at bracket depth 0 that ends an operand at that level, jumping over every (...), [...] and {...}.
+// false, with nothing consumed, when a bracket on the way does not pair up inside this lex
+bool Interpreter::skipOperand(SKIP_LEVELS level) {
+    const vector<Token> &tk = *lex->tokens;
+    int i = lex->posNow - 1;
+    for (; i < lex->tokenEnd; i++) {
+        TOKEN_TYPES type = tk[i].type;
+        if (type == TK_L_BRACKET || type == TK_L_SQUARE_BRACKET || type == TK_L_LARGE_BRACKET) {
+            if (tk[i].match <= i || tk[i].match >= lex->tokenEnd) {
+                return false;
+            }
+            i = tk[i].match;
+            continue;
+        }
+        if (type == TK_SEMICOLON || type == TK_R_BRACKET || type == TK_R_SQUARE_BRACKET ||
+            type == TK_R_LARGE_BRACKET) {
+            break;
+        }
+        if (level != SKIP_STATEMENT && (type == TK_QUESTION_MARK || type == TK_COLON || type == TK_COMMA ||
+                                        type == TK_ASSIGN || type == TK_PLUS_EQUAL || type == TK_MINUS_EQUAL)) {
+            break;
+        }
+        if (level == SKIP_COMPARE && (type == TK_AND_AND || type == TK_OR_OR || type == TK_BITWISE_AND ||
+                                      type == TK_BITWISE_OR || type == TK_BITWISE_XOR)) {
+            break;
+        }
+    }
+    lex->jumpTo(i);
+    return true;
+}
+
+// charge the time since the last switch to the function that ran
+void Interpreter::chargeTime() {
+    auto now = chrono::steady_clock::now();
+    long long ns = chrono::duration_cast<chrono::nanoseconds>(now - lastSwitch).count();
+    lastSwitch = now;
+    if (!currentFunction) {
+        scriptNs += ns;
+    } else if (runningCompiled) {
+        currentFunction->compiledNs += ns;
+    } else {
+        currentFunction->interpretedNs += ns;
+    }
+}
+
+void Interpreter::tierReport(ostream &os) {
+    static const char *tierNames[] = {"interpreter", "jit", "not compilable", "compiling"};
+    //a fork lists the shared functions it called
+    vector<FunctionInfo *> sorted;
+    copy_if(functions.begin(), functions.end(), back_inserter(sorted), [](FunctionInfo *info) { return info; });
+    sort(sorted.begin(), sorted.end(), [](FunctionInfo *a, FunctionInfo *b) {
+        return a->interpretedNs + a->compiledNs > b->interpretedNs + b->compiledNs;
+    });
+
+    os << left << setw(20) << "function" << setw(16) << "tier" << right << setw(10) << "calls"
+    << setw(12) << "back-edges" << setw(14) << "interp(ms)" << setw(12) << "jit(ms)" << setw(14) << "compile(ms)"
+    << setw(8) << "parsed" << setw(12) << "parse(ms)" << endl;
+    os << fixed << setprecision(3);
+    for (auto info: sorted) {
+        os << left << setw(20) << (info->name.empty() ? "(anonymous)" : info->name) << setw(16)
+        << tierNames[info->tier] << right << setw(10) << info->calls << setw(12) << info->backEdges
+        << setw(14) << info->interpretedNs / 1e6 << setw(12) << info->compiledNs / 1e6
+        << setw(14) << info->compileNs / 1e6 << setw(8) << (info->body ? "yes" : "no")
+        << setw(12) << info->parseNs / 1e6 << endl;
+    }
+    os << left << setw(20) << "(script)" << setw(16) << "interpreter" << right << setw(10) << 1 << setw(12) << "-"
+    << setw(14) << scriptNs / 1e6 << setw(12) << 0.0 << setw(14) << 0.0 << setw(8) << "yes" << setw(12) << "-"
+    << endl;
+
+    //loops that were considered for on-stack replacement, entries in the calls column
+    for (auto loop: loops) {
+        const Token &first = (*loop->loop->tokens)[loop->loop->tokenBegin];
+        int line = 1 + (int) count(loop->loop->source->begin(), loop->loop->source->begin() + first.pos, '\n');
+        os << left << setw(20) << ("loop:" + to_string(line)) << setw(16) << tierNames[loop->tier] << right
+        << setw(10) << loop->entries << setw(12) << loop->backEdges << endl;
+    }
+
+    //call sites the JIT compiled the callee into
+    for (auto info: functions) {
+        if (info && info->jitCode) {
+            for (auto &site: info->jitCode->inlined) {
+                os << "inlined " << site.name << " into " << (info->name.empty() ? "(anonymous)" : info->name)
+                << " at line " << site.line << endl;
+            }
+        }
+    }
+    for (auto loop: loops) {
+        if (loop->jitCode) {
+            const Token &first = (*loop->loop->tokens)[loop->loop->tokenBegin];
+            int line = 1 + (int) count(loop->loop->source->begin(), loop->loop->source->begin() + first.pos, '\n');
+            for (auto &site: loop->jitCode->inlined) {
+                os << "inlined " << site.name << " into loop:" << line << " at line " << site.line << endl;
+            }
+        }
+    }
+}
+
+void Interpreter::optimizerReport(ostream &os) {
+    os << "folded expressions: " << optimizerStats.foldedExpressions << ", folded nodes: "
+    << optimizerStats.foldedNodes << ", dead branches: " << optimizerStats.deadBranches << endl;
+}
+
 shared_ptr<VarLink> Interpreter::findVar(const string &varName) {
     for (int i = (int) scopes.size() - 1; i >= 0; i--) {
         auto var = scopes[i]->findChild(varName);
@@ -773,3 +2163,191 @@ shared_ptr<VarLink> Interpreter::findVar(const string &varName) {
     }
     return nullptr;
 }
+
+//straight from the token text, no string is made for the name
+shared_ptr<VarLink> Interpreter::findVar(const TokenText &varName) {
+    for (int i = (int) scopes.size() - 1; i >= 0; i--) {
+        auto var = scopes[i]->findChild(varName.data(), (size_t) varName.length());
+        if (var) {
+            return var;
+        }
+    }
+    return nullptr;
+}
+
+// everything below is what lets forks share a frozen heap: reads go to the frozen vars until this interpreter
+// writes, a write first copies the one var it changes (its value and its list of children, not what they link
+// to). from then on the copy stands for the frozen var wherever this interpreter looks a child up
+
+void Interpreter::freeze() {
+    vector<Var *> pending{root};
+    while (!pending.empty()) {
+        Var *var = pending.back();
+        pending.pop_back();
+        if (var->frozen) {
+            continue;
+        }
+        var->frozen = true;
+        for (auto link = var->firstChild; link; link = link->nextSibling) {
+            if (!link->var->frozen) {
+                pending.push_back(link->var);
+            }
+        }
+    }
+}
+
+Interpreter::~Interpreter() {
+    //a suspended run is unwound before its stack goes
+    if (mainFiber) {
+        terminate();
+        resume();
+    }
+    delete compileQueue;
+    for (auto &copy: copies) {
+        copy.second->unref();
+    }
+    //the closures of global functions link back to root, they are let go first
+    if (!parent) {
+        root->removeAllChildren();
+        root->unref();
+    }
+    for (size_t id = 0; id < forkedFunctions; id++) {
+        FunctionInfo *info = functions[id];
+        if (info) {
+            if (info->jitCode != sharedFunction((int) id)->jitCode) {
+                delete info->jitCode;
+            }
+            delete info->body;
+            delete info;
+        }
+    }
+    for (size_t id = forkedFunctions; id < functions.size(); id++) {
+        delete functions[id]->jitCode;
+        delete functions[id]->body;
+        delete functions[id];
+    }
+    for (auto loop: loops) {
+        delete loop->jitCode;
+        delete loop->loop;
+        delete loop;
+    }
+    for (auto &site: invariantSites) {
+        delete site.second;
+    }
+    //loops of a run that never got to their end
+    for (auto loop: inductionLoops) {
+        delete loop;
+    }
+    for (auto &script: scripts) {
+        delete script.second;
+    }
+}
+
+Interpreter *Interpreter::fork(const string &file) {
+    if (!copies.empty()) {
+        cout << "error: a fork that wrote to the shared heap cannot be forked" << endl;
+        return nullptr;
+    }
+    {
+        lock_guard<mutex> lock(forkLock);
+        if (!forked) {
+            freeze();
+            forked = true;
+        }
+    }
+
+    auto child = new Interpreter(file);
+    child->root->unref();
+    child->root = root;
+    child->parent = this;
+    child->functions.assign(functions.size(), nullptr);
+    child->forkedFunctions = functions.size();
+    child->natives = natives;
+    child->jit = jit;
+    child->tierUpCalls = tierUpCalls;
+    child->tierUpBackEdges = tierUpBackEdges;
+    child->inlineBudget = inlineBudget;
+    child->optimize = optimize;
+    child->cacheDir = cacheDir;
+    return child;
+}
+
+// the info the interpreter this was forked from has for function id, which it no longer changes
+const FunctionInfo *Interpreter::sharedFunction(int id) {
+    Interpreter *from = parent;
+    while (!from->functions[id]) {
+        from = from->parent;
+    }
+    return from->functions[id];
+}
+
+// the counters, the tier and the body of a function change as it runs, a fork changes a copy of its own.
+// the copy shares the machine code, and the body without counting references to the tokens: every call makes a
+// view of the body, and those counts would be shared by every fork calling the function on every core
+FunctionInfo *Interpreter::forkFunction(int id) {
+    const FunctionInfo *shared = sharedFunction(id);
+    auto info = new FunctionInfo(*shared);
+    if (shared->body) {
+        info->body = new Lex(*shared->body, shared->body->tokenBegin, shared->body->tokenEnd);
+        info->body->source = shared_ptr<const Source>(shared_ptr<const Source>(), shared->body->source.get());
+        info->body->tokens = shared_ptr<vector<Token>>(shared_ptr<vector<Token>>(), shared->body->tokens.get());
+    }
+    //a compile the parent queued is left to it, this fork tiers up on its own
+    if (info->tier == TIER_COMPILING) {
+        info->tier = TIER_INTERPRETER;
+        info->compileJob = nullptr;
+    }
+    functions[id] = info;
+    return info;
+}
+
+Var *Interpreter::own(Var *var) {
+    if (!var->frozen) {
+        return var;
+    }
+    auto found = copies.find(var);
+    if (found != copies.end()) {
+        return found->second;
+    }
+    Var *copy = var->shallowCopy()->ref();
+    copies[var] = copy;
+    if (root == var) {
+        root = copy;
+    }
+    for (auto &scope: scopes) {
+        if (scope == var) {
+            scope = copy;
+        }
+    }
+    return copy;
+}
+
+shared_ptr<VarLink> Interpreter::writable(const shared_ptr<VarLink> &link) {
+    if (!link->owner || !link->owner->frozen) {
+        return link;
+    }
+    return own(link->owner)->findChild(link->name);
+}
+
+shared_ptr<VarLink> Interpreter::currentLink(const shared_ptr<VarLink> &link) {
+    if (!link->owner || !link->owner->frozen || copies.empty()) {
+        return link;
+    }
+    auto found = copies.find(link->owner);
+    return found == copies.end() ? link : found->second->findChild(link->name);
+}
+
+void Interpreter::currentScopes() {
+    if (!copies.empty()) {
+        for (auto &scope: scopes) {
+            scope = current(scope);
+        }
+    }
+}
+
+// the property name of container, a missing one is added to it
+shared_ptr<VarLink> Interpreter::member(Var *container, const string &name) {
+    container = current(container);
+    auto link = container->findChild(name);
+    return link ? link : own(container)->findChildOrCreate(name);
+}
@@ -7,8 +7,20 @@
 
 #include "Lex.h"
 #include "Var.h"
+#include "JIT.h"
+#include "Optimizer.h"
+#include "CompileQueue.h"
+#include "TokenCache.h"
+#include "Fiber.h"
 #include <string>
 #include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <functional>
 #include <stdio.h>
 
 using namespace std;
@@ -20,16 +32,144 @@ enum STATE {
     CONTINUE
 };
 
+// how far skipOperand goes: a whole statement up to ;, a ternary arm, an operand of && and ||
+enum SKIP_LEVELS {
+    SKIP_STATEMENT,
+    SKIP_LOGIC,
+    SKIP_COMPARE
+};
+
+enum FUNCTION_TIERS {
+    TIER_INTERPRETER,
+    TIER_JIT,
+    TIER_NOT_COMPILABLE, //tried the JIT, stays in the interpreter
+    TIER_COMPILING //queued for the compile threads, interpreted until the code is ready
+};
+
+// one per function literal in the source, shared by every function object created from it
+struct FunctionInfo {
+    string name;
+    vector<string> params;
+    Lex *body = nullptr; //view over the tokens of { ... }, nullptr until the first call for a lazy body
+
+    //a body that was only pre-parsed: where its { ... } is in the source
+    shared_ptr<const Source> source;
+    int sourceBegin = 0;
+    int sourceEnd = 0;
+    long long parseNs = 0;
+
+    //hotness, only calls made by the interpreter are counted, not the ones inside machine code
+    long long calls = 0;
+    long long backEdges = 0;
+
+    FUNCTION_TIERS tier = TIER_INTERPRETER;
+    JITFunction *jitCode = nullptr;
+    shared_ptr<CompileJob> compileJob; //while TIER_COMPILING
+
+    //self time, callees not included
+    long long interpretedNs = 0;
+    long long compiledNs = 0;
+    long long compileNs = 0;
+};
+
+// how far start() or resume() got
+enum RUN_RESULTS {
+    RUN_FINISHED,
+    RUN_SUSPENDED, //used up its slice, resume() runs it on
+    RUN_TERMINATED //went over a hard limit or was terminated, unwound to the end of the script
+};
+
+enum OSR_RESULTS {
+    OSR_NOT_ENTERED,
+    OSR_FINISHED,
+    OSR_BAILED_OUT //the variables hold the values at the top of an iteration, interpret from there
+};
+
+// one per while/for in the source, counts iterations across every run of the loop
+struct LoopInfo {
+    Lex *loop = nullptr; //view over the tokens from while/for to the end of the body
+    long long backEdges = 0;
+    long long entries = 0; //jumps from the interpreter into the machine code
+
+    FUNCTION_TIERS tier = TIER_INTERPRETER;
+    JITFunction *jitCode = nullptr;
+    vector<string> names; //variables mapped into the compiled frame
+    vector<JIT_TYPES> types;
+};
+
+// elements of an array by index, taken when a loop first indexes it with its counter
+struct ArraySnapshot {
+    Var *array = nullptr;
+    shared_ptr<VarLink> lastChild; //anything appended makes the snapshot stale
+    vector<shared_ptr<VarLink>> elements;
+    bool inRange = false; //0 <= counter < array.length holds for the whole loop, no bounds check
+};
+
+// for (...; i < limit; i++) with an int counter: the counter and the limit are read through links
+// resolved once per run of the loop, instead of a findVar per token and a boxed compare per iteration
+struct InductionLoop {
+    string name;
+    shared_ptr<VarLink> counter;
+    int step = 1;
+    int start = 0;
+    TOKEN_TYPES compare = TK_LESS;
+
+    int limitValue = 0;
+    shared_ptr<VarLink> limit; //nullptr for an int literal
+    bool limitIsLength = false; //limit.length
+
+    bool counterFixed = false; //the body neither writes the counter or the limit nor calls anything that could
+
+    //limit.length as of the last iteration, recounted once the array gets a new child
+    int limitLength = 0;
+    Var *limitArray = nullptr;
+    shared_ptr<VarLink> limitLastChild;
+
+    vector<ArraySnapshot> arrays;
+};
+
+// the property loads (a.b.length) and parenthesized expressions of a while/for that nothing in it can
+// change: the loop makes no calls and stores to none of the names they read. each is evaluated on
+// first use in a run of the loop and reused for the rest of that run
+struct LoopInvariants {
+    unordered_map<int, int> ends; //token index of the first token -> index of the token after it
+    unordered_map<int, shared_ptr<VarLink>> values; //the current run
+};
+
+class Interpreter;
+
+// a function of the host, called with the values of the arguments. what it returns is the value of the call,
+// nullptr for undefined
+typedef function<Var *(Interpreter &interpreter, const vector<Var *> &args)> NativeFunction;
+
 class Interpreter {
 private:
-    string code;
+    shared_ptr<const Source> source;
+    FILE *stream = nullptr; //read and run statement by statement instead
     Lex *lex;
     vector<Var *> scopes;
 
-    void statement(STATE &state);
+    void open(const string &file);
+
+    void run(const shared_ptr<const Source> &piece);
+
+    Lex *load(const shared_ptr<const Source> &piece);
+
+    //the token streams of the scripts run so far, by source length
+    unordered_multimap<size_t, Lex *> scripts;
+
+    Lex *ranBefore(const shared_ptr<const Source> &piece);
+
+    void statement(STATE &state, TOKEN_TYPES end = TK_NOT_VALID);
 
     void block(STATE &state);
 
+    bool skipOperand(SKIP_LEVELS level);
+
+    bool condition(STATE &state);
+
+    bool fusedUpdate(STATE &state);
+
     shared_ptr<VarLink> eval(STATE &state);
 
     shared_ptr<VarLink> ternary(STATE &state);
@@ -50,23 +190,277 @@ private:
 
     shared_ptr<VarLink> findVar(const string &varName);
 
+    shared_ptr<VarLink> findVar(const TokenText &varName);
+
     shared_ptr<VarLink> parseJSON(STATE &state);
 
+    vector<FunctionInfo *> functions;
+    map<pair<const vector<Token> *, int>, int> functionIds; //token stream and position of the body
+
+    FunctionInfo *getFunctionInfo(Var *func);
+
+    FunctionInfo *functionInfo(int id) {
+        FunctionInfo *info = functions[id];
+        return info ? info : forkFunction(id);
+    }
+
+    Lex *functionBody(FunctionInfo *info);
+
+    void tierUp(FunctionInfo *info, Var *func);
+
+    CompileQueue *compileQueue = nullptr;
+
+    void queueCompile(FunctionInfo *info, Var *func);
+
+    void installCompiled(FunctionInfo *info);
+
+    Var *closureBinding(Var *func, const string &name);
+
+    bool calleeOf(Var *func, JITCallee &callee);
+
+    Var *callCompiled(FunctionInfo *info, Var *func, Var *args);
+
+    vector<LoopInfo *> loops;
+    map<pair<const vector<Token> *, int>, int> loopIds; //token stream and position of while/for
+
+    LoopInfo *getLoopInfo(int begin, int end);
+
+    OSR_RESULTS enterCompiledLoop(LoopInfo *loop);
+
+    vector<InductionLoop *> inductionLoops; //the running ones, innermost last, per function activation
+
+    InductionLoop *findInduction(Lex *condLex, Lex *updateLex, Lex *bodyLex);
+
+    bool inductionLimit(InductionLoop *loop, int &limit);
+
+    bool inductionStep(InductionLoop *loop, bool &cond);
+
+    shared_ptr<VarLink> inductionElement(Var *array);
+
+    map<pair<const vector<Token> *, int>, LoopInvariants *> invariantSites; //nullptr for none
+    vector<LoopInvariants *> invariantLoops; //the running ones, outermost first
+
+    LoopInvariants *getInvariants(int begin, int end);
+
+    LoopInvariants *invariantLoop(int index);
+
+    //the function running now, nullptr for the script itself
+    FunctionInfo *currentFunction = nullptr;
+    bool runningCompiled = false;
+    long long scriptNs = 0;
+    chrono::steady_clock::time_point lastSwitch;
+
+    void chargeTime();
+
+    //frozen vars this interpreter wrote to -> the copies it reads and writes instead
+    unordered_map<Var *, Var *> copies;
+    bool forked = false;
+    mutex forkLock; //forks are made from any thread
+
+    void freeze();
+
+    //the budget: every loop iteration and call counts poll.countdown down, the checks below run once it
+    //drops below zero. ops holds what was counted before the last refill
+    JITPoll poll;
+    long long pollRefill = 0; //what countdown was set to
+    long long pollChunk = 0; //how much it is set to when no budget is closer, sized to about chunkNs with time budgets
+    long long ops = 0;
+    long long sliceStartOps = 0;
+    long long runNs = 0; //running time before the current slice
+    chrono::steady_clock::time_point sliceStart;
+    chrono::steady_clock::time_point chunkStart;
+    atomic<bool> terminating{false};
+    bool terminated = false;
+    Fiber *fiber = nullptr; //the task running now, see runOn
+    Fiber *mainFiber = nullptr; //the one start() runs the script on
+
+    //a preemption point, false once the run is terminated: state is then SKIPPING, so everything up to
+    //the end of the script is skipped
+    bool checkpoint(STATE &state) {
+        if (--poll.countdown < 0 && !budgetLeft()) {
+            state = SKIPPING;
+            return false;
+        }
+        return true;
+    }
+
+    bool budgetLeft();
+
+    static int64_t pollExpired(JITPoll *poll);
+
+    void startBudget();
+
+    void suspendTask();
+
+    //a native function var has JS_ARGC_VAR -1, any number of arguments, and its index here as JS_NATIVE_VAR
+    vector<NativeFunction> natives;
+
+    Var *callNative(STATE &state, Var *func, Var *args);
+
+    //a fork: the interpreter it was forked from. the first forkedFunctions entries of functions start as
+    //nullptr and become this fork's own copy of the info on the function's first call
+    Interpreter *parent = nullptr;
+    size_t forkedFunctions = 0;
+
+    const FunctionInfo *sharedFunction(int id);
+
+    FunctionInfo *forkFunction(int id);
+
+    Var *current(Var *var) {
+        if (var->frozen && !copies.empty()) {
+            auto found = copies.find(var);
+            if (found != copies.end()) {
+                return found->second;
+            }
+        }
+        return var;
+    }
+
+    //var, or its copy when it is frozen: the var to write to
+    Var *own(Var *var);
+
+    //link, or the same child of the copy of its owner when the owner is frozen: the link to write to
+    shared_ptr<VarLink> writable(const shared_ptr<VarLink> &link);
+
+    //a link kept across statements, as the copy of its owner has it if there is one
+    shared_ptr<VarLink> currentLink(const shared_ptr<VarLink> &link);
+
+    void currentScopes();
+
+    shared_ptr<VarLink> member(Var *container, const string &name);
+
 
 public:
+    //"-" runs a script piped in on stdin as it arrives, any other file is mapped and lexed in place
     Interpreter(const string &file) {
-        const int maxSize = 1000000; // support 1MB code;
-        char code[maxSize];
-        FILE *fin = fopen(file.c_str(), "r");
-        fread(code, 1, maxSize, fin);
-        this->code = string(code);
-        root = new Var(VAR_BLANK, VAR_OBJECT);
+        open(file);
+        root = (new Var(VAR_BLANK, VAR_OBJECT))->ref();
+        poll.expired = &Interpreter::pollExpired;
+        poll.context = this;
+    }
+
+    //the script in script, a string of its own (see Source) or a file mapped before
+    explicit Interpreter(const shared_ptr<const Source> &script) : source(script) {
+        root = (new Var(VAR_BLANK, VAR_OBJECT))->ref();
+        poll.expired = &Interpreter::pollExpired;
+        poll.context = this;
     }
 
+    //no script yet, see execute(file)
+    Interpreter() {
+        root = (new Var(VAR_BLANK, VAR_OBJECT))->ref();
+        poll.expired = &Interpreter::pollExpired;
+        poll.context = this;
+    }
+
+    ~Interpreter();
+
     Var *root;
 
+    bool jit = false; //run hot functions as x86-64 machine code, Linux x86-64 only
+
+    //a function is compiled once it was called tierUpCalls times or looped tierUpBackEdges times,
+    //a loop is compiled and entered mid-run after tierUpBackEdges iterations
+    int tierUpCalls = 10;
+    int tierUpBackEdges = 1000;
+
+    //largest function body, in tokens, the JIT compiles into its callers instead of calling
+    int inlineBudget = 40;
+
+    //threads that compile hot functions in the background, 0 compiles them on the spot
+    int compileThreads = 0;
+
+    void setTierThresholds(int calls, int backEdges) {
+        tierUpCalls = calls;
+        tierUpBackEdges = backEdges;
+    }
+
+    void tierReport(ostream &os);
+
+    bool optimize = true; //fold constants and drop dead branches before running
+    OptimizerStats optimizerStats;
+
+    void optimizerReport(ostream &os);
+
+    //the token stream of the script is kept in this directory and reused while the script is unchanged,
+    //empty for none
+    string cacheDir;
+    TokenCacheStats cacheStats;
+
+    //budgets, 0 for none. ops counts loop iterations and function calls, ns the time spent running. a run
+    //from start() is suspended every slice; a run over a hard limit (max) is terminated: whatever it runs
+    //then is skipped, so it unwinds through the script like a return. checked at loop back-edges and function
+    //entries, interpreted or compiled, so a slice overruns by at most one iteration of a loop with no calls
+    long long sliceOps = 0;
+    long long sliceNs = 0;
+    long long maxOps = 0;
+    long long maxNs = 0;
+
     void execute();
 
+    //lex and optimize the script now instead of on its first run, which then only runs it. not for "-"
+    void compile();
+
+    //call() as a run of its own: the budgets start over and the time is taken, as for execute()
+    shared_ptr<VarLink> execute(Var *func, const vector<Var *> &args);
+
+    //execute() on a stack of its own, suspended whenever it used up a slice. the calling thread is free to
+    //run other scripts in between, resume() the run on it later
+    RUN_RESULTS start();
+
+    RUN_RESULTS resume();
+
+    //stop the run at its next preemption point, from any thread. a suspended run is finished by its next
+    //resume()
+    void terminate() {
+        terminating.store(true, memory_order_relaxed);
+    }
+
+    //a global function name that runs native
+    void addNative(const string &name, const NativeFunction &native);
+
+    //call func, a function of this interpreter's heap, from the host. args nothing else refers to are freed
+    //along with the call
+    shared_ptr<VarLink> call(Var *func, const vector<Var *> &args);
+
+    //resume task, a fiber running the script of start() or a call(), until it returns or suspends. true once
+    //it returned
+    bool runOn(Fiber *task);
+
+    //for a native: suspend the task that called it, until the task is resumed with runOn. other tasks and
+    //calls can run on the interpreter meanwhile. false when there is no task to suspend, or it is being
+    //terminated
+    bool await();
+
+    bool wasTerminated() const {
+        return terminated;
+    }
+
+    //loop iterations and calls of the last run
+    long long opsRun() const {
+        return ops + pollRefill - poll.countdown;
+    }
+
+    //run the script in file next, over the globals the scripts before it left. a script this interpreter ran
+    //before keeps its tokens, and with them its functions, loops and compiled code: it is not lexed again and
+    //starts at the tier it got to
+    void execute(const string &file);
+
+    //an interpreter for file over this one's heap, for running a request in a pristine copy of a warmed up
+    //global environment. the heap is frozen and shared by all forks, a fork copies a var the first time it
+    //writes to it, so making and deleting one costs about what its script changed. this interpreter is not
+    //run again, delete its forks before it. forks run on any threads in parallel, each on one at a time
+    Interpreter *fork(const string &file);
+
+    //write the heap reachable from root (values, objects, arrays, functions and their closures) to file.
+    //a host function is saved as its index in natives: call addNative again in the same order after
+    //loadSnapshot, a call of one that is not there is an error
+    bool saveSnapshot(const string &file);
+
+    //make root the heap saved in file, call it before execute. the snapshot is mapped, nothing in it
+    //is parsed or run
+    bool loadSnapshot(const string &file);
+
     Var *parseFuncDefinition(bool assign);
 
     Var *parseArguments(STATE &state);
@@ -0,0 +1,54 @@
+//
+// An interpreter confined to one thread at a time, with nothing mutable shared with other isolates.
+//
+
+#include "Isolate.h"
+
+Isolate::Isolate() : interpreter(new Interpreter()) {
+}
+
+Isolate::Isolate(const string &file) : interpreter(new Interpreter(file)) {
+}
+
+Isolate::Isolate(Interpreter &warm, const string &file) : interpreter(warm.fork(file)), forked(true) {
+}
+
+Isolate::~Isolate() {
+    delete interpreter;
+}
+
+bool Isolate::execute() {
+    if (!interpreter) {
+        return false;
+    }
+    if (running.exchange(true, memory_order_acquire)) {
+        cout << "error: the isolate is running already" << endl;
+        return false;
+    }
+    interpreter->execute();
+    running.store(false, memory_order_release);
+    return true;
+}
+
+bool Isolate::execute(const string &file, const string &input) {
+    if (!interpreter || forked) {
+        return false;
+    }
+    if (running.exchange(true, memory_order_acquire)) {
+        cout << "error: the isolate is running already" << endl;
+        return false;
+    }
+    interpreter->root->removeAllChildren();
+    interpreter->root->addChild("input", new Var(input));
+    interpreter->execute(file);
+    running.store(false, memory_order_release);
+    return true;
+}
+
+string Isolate::global(const string &name) {
+    if (!interpreter) {
+        return "";
+    }
+    auto link = interpreter->root->findChild(name);
+    return link ? link->var->getString() : "";
+}
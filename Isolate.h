@@ -0,0 +1,50 @@
+//
+// An interpreter confined to one thread at a time, with nothing mutable shared with other isolates.
+//
+
+#ifndef TINYJS_ISOLATE_H
+#define TINYJS_ISOLATE_H
+
+#include "Interpreter.h"
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+// the heap, functions, loops and machine code an isolate runs on are its own: a fresh heap, or a fork of a
+// warmed up one whose frozen vars it shares read-only. isolates run in parallel on any threads, process-wide
+// there is only configuration (Lex::lexThreads, the scanning kernel) set on startup
+class Isolate {
+public:
+    //a fresh heap, for scripts run with execute(file, input)
+    Isolate();
+
+    //a fresh heap for the script in file
+    explicit Isolate(const string &file);
+
+    //the script in file over a fork of warm's heap, see Interpreter::fork. any thread can fork warm, which
+    //has to outlive the isolate
+    Isolate(Interpreter &warm, const string &file);
+
+    ~Isolate();
+
+    //run the script on the calling thread. false when the isolate is running already, here or on another
+    //thread, or when the fork could not be made
+    bool execute();
+
+    //run the script in file over fresh globals but for one, input. what the isolate learnt running scripts
+    //before is kept (see Interpreter::execute(file)), so one run again is neither lexed nor compiled again.
+    //false for a fork, as for execute()
+    bool execute(const string &file, const string &input);
+
+    //a global after execute as a string, empty when there is none
+    string global(const string &name);
+
+    Interpreter *interpreter;
+
+private:
+    atomic<bool> running{false};
+    bool forked = false; //runs its one script, the globals are the shared heap
+};
+
+#endif //TINYJS_ISOLATE_H
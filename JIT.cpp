@@ -0,0 +1,1195 @@
+//
+// Baseline JIT: compiles a function body to x86-64 machine code.
+//
+// The body is parsed with the same grammar as Interpreter (ternary > logic > compare > shift >
+// expression > term > unary > factor) into a small typed tree, then every node is emitted as a
+// fixed instruction template. Values live unboxed in eax, locals in 8 byte slots below rbp.
+// Types are checked while parsing, so the only guards left at run time are the argument types
+// (checked by the caller) and division by zero, which bails out to the interpreter.
+//
+// A hot loop can also be compiled on its own and entered between two iterations (on-stack
+// replacement): the variables it uses come in as slots and are written back when it exits.
+//
+// Calls to small functions defined elsewhere are inlined: the callee's body is parsed at the call
+// site with its params and locals in slots of the caller, so the call costs no frame at all.
+//
+// Every function entry and loop iteration counts one down from the budget passed in (JITPoll), so code
+// running here can be suspended or terminated the way the interpreter's can.
+//
+
+#include "JIT.h"
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_X86_64 1
+#include <sys/mman.h>
+#else
+#define JIT_X86_64 0
+#endif
+
+//returned instead of a value when the compiled code gives up
+static const int64_t JIT_BAILOUT = INT64_MIN;
+
+enum JIT_NODES {
+    N_INT,
+    N_BOOL,
+    N_SLOT,
+    N_BINARY,
+    N_LOGIC,
+    N_NOT,
+    N_BITNOT,
+    N_NEG,
+    N_TERNARY,
+    N_CALL,
+    N_INLINE, //statements binding the params and locals of an inlined body, then its return value
+
+    N_ASSIGN,
+    N_DISCARD,
+    N_IF,
+    N_WHILE,
+    N_FOR,
+    N_RETURN,
+    N_BLOCK,
+    N_BREAK,
+    N_CONTINUE
+};
+
+struct JITNode {
+    JIT_NODES kind;
+    JIT_TYPES type;
+    TOKEN_TYPES op = TK_NOT_VALID;
+    int value = 0; //constant or slot
+    vector<JITNode *> kids;
+};
+
+class JITParser {
+public:
+    JITParser(const string &name, const vector<string> &params, const Lex &body, JIT_TYPES returnType)
+            : name(name), lex(body, body.tokenBegin, body.tokenEnd), returnType(returnType) {
+        for (auto &param: params) {
+            declare(param, JIT_INT);
+        }
+        paramCount = (int) params.size();
+    }
+
+    // a loop of the interpreter, its variables keep the types they have right now
+    JITParser(const Lex &loop, const vector<string> &names, const vector<JIT_TYPES> &types)
+            : lex(loop, loop.tokenBegin, loop.tokenEnd), returnType(JIT_INT), loopMode(true) {
+        for (size_t i = 0; i < names.size(); i++) {
+            declare(names[i], types[i]);
+        }
+        paramCount = (int) names.size();
+    }
+
+    JITNode *parseBody() {
+        lex.getNextToken();
+        if (!expect(TK_L_LARGE_BRACKET)) {
+            return nullptr;
+        }
+        auto body = node(N_BLOCK, JIT_INT);
+        while (!failed && lex.token.type != TK_R_LARGE_BRACKET && lex.token.type != TK_EOF) {
+            body->kids.push_back(statement());
+        }
+        if (!expect(TK_R_LARGE_BRACKET) || lex.token.type != TK_EOF || returns == 0) {
+            return fail();
+        }
+        return failed ? nullptr : body;
+    }
+
+    // the for init already ran in the interpreter, only the condition, update and body are compiled
+    JITNode *parseLoop() {
+        lex.getNextToken();
+        JITNode *loop = nullptr;
+        if (lex.token.type == TK_FOR) {
+            loop = forLoop(false);
+        } else if (lex.token.type == TK_WHILE) {
+            loop = statement();
+        }
+        if (failed || !loop || lex.token.type != TK_EOF) {
+            return fail();
+        }
+        return loop;
+    }
+
+    bool failed = false;
+    bool selfCalls = false;
+    bool mayBail = false;
+    int paramCount = 0;
+    vector<JIT_TYPES> slotTypes;
+
+    JITResolver resolve;
+    int inlineBudget = 0;
+    vector<JITInlined> inlined;
+
+private:
+    string name;
+    Lex lex;
+    JIT_TYPES returnType;
+    bool loopMode = false; //no var, return or calls, other than in inlined bodies
+    bool inlining = false; //only leaf functions are inlined, a call in an inlined body is not compiled
+    map<string, int> slots;
+    int depth = 0; //var is only compiled at the top level of the body, where it always runs
+    int loops = 0;
+    int returns = 0;
+    vector<unique_ptr<JITNode>> nodes;
+
+    JITNode *node(JIT_NODES kind, JIT_TYPES type) {
+        nodes.push_back(unique_ptr<JITNode>(new JITNode()));
+        nodes.back()->kind = kind;
+        nodes.back()->type = type;
+        return nodes.back().get();
+    }
+
+    JITNode *fail() {
+        failed = true;
+        return nullptr;
+    }
+
+    bool expect(TOKEN_TYPES type) {
+        if (failed || lex.token.type != type) {
+            failed = true;
+            return false;
+        }
+        lex.getNextToken();
+        return true;
+    }
+
+    TOKEN_TYPES peek() {
+        return lex.posNow < lex.tokenEnd ? (*lex.tokens)[lex.posNow].type : TK_EOF;
+    }
+
+    int declare(const string &id, JIT_TYPES type) {
+        int slot = (int) slotTypes.size();
+        slots[id] = slot;
+        slotTypes.push_back(type);
+        return slot;
+    }
+
+    JITNode *statement() {
+        if (failed) {
+            return nullptr;
+        }
+        switch (lex.token.type) {
+            case TK_L_LARGE_BRACKET: {
+                lex.getNextToken();
+                auto block = node(N_BLOCK, JIT_INT);
+                depth++;
+                while (!failed && lex.token.type != TK_R_LARGE_BRACKET && lex.token.type != TK_EOF) {
+                    block->kids.push_back(statement());
+                }
+                depth--;
+                return expect(TK_R_LARGE_BRACKET) ? block : nullptr;
+            }
+            case TK_SEMICOLON:
+                lex.getNextToken();
+                return node(N_BLOCK, JIT_INT);
+            case TK_VAR: {
+                if (depth != 0) {
+                    return fail();
+                }
+                lex.getNextToken();
+                string id = lex.token.value;
+                if (!expect(TK_IDENTIFIER) || !expect(TK_ASSIGN)) {
+                    return nullptr;
+                }
+                auto value = eval();
+                if (!value || !expect(TK_SEMICOLON)) {
+                    return fail();
+                }
+                auto it = slots.find(id);
+                int slot = it == slots.end() ? declare(id, value->type) : it->second;
+                if (slotTypes[slot] != value->type) {
+                    return fail();
+                }
+                auto assign = node(N_ASSIGN, value->type);
+                assign->op = TK_ASSIGN;
+                assign->value = slot;
+                assign->kids.push_back(value);
+                return assign;
+            }
+            case TK_IF: {
+                lex.getNextToken();
+                auto branch = node(N_IF, JIT_INT);
+                if (!expect(TK_L_BRACKET)) {
+                    return nullptr;
+                }
+                branch->kids.push_back(eval());
+                if (!expect(TK_R_BRACKET)) {
+                    return nullptr;
+                }
+                depth++;
+                branch->kids.push_back(statement());
+                if (lex.token.type == TK_ELSE) {
+                    lex.getNextToken();
+                    branch->kids.push_back(statement());
+                }
+                depth--;
+                return failed ? nullptr : branch;
+            }
+            case TK_WHILE: {
+                lex.getNextToken();
+                auto loop = node(N_WHILE, JIT_INT);
+                if (!expect(TK_L_BRACKET)) {
+                    return nullptr;
+                }
+                loop->kids.push_back(eval());
+                if (!expect(TK_R_BRACKET)) {
+                    return nullptr;
+                }
+                depth++;
+                loops++;
+                loop->kids.push_back(statement());
+                loops--;
+                depth--;
+                return failed ? nullptr : loop;
+            }
+            case TK_FOR:
+                return forLoop(true);
+            case TK_RETURN: {
+                if (loopMode) {
+                    return fail();
+                }
+                lex.getNextToken();
+                auto value = eval();
+                if (!value || value->type != returnType || !expect(TK_SEMICOLON)) {
+                    return fail();
+                }
+                returns++;
+                auto ret = node(N_RETURN, value->type);
+                ret->kids.push_back(value);
+                return ret;
+            }
+            case TK_BREAK:
+            case TK_CONTINUE: {
+                //the interpreter leaves the ; to an empty statement, so do we
+                if (loops == 0) {
+                    return fail();
+                }
+                auto jump = node(lex.token.type == TK_BREAK ? N_BREAK : N_CONTINUE, JIT_INT);
+                lex.getNextToken();
+                return jump;
+            }
+            case TK_IDENTIFIER: {
+                auto s = simpleStatement();
+                return expect(TK_SEMICOLON) ? s : nullptr;
+            }
+            default:
+                return fail();
+        }
+    }
+
+    JITNode *forLoop(bool compileInit) {
+        lex.getNextToken();
+        auto loop = node(N_FOR, JIT_INT);
+        if (!expect(TK_L_BRACKET)) {
+            return nullptr;
+        }
+        if (compileInit) {
+            loop->kids.push_back(statement());
+        } else {
+            int nesting = 0;
+            while (nesting > 0 || lex.token.type != TK_SEMICOLON) {
+                if (lex.token.type == TK_EOF) {
+                    return fail();
+                }
+                if (lex.token.type == TK_L_BRACKET || lex.token.type == TK_L_SQUARE_BRACKET ||
+                    lex.token.type == TK_L_LARGE_BRACKET) {
+                    nesting++;
+                } else if (lex.token.type == TK_R_BRACKET || lex.token.type == TK_R_SQUARE_BRACKET ||
+                           lex.token.type == TK_R_LARGE_BRACKET) {
+                    nesting--;
+                }
+                lex.getNextToken();
+            }
+            lex.getNextToken();
+            loop->kids.push_back(node(N_BLOCK, JIT_INT));
+        }
+        loop->kids.push_back(eval());
+        if (!expect(TK_SEMICOLON)) {
+            return nullptr;
+        }
+        loop->kids.push_back(simpleStatement());
+        if (!expect(TK_R_BRACKET)) {
+            return nullptr;
+        }
+        depth++;
+        loops++;
+        loop->kids.push_back(statement());
+        loops--;
+        depth--;
+        return failed ? nullptr : loop;
+    }
+
+    // id = e, id += e, id -= e, id++, id-- or a call whose value is dropped
+    JITNode *simpleStatement() {
+        if (failed || lex.token.type != TK_IDENTIFIER) {
+            return fail();
+        }
+        if (peek() == TK_L_BRACKET) {
+            auto call = factor();
+            if (!call || (call->kind != N_CALL && call->kind != N_INLINE)) {
+                return fail();
+            }
+            auto discard = node(N_DISCARD, call->type);
+            discard->kids.push_back(call);
+            return discard;
+        }
+
+        auto it = slots.find(lex.token.value);
+        if (it == slots.end()) {
+            return fail();
+        }
+        lex.getNextToken();
+        auto assign = node(N_ASSIGN, slotTypes[it->second]);
+        assign->value = it->second;
+        TOKEN_TYPES op = lex.token.type;
+        lex.getNextToken();
+        if (op == TK_PLUS_PLUS || op == TK_MINUS_MINUS) {
+            auto one = node(N_INT, JIT_INT);
+            one->value = 1;
+            assign->op = op == TK_PLUS_PLUS ? TK_PLUS_EQUAL : TK_MINUS_EQUAL;
+            assign->kids.push_back(one);
+        } else if (op == TK_ASSIGN || op == TK_PLUS_EQUAL || op == TK_MINUS_EQUAL) {
+            assign->op = op;
+            assign->kids.push_back(eval());
+        } else {
+            return fail();
+        }
+        if (failed || assign->kids[0]->type != assign->type ||
+            (assign->op != TK_ASSIGN && assign->type != JIT_INT)) {
+            return fail();
+        }
+        return assign;
+    }
+
+    JITNode *binary(JIT_NODES kind, JIT_TYPES type, TOKEN_TYPES op, JITNode *lhs, JITNode *rhs) {
+        auto n = node(kind, type);
+        n->op = op;
+        n->kids.push_back(lhs);
+        n->kids.push_back(rhs);
+        return n;
+    }
+
+    JITNode *eval() {
+        auto lhs = ternary();
+        if (lex.token.type == TK_ASSIGN || lex.token.type == TK_PLUS_EQUAL || lex.token.type == TK_MINUS_EQUAL) {
+            return fail();
+        }
+        return lhs;
+    }
+
+    JITNode *ternary() {
+        auto lhs = logic();
+        while (lhs && lex.token.type == TK_QUESTION_MARK) {
+            lex.getNextToken();
+            auto a = logic();
+            if (!a || !expect(TK_COLON)) {
+                return fail();
+            }
+            auto b = logic();
+            if (!b || a->type != b->type) {
+                return fail();
+            }
+            auto n = node(N_TERNARY, a->type);
+            n->kids = {lhs, a, b};
+            lhs = n;
+        }
+        return lhs;
+    }
+
+    JITNode *logic() {
+        auto lhs = compare();
+        while (lhs && (lex.token.type == TK_BITWISE_AND || lex.token.type == TK_BITWISE_OR ||
+                       lex.token.type == TK_BITWISE_XOR || lex.token.type == TK_AND_AND ||
+                       lex.token.type == TK_OR_OR)) {
+            TOKEN_TYPES op = lex.token.type;
+            lex.getNextToken();
+            auto rhs = compare();
+            if (!rhs) {
+                return fail();
+            }
+            if (op == TK_AND_AND || op == TK_OR_OR) {
+                //a short circuit hands back the left value itself, so it has to be a bool already
+                if (lhs->type != JIT_BOOL) {
+                    return fail();
+                }
+                lhs = binary(N_LOGIC, JIT_BOOL, op, lhs, rhs);
+            } else {
+                if (lhs->type != JIT_INT || rhs->type != JIT_INT) {
+                    return fail();
+                }
+                lhs = binary(N_BINARY, JIT_INT, op, lhs, rhs);
+            }
+        }
+        return lhs;
+    }
+
+    JITNode *compare() {
+        auto lhs = shift();
+        while (lhs && (lex.token.type == TK_EQUAL || lex.token.type == TK_N_EQUAL ||
+                       lex.token.type == TK_TYPEEQUAL || lex.token.type == TK_N_TYPEEQUAL ||
+                       lex.token.type == TK_LESS || lex.token.type == TK_L_EQUAL ||
+                       lex.token.type == TK_GREATER || lex.token.type == TK_G_EQUAL)) {
+            TOKEN_TYPES op = lex.token.type;
+            lex.getNextToken();
+            auto rhs = shift();
+            if (!rhs || lhs->type != JIT_INT || rhs->type != JIT_INT) {
+                return fail();
+            }
+            if (op == TK_TYPEEQUAL) {
+                op = TK_EQUAL;
+            } else if (op == TK_N_TYPEEQUAL) {
+                op = TK_N_EQUAL;
+            }
+            lhs = binary(N_BINARY, JIT_BOOL, op, lhs, rhs);
+        }
+        return lhs;
+    }
+
+    JITNode *shift() {
+        auto lhs = expression();
+        if (lhs && (lex.token.type == TK_L_SHIFT || lex.token.type == TK_R_SHIFT)) {
+            TOKEN_TYPES op = lex.token.type;
+            lex.getNextToken();
+            auto rhs = expression();
+            if (!rhs || lhs->type != JIT_INT || rhs->type != JIT_INT) {
+                return fail();
+            }
+            lhs = binary(N_BINARY, JIT_INT, op, lhs, rhs);
+        }
+        return lhs;
+    }
+
+    JITNode *expression() {
+        bool negative = false;
+        if (lex.token.type == TK_MINUS) {
+            lex.getNextToken();
+            negative = true;
+        }
+        auto lhs = term();
+        if (lhs && negative) {
+            if (lhs->type != JIT_INT) {
+                return fail();
+            }
+            auto n = node(N_NEG, JIT_INT);
+            n->kids.push_back(lhs);
+            lhs = n;
+        }
+        while (lhs && (lex.token.type == TK_PLUS || lex.token.type == TK_MINUS)) {
+            TOKEN_TYPES op = lex.token.type;
+            lex.getNextToken();
+            auto rhs = term();
+            if (!rhs || lhs->type != JIT_INT || rhs->type != JIT_INT) {
+                return fail();
+            }
+            lhs = binary(N_BINARY, JIT_INT, op, lhs, rhs);
+        }
+        if (lex.token.type == TK_PLUS_PLUS || lex.token.type == TK_MINUS_MINUS) {
+            return fail();
+        }
+        return lhs;
+    }
+
+    JITNode *term() {
+        auto lhs = unary();
+        while (lhs && (lex.token.type == TK_MULTIPLY || lex.token.type == TK_DIVIDE || lex.token.type == TK_MOD)) {
+            TOKEN_TYPES op = lex.token.type;
+            lex.getNextToken();
+            auto rhs = unary();
+            if (!rhs || lhs->type != JIT_INT || rhs->type != JIT_INT) {
+                return fail();
+            }
+            if (op != TK_MULTIPLY) {
+                mayBail = true;
+            }
+            lhs = binary(N_BINARY, JIT_INT, op, lhs, rhs);
+        }
+        return lhs;
+    }
+
+    JITNode *unary() {
+        if (lex.token.type == TK_NOT || lex.token.type == TK_BITWISE_NOT) {
+            bool logicalNot = lex.token.type == TK_NOT;
+            lex.getNextToken();
+            auto operand = factor();
+            if (!operand) {
+                return fail();
+            }
+            auto n = node(logicalNot ? N_NOT : N_BITNOT, logicalNot ? JIT_BOOL : JIT_INT);
+            n->kids.push_back(operand);
+            return n;
+        }
+        return factor();
+    }
+
+    JITNode *factor() {
+        if (failed) {
+            return nullptr;
+        }
+        switch (lex.token.type) {
+            case TK_L_BRACKET: {
+                lex.getNextToken();
+                auto e = eval();
+                return e && expect(TK_R_BRACKET) ? e : fail();
+            }
+            case TK_DEC_INT:
+            case TK_HEX_INT:
+            case TK_OCTAL_INT: {
+                auto n = node(N_INT, JIT_INT);
+                n->value = lex.token.getIntData();
+                lex.getNextToken();
+                return n;
+            }
+            case TK_TRUE:
+            case TK_FALSE: {
+                auto n = node(N_BOOL, JIT_BOOL);
+                n->value = lex.token.type == TK_TRUE;
+                lex.getNextToken();
+                return n;
+            }
+            case TK_IDENTIFIER: {
+                string id = lex.token.value;
+                int site = lex.posNow - 1;
+                lex.getNextToken();
+                auto it = slots.find(id);
+                if (lex.token.type == TK_L_BRACKET) {
+                    if (it != slots.end() || inlining) {
+                        return fail();
+                    }
+                    lex.getNextToken();
+                    vector<JITNode *> args;
+                    while (!failed && lex.token.type != TK_R_BRACKET) {
+                        if (lex.token.type == TK_COMMA) {
+                            lex.getNextToken();
+                        }
+                        auto arg = eval();
+                        if (!arg) {
+                            return fail();
+                        }
+                        args.push_back(arg);
+                    }
+                    if (!expect(TK_R_BRACKET)) {
+                        return nullptr;
+                    }
+                    if (loopMode || id != name) {
+                        return inlineCall(id, args, site);
+                    }
+                    //direct recursion, the caller checks that the name is still bound to this function
+                    auto call = node(N_CALL, returnType);
+                    for (auto arg: args) {
+                        if (arg->type != JIT_INT) {
+                            return fail();
+                        }
+                        call->kids.push_back(arg);
+                    }
+                    if ((int) call->kids.size() != paramCount) {
+                        return fail();
+                    }
+                    selfCalls = true;
+                    return call;
+                }
+                if (it == slots.end() || lex.token.type == TK_DOT || lex.token.type == TK_L_SQUARE_BRACKET) {
+                    return fail();
+                }
+                auto n = node(N_SLOT, slotTypes[it->second]);
+                n->value = it->second;
+                return n;
+            }
+            default:
+                return fail();
+        }
+    }
+
+    // callee(args) with callee bound outside the code being compiled: its body is parsed in place,
+    // the arguments and its locals go to slots of their own and the call takes the value of its return
+    JITNode *inlineCall(const string &callee, const vector<JITNode *> &args, int site) {
+        JITCallee target;
+        if (!resolve || !resolve(callee, target) || target.params.size() != args.size() ||
+            target.body->tokenEnd - target.body->tokenBegin > inlineBudget) {
+            return fail();
+        }
+        //a var of the same name would shadow the binding checked on entry
+        for (int i = lex.tokenBegin; i + 1 < lex.tokenEnd; i++) {
+            if ((*lex.tokens)[i].type == TK_VAR && (*lex.tokens)[i + 1].value == callee) {
+                return fail();
+            }
+        }
+
+        auto n = node(N_INLINE, JIT_INT);
+        map<string, int> outerSlots;
+        outerSlots.swap(slots);
+        for (size_t i = 0; i < args.size(); i++) {
+            auto assign = node(N_ASSIGN, args[i]->type);
+            assign->op = TK_ASSIGN;
+            assign->value = declare(target.params[i], args[i]->type);
+            assign->kids.push_back(args[i]);
+            n->kids.push_back(assign);
+        }
+        Lex outerLex = lex;
+        int outerDepth = depth;
+        lex = Lex(*target.body, target.body->tokenBegin, target.body->tokenEnd);
+        lex.getNextToken();
+        depth = 0;
+        inlining = true;
+
+        //{ var x = e; ... return e; }
+        JITNode *value = nullptr;
+        if (expect(TK_L_LARGE_BRACKET)) {
+            while (!failed && lex.token.type == TK_VAR) {
+                n->kids.push_back(statement());
+            }
+            if (!failed && lex.token.type == TK_RETURN) {
+                lex.getNextToken();
+                value = eval();
+            }
+            if (!value || !expect(TK_SEMICOLON) || !expect(TK_R_LARGE_BRACKET) || lex.token.type != TK_EOF) {
+                fail();
+            }
+        }
+
+        inlining = false;
+        depth = outerDepth;
+        lex = outerLex;
+        slots.swap(outerSlots);
+        if (failed) {
+            return nullptr;
+        }
+        n->type = value->type;
+        n->kids.push_back(value);
+
+        JITInlined record;
+        record.name = callee;
+        record.binding = target.binding;
+        record.line = 1 + (int) count(lex.source->begin(), lex.source->begin() + (*lex.tokens)[site].pos, '\n');
+        inlined.push_back(record);
+        return n;
+    }
+};
+
+// x86-64 encoder with forward labels
+class JITAssembler {
+public:
+    vector<uint8_t> code;
+
+    enum CONDITIONS {
+        CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_NS = 0x9, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+    };
+
+    void emit(std::initializer_list<uint8_t> bytes) {
+        code.insert(code.end(), bytes.begin(), bytes.end());
+    }
+
+    void imm32(int32_t value) {
+        uint8_t bytes[4];
+        memcpy(bytes, &value, 4);
+        code.insert(code.end(), bytes, bytes + 4);
+    }
+
+    void imm64(int64_t value) {
+        uint8_t bytes[8];
+        memcpy(bytes, &value, 8);
+        code.insert(code.end(), bytes, bytes + 8);
+    }
+
+    int newLabel() {
+        labels.push_back(-1);
+        return (int) labels.size() - 1;
+    }
+
+    void bind(int label) {
+        labels[label] = (int) code.size();
+    }
+
+    void jump(int label) {
+        emit({0xE9});
+        fixup(label);
+    }
+
+    void jumpIf(int cc, int label) {
+        emit({0x0F, (uint8_t) (0x80 + cc)});
+        fixup(label);
+    }
+
+    void call(int label) {
+        emit({0xE8});
+        fixup(label);
+    }
+
+    void finish() {
+        for (auto &f: fixups) {
+            int32_t rel = labels[f.second] - (f.first + 4);
+            memcpy(&code[f.first], &rel, 4);
+        }
+    }
+
+private:
+    vector<int> labels;
+    vector<pair<int, int>> fixups; //position of a rel32, label
+
+    void fixup(int label) {
+        fixups.push_back(make_pair((int) code.size(), label));
+        imm32(0);
+    }
+};
+
+class JITCodegen {
+public:
+    JITAssembler a;
+
+    void function(JITNode *body, int params, int slots) {
+        entry = a.newLabel();
+        bail = a.newLabel();
+        pollSlot = slots;
+        a.bind(entry);
+        int frame = ((slots + 1) * 8 + 15) / 16 * 16;
+        a.emit({0x55});                         // push rbp
+        a.emit({0x48, 0x89, 0xE5});             // mov rbp, rsp
+        a.emit({0x48, 0x81, 0xEC});             // sub rsp, frame
+        a.imm32(frame);
+        a.emit({0x48, 0x89, 0xB5});             // mov [rbp - 8 * (slots + 1)], rsi
+        a.imm32(-8 * (pollSlot + 1));
+        for (int i = 0; i < params; i++) {
+            a.emit({0x8B, 0x87});               // mov eax, [rdi + 8 * i]
+            a.imm32(8 * i);
+            store(i);
+        }
+        poll();
+        statement(body);
+        //fell off the end: the result is undefined, leave it to the interpreter
+        a.bind(bail);
+        a.emit({0x48, 0xB8});                   // mov rax, JIT_BAILOUT
+        a.imm64(JIT_BAILOUT);
+        a.emit({0xC9, 0xC3});                   // leave; ret
+        a.finish();
+    }
+
+    // rdi points at the first `names` slots, read on entry and written back on exit. When the loop can
+    // bail out they are also written back at the top of every iteration, so the interpreter resumes there
+    void loop(JITNode *loopNode, int slots, int names, bool commitEveryIteration) {
+        entry = a.newLabel();
+        bail = a.newLabel();
+        frameSlots = slots;
+        committedSlots = names;
+        pollSlot = slots + 1;
+        a.bind(entry);
+        int frame = ((slots + 2) * 8 + 15) / 16 * 16;
+        a.emit({0x55});                         // push rbp
+        a.emit({0x48, 0x89, 0xE5});             // mov rbp, rsp
+        a.emit({0x48, 0x81, 0xEC});             // sub rsp, frame
+        a.imm32(frame);
+        a.emit({0x48, 0x89, 0xBD});             // mov [rbp - 8 * (slots + 1)], rdi
+        a.imm32(-8 * (slots + 1));
+        a.emit({0x48, 0x89, 0xB5});             // mov [rbp - 8 * (slots + 2)], rsi
+        a.imm32(-8 * (pollSlot + 1));
+        for (int i = 0; i < names; i++) {
+            a.emit({0x8B, 0x87});               // mov eax, [rdi + 8 * i]
+            a.imm32(8 * i);
+            store(i);
+        }
+        if (commitEveryIteration) {
+            osrLoop = loopNode;
+        }
+        statement(loopNode);
+        commit();
+        a.emit({0x31, 0xC0});                   // xor eax, eax
+        a.emit({0xC9, 0xC3});                   // leave; ret
+        a.bind(bail);
+        a.emit({0x48, 0xB8});                   // mov rax, JIT_BAILOUT
+        a.imm64(JIT_BAILOUT);
+        a.emit({0xC9, 0xC3});                   // leave; ret
+        a.finish();
+    }
+
+private:
+    int entry = 0;
+    int bail = 0;
+    int frameSlots = 0;
+    int committedSlots = 0;
+    int pollSlot = 0; //holds the JITPoll * the code was called with
+    JITNode *osrLoop = nullptr;
+    vector<int> breakLabels;
+    vector<int> continueLabels;
+
+    void load(int slot) {
+        a.emit({0x8B, 0x85});                   // mov eax, [rbp - 8 * (slot + 1)]
+        a.imm32(-8 * (slot + 1));
+    }
+
+    void store(int slot) {
+        a.emit({0x89, 0x85});                   // mov [rbp - 8 * (slot + 1)], eax
+        a.imm32(-8 * (slot + 1));
+    }
+
+    void commit() {
+        a.emit({0x48, 0x8B, 0x8D});             // mov rcx, [rbp - 8 * (slots + 1)]
+        a.imm32(-8 * (frameSlots + 1));
+        for (int i = 0; i < committedSlots; i++) {
+            load(i);
+            a.emit({0x48, 0x63, 0xC0});         // movsxd rax, eax
+            a.emit({0x48, 0x89, 0x81});         // mov [rcx + 8 * i], rax
+            a.imm32(8 * i);
+        }
+    }
+
+    // count one down from the budget at function entry and loop back-edges. nothing is live in registers
+    // there, so the slow path calls expired on a 16 byte aligned stack and bails out if it says so
+    void poll() {
+        int skip = a.newLabel();
+        a.emit({0x48, 0x8B, 0x8D});             // mov rcx, [rbp - 8 * (pollSlot + 1)]
+        a.imm32(-8 * (pollSlot + 1));
+        a.emit({0x48, 0xFF, 0x09});             // dec qword [rcx]
+        a.jumpIf(JITAssembler::CC_NS, skip);
+        a.emit({0x48, 0x89, 0xCF});             // mov rdi, rcx
+        a.emit({0x48, 0x89, 0xE2});             // mov rdx, rsp
+        a.emit({0x48, 0x83, 0xE4, 0xF0});       // and rsp, -16
+        a.emit({0x52, 0x52});                   // push rdx; push rdx
+        a.emit({0xFF, 0x57, 0x08});             // call [rdi + 8]
+        a.emit({0x48, 0x8B, 0x24, 0x24});       // mov rsp, [rsp]
+        a.emit({0x48, 0x85, 0xC0});             // test rax, rax
+        a.jumpIf(JITAssembler::CC_NE, bail);
+        a.bind(skip);
+    }
+
+    void testAndJumpIfFalse(int label) {
+        a.emit({0x85, 0xC0});                   // test eax, eax
+        a.jumpIf(JITAssembler::CC_E, label);
+    }
+
+    void setFlag(int cc) {
+        a.emit({0x0F, (uint8_t) (0x90 + cc), 0xC0}); // setcc al
+        a.emit({0x0F, 0xB6, 0xC0});             // movzx eax, al
+    }
+
+    void expression(JITNode *n) {
+        switch (n->kind) {
+            case N_INT:
+            case N_BOOL:
+                a.emit({0xB8});                 // mov eax, imm32
+                a.imm32(n->value);
+                break;
+            case N_SLOT:
+                load(n->value);
+                break;
+            case N_NOT:
+                expression(n->kids[0]);
+                a.emit({0x85, 0xC0});           // test eax, eax
+                setFlag(JITAssembler::CC_E);
+                break;
+            case N_BITNOT:
+                expression(n->kids[0]);
+                a.emit({0xF7, 0xD0});           // not eax
+                break;
+            case N_NEG:
+                expression(n->kids[0]);
+                a.emit({0xF7, 0xD8});           // neg eax
+                break;
+            case N_TERNARY: {
+                int otherwise = a.newLabel(), end = a.newLabel();
+                expression(n->kids[0]);
+                testAndJumpIfFalse(otherwise);
+                expression(n->kids[1]);
+                a.jump(end);
+                a.bind(otherwise);
+                expression(n->kids[2]);
+                a.bind(end);
+                break;
+            }
+            case N_LOGIC: {
+                //the left side is a bool, so on a short circuit eax already holds the result
+                int end = a.newLabel();
+                expression(n->kids[0]);
+                a.emit({0x85, 0xC0});           // test eax, eax
+                a.jumpIf(n->op == TK_AND_AND ? JITAssembler::CC_E : JITAssembler::CC_NE, end);
+                expression(n->kids[1]);
+                a.emit({0x85, 0xC0});           // test eax, eax
+                setFlag(JITAssembler::CC_NE);
+                a.bind(end);
+                break;
+            }
+            case N_CALL: {
+                int argc = (int) n->kids.size();
+                for (int i = argc - 1; i >= 0; i--) {
+                    expression(n->kids[i]);
+                    a.emit({0x50});             // push rax
+                }
+                a.emit({0x48, 0x89, 0xE7});     // mov rdi, rsp
+                a.emit({0x48, 0x8B, 0xB5});     // mov rsi, [rbp - 8 * (pollSlot + 1)]
+                a.imm32(-8 * (pollSlot + 1));
+                a.call(entry);
+                a.emit({0x48, 0x81, 0xC4});     // add rsp, 8 * argc
+                a.imm32(8 * argc);
+                a.emit({0x48, 0xB9});           // mov rcx, JIT_BAILOUT
+                a.imm64(JIT_BAILOUT);
+                a.emit({0x48, 0x39, 0xC8});     // cmp rax, rcx
+                a.jumpIf(JITAssembler::CC_E, bail);
+                break;
+            }
+            case N_INLINE:
+                for (size_t i = 0; i + 1 < n->kids.size(); i++) {
+                    statement(n->kids[i]);
+                }
+                expression(n->kids.back());
+                break;
+            case N_BINARY:
+                binary(n);
+                break;
+            default:
+                assert(0);
+        }
+    }
+
+    void binary(JITNode *n) {
+        expression(n->kids[0]);
+        a.emit({0x50});                         // push rax
+        expression(n->kids[1]);
+        a.emit({0x89, 0xC1});                   // mov ecx, eax
+        a.emit({0x58});                         // pop rax
+        switch (n->op) {
+            case TK_PLUS:
+                a.emit({0x01, 0xC8});           // add eax, ecx
+                break;
+            case TK_MINUS:
+                a.emit({0x29, 0xC8});           // sub eax, ecx
+                break;
+            case TK_MULTIPLY:
+                a.emit({0x0F, 0xAF, 0xC1});     // imul eax, ecx
+                break;
+            case TK_DIVIDE:
+            case TK_MOD: {
+                //x / 0 and INT_MIN / -1 trap, the interpreter can report those
+                int ok = a.newLabel();
+                a.emit({0x85, 0xC9});           // test ecx, ecx
+                a.jumpIf(JITAssembler::CC_E, bail);
+                a.emit({0x83, 0xF9, 0xFF});     // cmp ecx, -1
+                a.jumpIf(JITAssembler::CC_NE, ok);
+                a.emit({0x3D});                 // cmp eax, INT_MIN
+                a.imm32(INT32_MIN);
+                a.jumpIf(JITAssembler::CC_E, bail);
+                a.bind(ok);
+                a.emit({0x99});                 // cdq
+                a.emit({0xF7, 0xF9});           // idiv ecx
+                if (n->op == TK_MOD) {
+                    a.emit({0x89, 0xD0});       // mov eax, edx
+                }
+                break;
+            }
+            case TK_BITWISE_AND:
+                a.emit({0x21, 0xC8});           // and eax, ecx
+                break;
+            case TK_BITWISE_OR:
+                a.emit({0x09, 0xC8});           // or eax, ecx
+                break;
+            case TK_BITWISE_XOR:
+                a.emit({0x31, 0xC8});           // xor eax, ecx
+                break;
+            case TK_L_SHIFT:
+                a.emit({0xD3, 0xE0});           // shl eax, cl
+                break;
+            case TK_R_SHIFT:
+                a.emit({0xD3, 0xF8});           // sar eax, cl
+                break;
+            default: {
+                int cc = JITAssembler::CC_E;
+                if (n->op == TK_N_EQUAL) cc = JITAssembler::CC_NE;
+                else if (n->op == TK_LESS) cc = JITAssembler::CC_L;
+                else if (n->op == TK_L_EQUAL) cc = JITAssembler::CC_LE;
+                else if (n->op == TK_GREATER) cc = JITAssembler::CC_G;
+                else if (n->op == TK_G_EQUAL) cc = JITAssembler::CC_GE;
+                a.emit({0x39, 0xC8});           // cmp eax, ecx
+                setFlag(cc);
+            }
+        }
+    }
+
+    void statement(JITNode *n) {
+        switch (n->kind) {
+            case N_ASSIGN:
+                expression(n->kids[0]);
+                if (n->op != TK_ASSIGN) {
+                    a.emit({0x89, 0xC1});       // mov ecx, eax
+                    load(n->value);
+                    if (n->op == TK_PLUS_EQUAL) {
+                        a.emit({0x01, 0xC8});   // add eax, ecx
+                    } else {
+                        a.emit({0x29, 0xC8});   // sub eax, ecx
+                    }
+                }
+                store(n->value);
+                break;
+            case N_DISCARD:
+                expression(n->kids[0]);
+                break;
+            case N_IF: {
+                int otherwise = a.newLabel(), end = a.newLabel();
+                expression(n->kids[0]);
+                testAndJumpIfFalse(otherwise);
+                statement(n->kids[1]);
+                a.jump(end);
+                a.bind(otherwise);
+                if (n->kids.size() > 2) {
+                    statement(n->kids[2]);
+                }
+                a.bind(end);
+                break;
+            }
+            case N_WHILE: {
+                int cond = a.newLabel(), end = a.newLabel();
+                a.bind(cond);
+                if (n == osrLoop) {
+                    commit();
+                }
+                poll();
+                expression(n->kids[0]);
+                testAndJumpIfFalse(end);
+                loopBody(n->kids[1], end, cond);
+                a.jump(cond);
+                a.bind(end);
+                break;
+            }
+            case N_FOR: {
+                int cond = a.newLabel(), update = a.newLabel(), end = a.newLabel();
+                statement(n->kids[0]);
+                a.bind(cond);
+                if (n == osrLoop) {
+                    commit();
+                }
+                poll();
+                expression(n->kids[1]);
+                testAndJumpIfFalse(end);
+                loopBody(n->kids[3], end, update);
+                a.bind(update);
+                statement(n->kids[2]);
+                a.jump(cond);
+                a.bind(end);
+                break;
+            }
+            case N_RETURN:
+                expression(n->kids[0]);
+                a.emit({0x48, 0x63, 0xC0});     // movsxd rax, eax
+                a.emit({0xC9, 0xC3});           // leave; ret
+                break;
+            case N_BLOCK:
+                for (auto kid: n->kids) {
+                    statement(kid);
+                }
+                break;
+            case N_BREAK:
+                a.jump(breakLabels.back());
+                break;
+            case N_CONTINUE:
+                a.jump(continueLabels.back());
+                break;
+            default:
+                assert(0);
+        }
+    }
+
+    void loopBody(JITNode *body, int breakLabel, int continueLabel) {
+        breakLabels.push_back(breakLabel);
+        continueLabels.push_back(continueLabel);
+        statement(body);
+        breakLabels.pop_back();
+        continueLabels.pop_back();
+    }
+};
+
+bool jitSupported() {
+    return JIT_X86_64 != 0;
+}
+
+JITFunction::~JITFunction() {
+#if JIT_X86_64
+    if (code) {
+        munmap(code, mappedSize);
+    }
+#endif
+}
+
+bool JITFunction::call(int64_t *args, int64_t &result, JITPoll *poll) {
+    typedef int64_t (*Entry)(int64_t *, JITPoll *);
+    int64_t ret = ((Entry) code)(args, poll);
+    if (ret == JIT_BAILOUT) {
+        return false;
+    }
+    result = ret;
+    return true;
+}
+
+// copy the code into executable memory
+static JITFunction *install(const vector<uint8_t> &code) {
+#if JIT_X86_64
+    size_t size = (code.size() + 4095) / 4096 * 4096;
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    memcpy(mem, code.data(), code.size());
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return nullptr;
+    }
+
+    auto f = new JITFunction();
+    f->code = mem;
+    f->mappedSize = size;
+    f->codeSize = code.size();
+    return f;
+#else
+    return nullptr;
+#endif
+}
+
+JITFunction *jitCompile(const string &name, const vector<string> &params, const Lex &body,
+                        const JITResolver &resolve, int inlineBudget) {
+#if JIT_X86_64
+    //the return type is not declared, try both
+    for (JIT_TYPES returnType: {JIT_INT, JIT_BOOL}) {
+        JITParser parser(name, params, body, returnType);
+        parser.resolve = resolve;
+        parser.inlineBudget = inlineBudget;
+        JITNode *tree = parser.parseBody();
+        if (!tree) {
+            continue;
+        }
+
+        JITCodegen codegen;
+        codegen.function(tree, parser.paramCount, (int) parser.slotTypes.size());
+        auto f = install(codegen.a.code);
+        if (f) {
+            f->argc = parser.paramCount;
+            f->resultType = returnType;
+            f->selfCalls = parser.selfCalls;
+            f->inlined = parser.inlined;
+        }
+        return f;
+    }
+#endif
+    return nullptr;
+}
+
+JITFunction *jitCompileLoop(const Lex &loop, const vector<string> &names, const vector<JIT_TYPES> &types,
+                            const JITResolver &resolve, int inlineBudget) {
+#if JIT_X86_64
+    JITParser parser(loop, names, types);
+    parser.resolve = resolve;
+    parser.inlineBudget = inlineBudget;
+    JITNode *tree = parser.parseLoop();
+    if (!tree) {
+        return nullptr;
+    }
+
+    JITCodegen codegen;
+    codegen.loop(tree, (int) parser.slotTypes.size(), parser.paramCount, parser.mayBail);
+    auto f = install(codegen.a.code);
+    if (f) {
+        f->argc = parser.paramCount;
+        f->inlined = parser.inlined;
+    }
+    return f;
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,84 @@
+//
+// Baseline JIT: compiles a function body to x86-64 machine code.
+//
+
+#ifndef TINYJS_JIT_H
+#define TINYJS_JIT_H
+
+#include "Lex.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+using namespace std;
+
+enum JIT_TYPES {
+    JIT_INT,
+    JIT_BOOL
+};
+
+// a function called by name from code being compiled, as the name resolves right now
+struct JITCallee {
+    vector<string> params;
+    const Lex *body = nullptr; //tokens of { ... }
+    const void *binding = nullptr; //whatever the name is bound to, compared before entering the code
+};
+
+// looks a called name up, false when it is not bound to a function
+typedef function<bool(const string &name, JITCallee &callee)> JITResolver;
+
+// a call site whose callee was compiled in place
+struct JITInlined {
+    string name;
+    const void *binding = nullptr;
+    int line = 0;
+};
+
+// the budget compiled code counts down, once per call and loop iteration. when countdown drops below zero
+// the code calls expired(poll), and bails out if that returns nonzero
+struct JITPoll {
+    int64_t countdown = 0;
+    int64_t (*expired)(JITPoll *poll) = nullptr;
+    void *context = nullptr;
+};
+
+// machine code of one function, int32 arguments in, an int32 or bool out
+class JITFunction {
+public:
+    JITFunction() { };
+
+    ~JITFunction();
+
+    //false when the code bailed out, the caller then runs the function in the interpreter.
+    //a compiled loop writes its variables back into args
+    bool call(int64_t *args, int64_t &result, JITPoll *poll);
+
+    JIT_TYPES resultType = JIT_INT;
+    int argc = 0;
+    bool selfCalls = false; //calls itself by name, so the binding has to be checked before entering
+    vector<JITInlined> inlined; //every name here has to be bound to the same callee before entering
+    size_t codeSize = 0;
+
+    void *code = nullptr;
+    size_t mappedSize = 0;
+};
+
+bool jitSupported();
+
+// compile `function name(params) body`, body being the tokens of { ... }.
+// handles int32/bool params and locals, arithmetic, compares, if/while/for and calls to itself;
+// returns nullptr for anything else, so the function stays in the interpreter.
+// a call to another function that resolve finds is inlined when its body is `var x = e; ... return e;`
+// in at most inlineBudget tokens and it does not end up calling itself or the function being compiled
+JITFunction *jitCompile(const string &name, const vector<string> &params, const Lex &body,
+                        const JITResolver &resolve = nullptr, int inlineBudget = 0);
+
+// compile a while/for loop, loop being its tokens, to be entered between two iterations.
+// names are the variables it may use with their current types; call() takes them in and writes
+// them back, after a bailout they hold the values at the top of the iteration that bailed.
+// calls are only compiled when they can be inlined, see jitCompile
+JITFunction *jitCompileLoop(const Lex &loop, const vector<string> &names, const vector<JIT_TYPES> &types,
+                            const JITResolver &resolve = nullptr, int inlineBudget = 0);
+
+#endif //TINYJS_JIT_H
@@ -7,11 +7,14 @@
 //
 
 #include "Lex.h"
-#include <regex>
+#include "LexScan.h"
 #include <sstream>
+#include <mutex>
+#include <thread>
+#include <algorithm>
 
 //the tokens that can appear before numbers with '+/-' prefix
-set<TOKEN_TYPES> tokenBeforePrefix{
+static const set<TOKEN_TYPES> tokenBeforePrefix{
     TK_L_BRACKET,
     TK_ASSIGN,
     TK_PLUS_EQUAL,
@@ -25,110 +28,620 @@ set<TOKEN_TYPES> tokenBeforePrefix{
     TK_G_EQUAL,
 };
 
+map<string, TOKEN_TYPES> Lex::tokenMap;
+atomic<int> Lex::lexThreads{0};
+map<TOKEN_TYPES, string> Lex::invTokenMap;
+
 Lex::Lex() {
     initialTokenMap();
 
     token.type = TK_NOT_VALID;
     lastTk.type = TK_NOT_VALID;
 
-    tokenLastEnd = 0;
+    source = make_shared<Source>();
+    tokens = make_shared<vector<Token>>();
     posNow = 0;
 }
 
-Lex::Lex(const string &str) : originalStr(str) {
+Lex::Lex(const string &str) {
     initialTokenMap();
     token.type = TK_NOT_VALID;
     lastTk.type = TK_NOT_VALID;
 
-    tokenLastEnd = 0;
-
-    posNow = 0;
+    source = make_shared<Source>(str);
+    getLex();
 };
 
+Lex::Lex(const shared_ptr<const Source> &source) : source(source) {
+    initialTokenMap();
+    token.type = TK_NOT_VALID;
+    lastTk.type = TK_NOT_VALID;
+    getLex();
+}
+
+Lex::Lex(const Lex &parent, int begin, int end) : source(parent.source), tokens(parent.tokens),
+                                                  tokenBegin(begin), tokenEnd(end) {
+    reset();
+}
+
+Lex::Lex(const shared_ptr<const Source> &source, int begin, int end) : source(source) {
+    initialTokenMap();
+    tokenize(begin, end);
+}
+
 void Lex::reset() {
     token.type = TK_NOT_VALID;
     lastTk.type = TK_NOT_VALID;
 
-    tokenLastEnd = 0;
+    posNow = tokenBegin;
+}
 
-    posNow = 0;
+//tokenize the whole source once, the interpreter then only walks the token stream.
+//a big source is cut into chunks of at least LEX_CHUNK_MIN bytes that are lexed in parallel
+void Lex::getLex() {
+    int len = (int) source->length();
+    int threads = lexThreads.load(memory_order_relaxed);
+    threads = threads > 0 ? threads : (int) thread::hardware_concurrency();
+    threads = min(threads, len / LEX_CHUNK_MIN);
+    if (threads > 1) {
+        tokenizeParallel(threads);
+    } else {
+        tokenize(0, len);
+    }
+}
+
+//function bodies are only pre-parsed: a body whose brackets, strings and comments are well formed
+//becomes a single TK_FUNCTION_BODY token and is tokenized by the first call
+void Lex::tokenize(int begin, int end) {
+    tokens = make_shared<vector<Token>>();
+    complete = lexRange(begin, end, *tokens);
+    tokenBegin = 0;
+    tokenEnd = (int) tokens->size();
+    matchBrackets();
+    fuseTokens();
+    reset();
+}
+
+//append the tokens of str[begin, end) to out, false when the lexer hit an error and stopped there
+bool Lex::lexRange(int begin, int end, vector<Token> &out) const {
+    const char *str = source->data();
+    int len = source->length();
+
+    Token tk, last;
+    last.type = TK_NOT_VALID;
+    int header = 0; //how much of `function name(params)` was seen, 4 is all of it
+    int pos = begin;
+    while (pos >= 0 && pos < end) {
+        tk.type = TK_NOT_VALID;
+        tk.end = 0;
+        int start = pos;
+        pos = getNextTokenInner(str, len, pos, tk, last);
+        if (pos >= 0 && tk.type != TK_NOT_VALID) {
+            tk.pos = scanSpace(str, start, len);
+            if (tk.pos >= end) {
+                //the whitespace at the end of the range ran into the next one
+                break;
+            }
+            if (tk.type == TK_L_LARGE_BRACKET && header == 4) {
+                int close = preParseBody(str, tk.pos, end);
+                if (close >= 0) {
+                    tk.setToken(TK_FUNCTION_BODY, TokenText());
+                    tk.end = close;
+                    pos = close + 1;
+                    out.push_back(tk);
+                    last.setToken(TK_R_LARGE_BRACKET, TokenText(str + close, 1)); //what the next token sees
+                    header = 0;
+                    continue;
+                }
+            }
+
+            if (tk.type == TK_FUNCTION) {
+                header = 1;
+            } else if (header == 1 && tk.type == TK_IDENTIFIER) {
+                header = 2;
+            } else if ((header == 1 || header == 2) && tk.type == TK_L_BRACKET) {
+                header = 3;
+            } else if (header == 3 && tk.type == TK_R_BRACKET) {
+                header = 4;
+            } else if (header != 3 || (tk.type != TK_IDENTIFIER && tk.type != TK_COMMA)) {
+                header = 0;
+            }
+            out.push_back(tk);
+            last = tk;
+        }
+    }
+    return pos >= 0;
+}
+
+//offsets a source can be cut at, at most one per step bytes: the start of a line that follows a ; or }
+//outside of any bracket, string and comment. no token or function body crosses such a cut and the lexer
+//starts after it in the same state as at the top of the source.
+//the pre-scan reads strings and comments the way getNextTokenInner does and stops cutting at anything
+//malformed, the error is then reported by the piece that holds it
+static void safeCuts(const char *str, int len, int step, vector<int> &cuts) {
+    int next = step;
+    int depth = 0;
+    char last = 0; //last character outside of comments and whitespace
+    for (int i = 0; i < len; i++) {
+        char c = str[i];
+        if (c == '\n') {
+            if (depth == 0 && (last == ';' || last == '}') && i + 1 >= next) {
+                cuts.push_back(i + 1);
+                next = i + 1 + step;
+            }
+            continue;
+        }
+        if (isspace(c)) {
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            i = scanString(str, i + 1, len, c);
+            if (i >= len) {
+                break;
+            }
+        } else if (c == '/' && i + 1 < len && str[i + 1] == '/') {
+            i = scanChar(str, i, len, '\n') - 1;
+            continue;
+        } else if (c == '/' && i + 1 < len && str[i + 1] == '*') {
+            int slash = scanChar(str, i + 2, len, '/');
+            if (slash >= len || str[slash - 1] != '*' || slash - i < 3) {
+                break;
+            }
+            i = slash;
+            continue;
+        } else if (c == '{' || c == '(' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ')' || c == ']') {
+            if (--depth < 0) {
+                break;
+            }
+        }
+        last = c;
+    }
+}
+
+//where to cut a source to be lexed in parallel, about one cut per len / chunks bytes, 0 and len included
+vector<int> Lex::chunkBoundaries(const char *str, int len, int chunks) {
+    vector<int> cuts{0};
+    safeCuts(str, len, len / chunks, cuts);
+    if (cuts.back() == len) {
+        cuts.pop_back();
+    }
+    cuts.push_back(len);
+    return cuts;
+}
+
+static bool isIdentifierChar(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+//the end of the first run of complete top-level statements in stream.pending, 0 for none yet.
+//a line after a ; or } outside of any bracket, string and comment ends it, but only once the token after
+//it is known not to be an else: a cut between if (...) {...} and else would run else as a script of its
+//own. the scan picks up where the last call stopped, at a string or comment the buffer ended in
+int Lex::statementsEnd(StatementStream &stream) {
+    const char *str = stream.pending.data();
+    int len = (int) stream.pending.size();
+    int i = stream.scanned;
+    for (; i < len && !stream.stopped; i++) {
+        char c = str[i];
+        if (c == '\n') {
+            if (stream.depth == 0 && (stream.last == ';' || stream.last == '}') && !stream.cut) {
+                stream.cut = i + 1;
+            }
+            continue;
+        }
+        if (isspace(c)) {
+            continue;
+        }
+        int from = i;
+        if (c == '/' && i + 1 < len && str[i + 1] == '/') {
+            i = scanChar(str, i, len, '\n');
+            if (i >= len) {
+                i = from;
+                break;
+            }
+            i--;
+            continue;
+        } else if (c == '/' && i + 1 < len && str[i + 1] == '*') {
+            int slash = i + 2;
+            do {
+                slash = scanChar(str, slash + 1, len, '/');
+            } while (slash < len && str[slash - 1] != '*');
+            if (slash >= len) {
+                break;
+            }
+            i = slash;
+            continue;
+        }
+        if (stream.cut) {
+            static const char keyword[] = "else";
+            int n = 0;
+            while (n < 4 && i + n < len && str[i + n] == keyword[n]) {
+                n++;
+            }
+            if (n == len - i && n <= 4) {
+                //an else or an identifier starting with it, the next line tells
+                break;
+            }
+            if (n == 4 && !isIdentifierChar(str[i + 4])) {
+                stream.cut = 0;
+            } else {
+                //the caller drops pending[0, cut), the scan starts over at what follows
+                int end = stream.cut;
+                stream.scanned = 0;
+                stream.depth = 0;
+                stream.last = 0;
+                stream.cut = 0;
+                return end;
+            }
+        }
+        if (c == '"' || c == '\'') {
+            i = scanString(str, i + 1, len, c);
+            if (i >= len) {
+                i = from;
+                break;
+            }
+        } else if (c == '{' || c == '(' || c == '[') {
+            stream.depth++;
+        } else if (c == '}' || c == ')' || c == ']') {
+            if (--stream.depth < 0) {
+                stream.stopped = true;
+            }
+        }
+        stream.last = c;
+    }
+    stream.scanned = i;
+    return 0;
+}
+
+//lex the chunks between the cuts on threads of their own and join the token streams, the same tokens
+//a single pass makes: a chunk after one that stopped at an error is dropped
+void Lex::tokenizeParallel(int threads) {
+    vector<int> cuts = chunkBoundaries(source->data(), source->length(), threads);
+    int chunks = (int) cuts.size() - 1;
+    vector<vector<Token>> parts(chunks);
+    vector<char> ok(chunks);
+    vector<thread> workers;
+    for (int i = 1; i < chunks; i++) {
+        workers.push_back(thread([&, i] {
+            ok[i] = lexRange(cuts[i], cuts[i + 1], parts[i]);
+        }));
+    }
+    ok[0] = lexRange(cuts[0], cuts[1], parts[0]);
+    for (auto &worker: workers) {
+        worker.join();
+    }
+
+    size_t total = 0;
+    for (auto &part: parts) {
+        total += part.size();
+    }
+    tokens = make_shared<vector<Token>>();
+    tokens->reserve(total);
+    for (int i = 0; i < chunks; i++) {
+        tokens->insert(tokens->end(), parts[i].begin(), parts[i].end());
+        if (!ok[i]) {
+            complete = false;
+            break;
+        }
+    }
+
+    tokenBegin = 0;
+    tokenEnd = (int) tokens->size();
+    matchBrackets();
+    fuseTokens();
+    reset();
+}
+
+//offset of the } closing the { at begin, found without tokenizing: brackets are only counted and
+//checked to pair up, strings and comments skipped the way getNextTokenInner reads them.
+//-1 when the structure is broken, the body is then tokenized right away and reports its errors
+int Lex::preParseBody(const char *str, int begin, int end) {
+    string open;
+    for (int i = begin; i < end; i++) {
+        char c = str[i];
+        if (c == '{' || c == '(' || c == '[') {
+            open.push_back(c);
+        } else if (c == '}' || c == ')' || c == ']') {
+            char opening = c == '}' ? '{' : c == ')' ? '(' : '[';
+            if (open.empty() || open.back() != opening) {
+                return -1;
+            }
+            open.pop_back();
+            if (open.empty()) {
+                return i;
+            }
+        } else if (c == '"' || c == '\'') {
+            i = scanString(str, i + 1, end, c);
+            if (i >= end) {
+                return -1;
+            }
+        } else if (c == '/' && i + 1 < end && str[i + 1] == '/') {
+            i = scanChar(str, i, end, '\n');
+        } else if (c == '/' && i + 1 < end && str[i + 1] == '*') {
+            //the comment ends at the first / after /*, which has to follow a *
+            int slash = scanChar(str, i + 2, end, '/');
+            if (slash >= end || str[slash - 1] != '*' || slash - i < 3) {
+                return -1;
+            }
+            i = slash;
+        }
+    }
+    return -1;
 }
 
+//pair every bracket with its closing one, a skipped group is then a single jump.
+//brackets that do not pair up keep match = -1 and are walked token by token
+void Lex::matchBrackets() {
+    vector<Token> &tk = *tokens;
+    vector<int> open;
+    for (int i = 0; i < (int) tk.size(); i++) {
+        tk[i].match = -1;
+        TOKEN_TYPES type = tk[i].type;
+        if (type == TK_L_BRACKET || type == TK_L_SQUARE_BRACKET || type == TK_L_LARGE_BRACKET) {
+            open.push_back(i);
+        } else if (type == TK_R_BRACKET || type == TK_R_SQUARE_BRACKET || type == TK_R_LARGE_BRACKET) {
+            TOKEN_TYPES opening = type == TK_R_BRACKET ? TK_L_BRACKET :
+                                  type == TK_R_SQUARE_BRACKET ? TK_L_SQUARE_BRACKET : TK_L_LARGE_BRACKET;
+            if (!open.empty() && tk[open.back()].type == opening) {
+                tk[i].match = open.back();
+                tk[open.back()].match = i;
+                open.pop_back();
+            }
+        }
+    }
+}
 
-int Lex::getNextTokenInner(string &str, int startPos, Token &tk, Token &lastTk) {
-    regex floatExp("^[\\+-]?((([1-9]\\d*)?\\.\\d+|[1-9]\\d*(\\.\\d*)?)[eE][\\+-]?[1-9]\\d*|([1-9]\\d*)?\\.\\d+)");
-    regex decExp("^([\\+-]?[1-9]\\d*|0)");
-    regex octalExp("^0[1-7][0-7]*");
-    regex hexExp("^0[xX][1-9a-fA-F][0-9a-fA-F]*");
+//peephole pass, the patterns are the most frequent token pairs of conditions and counter updates
+//(TINYJS_PAIR_REPORT counts them, the README has the counts they were picked from)
+void Lex::fuseTokens() {
+    vector<Token> &tk = *tokens;
+    int n = (int) tk.size();
+    auto isOperand = [&](int i) {
+        return i < n && (tk[i].type == TK_IDENTIFIER || tk[i].type == TK_DEC_INT || tk[i].type == TK_HEX_INT ||
+                         tk[i].type == TK_OCTAL_INT);
+    };
+    auto isEnd = [&](int i) {
+        return i < n && (tk[i].type == TK_R_BRACKET || tk[i].type == TK_SEMICOLON);
+    };
 
-    while (isspace(str.at(startPos))) {
-        startPos++;
-        if (startPos == str.length()) {
-            tk.type = TK_NOT_VALID;
-            return startPos;
+    for (int i = 0; i + 2 < n; i++) {
+        if (tk[i].type != TK_IDENTIFIER) {
+            continue;
+        }
+        TOKEN_TYPES op = tk[i + 1].type;
+        if ((op == TK_LESS || op == TK_L_EQUAL || op == TK_GREATER || op == TK_G_EQUAL || op == TK_EQUAL ||
+             op == TK_N_EQUAL) && isOperand(i + 2) && isEnd(i + 3)) {
+            tk[i].fused = FUSED_CMP_BRANCH;
+        } else if ((op == TK_PLUS_PLUS || op == TK_MINUS_MINUS) && isEnd(i + 2)) {
+            tk[i].fused = FUSED_INC;
+        } else if ((op == TK_PLUS_EQUAL || op == TK_MINUS_EQUAL) && isOperand(i + 2) && isEnd(i + 3)) {
+            tk[i].fused = FUSED_OP_ASSIGN;
+        } else if (op == TK_ASSIGN && i + 4 < n && tk[i + 2].type == TK_IDENTIFIER &&
+                   tk[i + 2].value == tk[i].value && (tk[i + 3].type == TK_PLUS || tk[i + 3].type == TK_MINUS) &&
+                   isOperand(i + 4) && isEnd(i + 5)) {
+            tk[i].fused = FUSED_LOAD_OP_STORE;
         }
     }
+}
+
+vector<long long> *Lex::pairCounts = nullptr;
+
+static const int pairTypes = TK_EOF - TK_IDENTIFIER + 1;
+
+void Lex::countPair(TOKEN_TYPES from, TOKEN_TYPES to) {
+    if (from < TK_IDENTIFIER || to < TK_IDENTIFIER) {
+        return;
+    }
+    if (pairCounts->empty()) {
+        pairCounts->assign(pairTypes * pairTypes, 0);
+    }
+    (*pairCounts)[(from - TK_IDENTIFIER) * pairTypes + to - TK_IDENTIFIER]++;
+}
+
+void Lex::pairReport(ostream &os, int top) {
+    vector<pair<long long, int>> sorted;
+    for (int i = 0; pairCounts && i < (int) pairCounts->size(); i++) {
+        if ((*pairCounts)[i]) {
+            sorted.push_back(make_pair((*pairCounts)[i], i));
+        }
+    }
+    sort(sorted.begin(), sorted.end(), [](const pair<long long, int> &a, const pair<long long, int> &b) {
+        return a.first > b.first;
+    });
+    long long total = 0;
+    for (auto &p: sorted) {
+        total += p.first;
+    }
+    os << "token pairs stepped through: " << total << endl;
+    for (int i = 0; i < top && i < (int) sorted.size(); i++) {
+        int from = sorted[i].second / pairTypes, to = sorted[i].second % pairTypes;
+        os << getTokenStr((TOKEN_TYPES) (from + TK_IDENTIFIER)) << " "
+        << getTokenStr((TOKEN_TYPES) (to + TK_IDENTIFIER)) << "\t" << sorted[i].first << "\t"
+        << 100.0 * sorted[i].first / total << "%" << endl;
+    }
+}
+
+//nothing longer than a keyword is looked up, the rest fits the small string buffer and allocates nothing
+TOKEN_TYPES Lex::lookupToken(const char *text, int length) {
+    if (length > 12) {
+        return TK_NOT_VALID;
+    }
+    auto it = tokenMap.find(string(text, (size_t) length));
+    return it == tokenMap.end() ? TK_NOT_VALID : it->second;
+}
+
+//number literals, matched by hand the way the regexes they replace did (leftmost alternative first):
+//  float  ^[+-]?((([1-9]\d*)?\.\d+|[1-9]\d*(\.\d*)?)[eE][+-]?[1-9]\d*|([1-9]\d*)?\.\d+)
+//  octal  ^0[1-7][0-7]*
+//  hex    ^0[xX][1-9a-fA-F][0-9a-fA-F]*
+//  dec    ^([+-]?[1-9]\d*|0)
+//each returns the length of the literal at i, 0 for none
+
+static inline bool digitAt(const char *s, int i, int len) {
+    return i < len && s[i] >= '0' && s[i] <= '9';
+}
+
+static inline int digitsFrom(const char *s, int i, int len) {
+    while (digitAt(s, i, len)) {
+        i++;
+    }
+    return i;
+}
+
+//[1-9]\d*, the offset after it or -1
+static int integerPart(const char *s, int i, int len) {
+    if (i >= len || s[i] < '1' || s[i] > '9') {
+        return -1;
+    }
+    return digitsFrom(s, i + 1, len);
+}
+
+//\.\d+
+static int fractionPart(const char *s, int i, int len) {
+    if (i < len && s[i] == '.' && digitAt(s, i + 1, len)) {
+        return digitsFrom(s, i + 1, len);
+    }
+    return -1;
+}
+
+//[eE][+-]?[1-9]\d*
+static int exponentPart(const char *s, int i, int len) {
+    if (i >= len || (s[i] != 'e' && s[i] != 'E')) {
+        return -1;
+    }
+    i++;
+    if (i < len && (s[i] == '+' || s[i] == '-')) {
+        i++;
+    }
+    return integerPart(s, i, len);
+}
+
+static int floatLiteral(const char *s, int start, int len) {
+    int i = start;
+    if (i < len && (s[i] == '+' || s[i] == '-')) {
+        i++;
+    }
+    int integer = integerPart(s, i, len);
+    int m;
+    //1.5e3 .5e3
+    if (integer >= 0 && (m = fractionPart(s, integer, len)) >= 0 && (m = exponentPart(s, m, len)) >= 0) {
+        return m - start;
+    }
+    if ((m = fractionPart(s, i, len)) >= 0 && (m = exponentPart(s, m, len)) >= 0) {
+        return m - start;
+    }
+    //1.e3 1e3
+    if (integer >= 0) {
+        if (integer < len && s[integer] == '.' && (m = exponentPart(s, digitsFrom(s, integer + 1, len), len)) >= 0) {
+            return m - start;
+        }
+        if ((m = exponentPart(s, integer, len)) >= 0) {
+            return m - start;
+        }
+    }
+    //1.5 .5
+    if (integer >= 0 && (m = fractionPart(s, integer, len)) >= 0) {
+        return m - start;
+    }
+    if ((m = fractionPart(s, i, len)) >= 0) {
+        return m - start;
+    }
+    return 0;
+}
+
+static int octalLiteral(const char *s, int i, int len) {
+    if (i + 1 >= len || s[i] != '0' || s[i + 1] < '1' || s[i + 1] > '7') {
+        return 0;
+    }
+    int j = i + 2;
+    while (j < len && s[j] >= '0' && s[j] <= '7') {
+        j++;
+    }
+    return j - i;
+}
+
+static int hexLiteral(const char *s, int i, int len) {
+    if (i + 2 >= len || s[i] != '0' || (s[i + 1] != 'x' && s[i + 1] != 'X') || s[i + 2] == '0' ||
+        !isxdigit((unsigned char) s[i + 2])) {
+        return 0;
+    }
+    int j = i + 3;
+    while (j < len && isxdigit((unsigned char) s[j])) {
+        j++;
+    }
+    return j - i;
+}
+
+static int decimalLiteral(const char *s, int i, int len) {
+    int j = i;
+    if (j < len && (s[j] == '+' || s[j] == '-')) {
+        j++;
+    }
+    int end = integerPart(s, j, len);
+    if (end >= 0) {
+        return end - i;
+    }
+    return i < len && s[i] == '0' ? 1 : 0;
+}
+
+int Lex::getNextTokenInner(const char *data, int len, int startPos, Token &tk, const Token &lastTk) {
+    startPos = scanSpace(data, startPos, len);
+    if (startPos == len) {
+        tk.type = TK_NOT_VALID;
+        return startPos;
+    }
 
     int i = startPos;
     bool maybeANum = false;
 
-    if (str.at(i) == '.' || isdigit(str.at(i))) {
+    if (data[i] == '.' || isdigit(data[i])) {
         maybeANum = true;
-    } else if (str.at(i) == '+' || str.at(i) == '-') {
+    } else if (data[i] == '+' || data[i] == '-') {
         if (tokenBeforePrefix.find(lastTk.type) != tokenBeforePrefix.end()) {
             maybeANum = true;
         }
     }
 
     if (maybeANum) {
-//        if ( (str.at(i) != '+' && str.at(i) != '-') || (lastTk.type != TK_START && lastTk.type != TK_IDENTIFIER && lastTk.type != TK_DEC_INT && lastTk.type != TK_OCTAL_INT && lastTk.type != TK_HEX_INT && lastTk.type != TK_FLOAT)) {
-        smatch m;
-        string s = str.substr(i);
-        if (regex_search(s, m, floatExp)) {
-            tk.setToken(TK_FLOAT, m[0]);
-            i += tk.value.length();
-            return i;
-        } else if (regex_search(s, m, octalExp)) {
-            tk.setToken(TK_OCTAL_INT, m[0]);
-            i += tk.value.length();
-            return i;
-        } else if (regex_search(s, m, hexExp)) {
-            tk.setToken(TK_HEX_INT, m[0]);
-            i += tk.value.length();
-            return i;
-        } else if (regex_search(s, m, decExp)) {
-            tk.setToken(TK_DEC_INT, m[0]);
-            i += tk.value.length();
-            return i;
+//        if ( (data[i] != '+' && data[i] != '-') || (lastTk.type != TK_START && lastTk.type != TK_IDENTIFIER && lastTk.type != TK_DEC_INT && lastTk.type != TK_OCTAL_INT && lastTk.type != TK_HEX_INT && lastTk.type != TK_FLOAT)) {
+        int n;
+        if ((n = floatLiteral(data, i, len))) {
+            tk.setToken(TK_FLOAT, TokenText(data + i, n));
+            return i + n;
+        } else if ((n = octalLiteral(data, i, len))) {
+            tk.setToken(TK_OCTAL_INT, TokenText(data + i, n));
+            return i + n;
+        } else if ((n = hexLiteral(data, i, len))) {
+            tk.setToken(TK_HEX_INT, TokenText(data + i, n));
+            return i + n;
+        } else if ((n = decimalLiteral(data, i, len))) {
+            tk.setToken(TK_DEC_INT, TokenText(data + i, n));
+            return i + n;
         }
 //    }
     }
 
-    if (!isalpha(str.at(i)) && str.at(i) != '_') {
+    if (!isalpha(data[i]) && data[i] != '_') {
         //token is of types other than num and identifier
-        switch (str.at(i)) {
+        switch (data[i]) {
             case '/': {
-                if (i + 1 == str.length() || (str.at(i + 1) != '=' && str.at(i + 1) != '/' && str.at(i + 1) != '*')) {
-                    tk.setToken(tokenMap[str.substr(i, 1)], str.substr(i, 1));
+                if (i + 1 == len || (data[i + 1] != '=' && data[i + 1] != '/' && data[i + 1] != '*')) {
+                    tk.setToken(lookupToken(data + i, 1), TokenText(data + i, 1));
                     return i + 1;
-                } else if (str.at(i + 1) == '=') {
-                    tk.setToken(tokenMap[str.substr(i, 2)], str.substr(i, 2));
+                } else if (data[i + 1] == '=') {
+                    tk.setToken(lookupToken(data + i, 2), TokenText(data + i, 2));
                     return i + 2;
                 }
                     //remove comment. '/' 出现在这里，只能是注释
                     // '//', '/* */'
-                else if (str.at(i + 1) == '/') {
-                    while (i != str.length() && str.at(i) != '\n') {
-                        i++;
-                    }
+                else if (data[i + 1] == '/') {
                     tk.type = TK_NOT_VALID;
-                    return i;
-                } else if (str.at(i + 1) == '*') {
-                    i++;
-                    while (i != str.length() && str.at(i) != '/') {
-                        i++;
-                    }
-                    if (i != str.length() && str.at(i - 1) == '*' && i - startPos >= 3) {
+                    return scanChar(data, i, len, '\n');
+                } else if (data[i + 1] == '*') {
+                    i = scanChar(data, i + 1, len, '/');
+                    if (i != len && data[i - 1] == '*' && i - startPos >= 3) {
                         tk.type = TK_NOT_VALID;
                         return i + 1;
                     } else {
@@ -140,31 +653,14 @@ int Lex::getNextTokenInner(string &str, int startPos, Token &tk, Token &lastTk)
             }
             case '\'':
             case '"': {
-                bool inBackslashChain = false;
-                int backslashCount = 0;
-                i++;
                 //"...\"..."               "...\\"
-                while (1) {
-                    while (str.at(i) != str.at(startPos)) {
-                        if (str.at(i) == '\\') {
-                            inBackslashChain = true;
-                            backslashCount++;
-                        } else {
-                            inBackslashChain = false;
-                            backslashCount = 0;
-                        }
-                        i++;
-                        if (i == str.length()) {
-                            cout << "In string, quotation not match" << endl;
-                            return -1;
-                        }
-                    }
-                    if (backslashCount % 2 == 0) {
-                        tk.setToken(TK_STRING, str.substr(startPos, i - startPos + 1));
-                        return i + 1;
-                        break;
-                    }
+                i = scanString(data, i + 1, len, data[startPos]);
+                if (i == len) {
+                    cout << "In string, quotation not match" << endl;
+                    return -1;
                 }
+                tk.setToken(TK_STRING, TokenText(data + startPos, i - startPos + 1));
+                return i + 1;
             }
             case '.':
             case ',':
@@ -178,7 +674,7 @@ int Lex::getNextTokenInner(string &str, int startPos, Token &tk, Token &lastTk)
             case '[':
             case ']':
             case '~':
-                tk.setToken(tokenMap[str.substr(i, 1)], str.substr(i, 1));
+                tk.setToken(lookupToken(data + i, 1), TokenText(data + i, 1));
                 return i + 1;
                 break;
             case '+':
@@ -187,47 +683,47 @@ int Lex::getNextTokenInner(string &str, int startPos, Token &tk, Token &lastTk)
             case '&':
             case '|':
             case '^':
-                if (i + 1 == str.length() || (str.at(i + 1) != str.at(i) && str.at(i + 1) != '=')) {
-                    tk.setToken(tokenMap[str.substr(i, 1)], str.substr(i, 1));
+                if (i + 1 == len || (data[i + 1] != data[i] && data[i + 1] != '=')) {
+                    tk.setToken(lookupToken(data + i, 1), TokenText(data + i, 1));
                     return i + 1;
                 } else {
-                    tk.setToken(tokenMap[str.substr(i, 2)], str.substr(i, 2));
+                    tk.setToken(lookupToken(data + i, 2), TokenText(data + i, 2));
                     return i + 2;
                 }
                 break;
             case '%':
-                if (i + 1 == str.length() || (str.at(i + 1) != '=')) {
-                    tk.setToken(tokenMap[str.substr(i, 1)], str.substr(i, 1));
+                if (i + 1 == len || (data[i + 1] != '=')) {
+                    tk.setToken(lookupToken(data + i, 1), TokenText(data + i, 1));
                     return i + 1;
                 } else {
-                    tk.setToken(tokenMap[str.substr(i, 2)], str.substr(i, 2));
+                    tk.setToken(lookupToken(data + i, 2), TokenText(data + i, 2));
                     return i + 2;
                 }
                 break;
             case '<'://< <= << <<=
             case '>':
-                if (i + 1 == str.length() || (str.at(i + 1) != str.at(i) && str.at(i + 1) != '=')) {
-                    tk.setToken(tokenMap[str.substr(i, 1)], str.substr(i, 1));
+                if (i + 1 == len || (data[i + 1] != data[i] && data[i + 1] != '=')) {
+                    tk.setToken(lookupToken(data + i, 1), TokenText(data + i, 1));
                     return i + 1;
-                } else if (str.at(i + 1) == '=' ||
-                           (str.at(i + 1) == str.at(i) && (i + 2 == str.length() || str.at(i + 2) != '='))) {
-                    tk.setToken(tokenMap[str.substr(i, 2)], str.substr(i, 2));
+                } else if (data[i + 1] == '=' ||
+                           (data[i + 1] == data[i] && (i + 2 == len || data[i + 2] != '='))) {
+                    tk.setToken(lookupToken(data + i, 2), TokenText(data + i, 2));
                     return i + 2;
                 } else {
-                    tk.setToken(tokenMap[str.substr(i, 3)], str.substr(i, 3));
+                    tk.setToken(lookupToken(data + i, 3), TokenText(data + i, 3));
                     return i + 3;
                 }
                 break;
             case '!': // ! != !==
             case '=': // = == ===
-                if (i + 1 == str.length() || (str.at(i + 1) != '=')) {
-                    tk.setToken(tokenMap[str.substr(i, 1)], str.substr(i, 1));
+                if (i + 1 == len || (data[i + 1] != '=')) {
+                    tk.setToken(lookupToken(data + i, 1), TokenText(data + i, 1));
                     return i + 1;
-                } else if (i + 2 == str.length() || str.at(i + 2) != '=') {
-                    tk.setToken(tokenMap[str.substr(i, 2)], str.substr(i, 2));
+                } else if (i + 2 == len || data[i + 2] != '=') {
+                    tk.setToken(lookupToken(data + i, 2), TokenText(data + i, 2));
                     return i + 2;
                 } else {
-                    tk.setToken(tokenMap[str.substr(i, 3)], str.substr(i, 3));
+                    tk.setToken(lookupToken(data + i, 3), TokenText(data + i, 3));
                     return i + 3;
                 }
                 break;
@@ -238,17 +734,11 @@ int Lex::getNextTokenInner(string &str, int startPos, Token &tk, Token &lastTk)
         }
 
     } else {
-        while (isalnum(str.at(i)) || str.at(i) == '_') {
-            i++;
-            if (i == str.length()) {
-                break;
-            }
-        }
+        i = scanIdentifier(data, i, len);
 
-        tk.value = str.substr(startPos, i - startPos);
-        if (tokenMap.find(tk.value) != tokenMap.end()) {
-            tk.type = tokenMap[tk.value];
-        } else {
+        tk.value = TokenText(data + startPos, i - startPos);
+        tk.type = lookupToken(data + startPos, i - startPos);
+        if (tk.type == TK_NOT_VALID) {
             tk.type = TK_IDENTIFIER;
         }
         return i;
@@ -268,7 +758,7 @@ void Lex::match(TOKEN_TYPES expected_token) {
 
 string Lex::getTokenStr(TOKEN_TYPES tkType) {
     if (invTokenMap.find(tkType) != invTokenMap.end()) {
-        return invTokenMap[tkType];
+        return invTokenMap.at(tkType);
     }
 
     stringstream ss;
@@ -276,41 +766,46 @@ string Lex::getTokenStr(TOKEN_TYPES tkType) {
     return string("?[" + ss.str() + "]");
 }
 
-string Lex::getFunctionBody() {
+//step over the body of a function, the current token being its { or its TK_FUNCTION_BODY
+void Lex::skipFunctionBody() {
+    if (token.type == TK_FUNCTION_BODY) {
+        getNextToken();
+        return;
+    }
     int count = 1;
-    int prePos = posNow;
-    int start = posNow - 1;
-    int len = 1;
-
-
-    while (count > 0) {
+    if (token.match > posNow - 1 && token.match < tokenEnd) {
+        jumpTo(token.match);
+        count = 0;
+    }
+    while (count > 0 && token.type != TK_EOF) {
         this->getNextToken();
-        if (token.value == "{") {
+        if (token.type == TK_L_LARGE_BRACKET) {
             count++;
         }
-        if (token.value == "}") {
+        if (token.type == TK_R_LARGE_BRACKET) {
             count--;
         }
     };
-
-    len = posNow - prePos;
-    string result = originalStr.substr(start, len + 1);
     this->match(TK_R_LARGE_BRACKET);
-
-    return result;
 }
 
 Lex *Lex::getSubLex(int lastPosition) {
-    if (lastPosition >= tokenLastEnd) {
+    if (lastPosition >= posNow - 1) {
         cout << "getSubLex error: lastPositin >= tokenLastEnd" << endl;
         return nullptr;
     }
-    return new Lex(originalStr.substr(lastPosition - 1, tokenLastEnd - lastPosition + 2));
+    return new Lex(*this, lastPosition - 1, posNow - 1);
 
 }
 
 
+//lexes are made on the compile threads too, the maps are filled once and only read after that
 void Lex::initialTokenMap() {
+    static once_flag filled;
+    call_once(filled, fillTokenMaps);
+}
+
+void Lex::fillTokenMaps() {
     // value properties
     tokenMap["Infinity"] = TK_INFINITY;
     tokenMap["NaN"] = TK_NAN;
@@ -17,7 +17,11 @@
 #include <stdlib.h>
 #include <string>
 #include <unordered_map>
+#include <memory>
+#include <atomic>
 #include <assert.h>
+#include "Source.h"
+#include <string.h>
 
 using namespace std;
 
@@ -72,6 +76,7 @@ enum TOKEN_TYPES {
     TK_TYPEOF,
 
     TK_FUNCTION,
+    TK_FUNCTION_BODY, //{ ... } of a function as one token, tokenized when the function is first called
     TK_RETURN,
     TK_CLASS,
     TK_SUPER,
@@ -95,94 +100,240 @@ enum TOKEN_TYPES {
     TK_EOF
 };
 
+//superinstructions, set on the first token of a sequence the interpreter can run in one step
+enum FUSED_TYPES {
+    FUSED_NONE,
+    FUSED_CMP_BRANCH,   // id <op> id|int followed by ) or ;   -- if/while/for condition
+    FUSED_INC,          // id++ / id-- followed by ) or ;
+    FUSED_OP_ASSIGN,    // id += id|int / id -= id|int followed by ) or ;
+    FUSED_LOAD_OP_STORE // id = id + id|int / id = id - id|int followed by ) or ;
+};
+
+
+//smallest chunk worth a lexing thread of its own, in bytes
+const int LEX_CHUNK_MIN = 64 * 1024;
+
+// the text of a token, a view into the source it was lexed from: tokens own no memory and copying one
+// copies a pointer. text that is not in any source (what the optimizer folds) is kept in a buffer of its own
+class TokenText {
+public:
+    TokenText() { };
+
+    TokenText(const char *data, int length) : ptr(data), len(length) { };
+
+    TokenText(const string &text) : owned(make_shared<const string>(text)), ptr(owned->data()),
+                                    len((int) owned->size()) { };
+
+    TokenText(const char *text) : TokenText(string(text)) { };
+
+    const char *data() const {
+        return ptr;
+    }
+
+    int length() const {
+        return len;
+    }
+
+    bool empty() const {
+        return len == 0;
+    }
+
+    void clear() {
+        owned.reset();
+        ptr = "";
+        len = 0;
+    }
+
+    //a string of its own, for a value that has to outlive the source
+    string str() const {
+        return string(ptr, (size_t) len);
+    }
+
+    operator string() const {
+        return str();
+    }
+
+    string substr(int from, int count) const {
+        return string(ptr + from, (size_t) count);
+    }
+
+    bool operator==(const TokenText &other) const {
+        return len == other.len && memcmp(ptr, other.ptr, (size_t) len) == 0;
+    }
+
+    bool operator!=(const TokenText &other) const {
+        return !(*this == other);
+    }
+
+    bool operator==(const string &other) const {
+        return (size_t) len == other.size() && memcmp(ptr, other.data(), (size_t) len) == 0;
+    }
+
+    bool operator!=(const string &other) const {
+        return !(*this == other);
+    }
+
+    bool operator==(const char *other) const {
+        return strlen(other) == (size_t) len && memcmp(ptr, other, (size_t) len) == 0;
+    }
+
+private:
+    shared_ptr<const string> owned; //nullptr for a view into a source
+    const char *ptr = "";
+    int len = 0;
+};
+
+inline bool operator==(const string &a, const TokenText &b) {
+    return b == a;
+}
+
+inline bool operator!=(const string &a, const TokenText &b) {
+    return b != a;
+}
+
+inline ostream &operator<<(ostream &os, const TokenText &text) {
+    return os.write(text.data(), text.length());
+}
 
 class Token {
 public:
     Token() { };
 
-    Token(TOKEN_TYPES _type, const string &_value) : type(_type), value(_value) { };
+    Token(TOKEN_TYPES _type, const TokenText &_value) : type(_type), value(_value) { };
 
-    void setToken(TOKEN_TYPES _type, const string &_value) {
+    void setToken(TOKEN_TYPES _type, const TokenText &_value) {
         type = _type;
         value = _value;
     }
 
-    int getIntData() {
+    //short numbers fit the small string buffer, nothing is allocated
+    int getIntData() const {
         if (type == TK_DEC_INT) {
-            return stoi(value, 0, 10);
+            return stoi(value.str(), 0, 10);
         } else if (type == TK_OCTAL_INT) {
-            return stoi(value, 0, 8);
+            return stoi(value.str(), 0, 8);
         } else if (type == TK_HEX_INT) {
-            return stoi(value, 0, 16);
+            return stoi(value.str(), 0, 16);
         } else {
             assert(0);
             return 0;
         }
     }
 
-    double getFloatData() {
-        return atof(value.c_str());
+    double getFloatData() const {
+        return atof(value.str().c_str());
     }
 
     TOKEN_TYPES type;
-    string value;
+    TokenText value;
+    int pos = 0; //offset of the token in the source
+    int match = -1; //for ( [ { ) ] }, index of the bracket that pairs with it
+    int end = 0; //for TK_FUNCTION_BODY, offset of the closing }
+    unsigned char fused = FUSED_NONE;
 };
 
 class Lex {
 private:
-    map<string, TOKEN_TYPES> tokenMap;
-    map<TOKEN_TYPES, string> invTokenMap;
+    static map<string, TOKEN_TYPES> tokenMap;
+    static map<TOKEN_TYPES, string> invTokenMap;
 
-    int getNextTokenInner(string &str, int startPos, Token &tk, Token &lastTk);
+    static int getNextTokenInner(const char *data, int len, int startPos, Token &tk, const Token &lastTk);
     //return this token's endpos + 1
 
+    static TOKEN_TYPES lookupToken(const char *text, int length);
+
+    static void fillTokenMaps();
+
+    bool lexRange(int begin, int end, vector<Token> &out) const;
+
+    void tokenizeParallel(int threads);
+
 public:
-    string originalStr = "";
+    //the source is tokenized once, sub lexes are views into the same token stream
+    shared_ptr<const Source> source;
+    shared_ptr<vector<Token>> tokens;
+    int tokenBegin = 0;
+    int tokenEnd = 0;
 
     Token lastTk;
     Token token;
 
-    int tokenLastEnd;
-    int posNow = 0;
+    int posNow = 0; //index of the token after the current one
+
+    bool complete = true; //false when the lexer stopped at an error, the tokens end there
 
 
     Lex();
 
     Lex(const string &str);
 
-    void initialTokenMap();
+    //lexed straight from the source's buffer, a mapped file is not copied
+    Lex(const shared_ptr<const Source> &source);
 
-    void setString(const string &str) {
-        originalStr = str;
-    }
+    Lex(const Lex &parent, int begin, int end);
+
+    //tokenize source[begin, end) on its own, token offsets stay relative to the whole source
+    Lex(const shared_ptr<const Source> &source, int begin, int end);
+
+    //threads getLex lexes a big source with, 0 for one per core and 1 to lex it in a single pass
+    static atomic<int> lexThreads;
+
+    static void initialTokenMap();
+
+    void getLex();
+
+    void tokenize(int begin, int end);
+
+    static int preParseBody(const char *str, int begin, int end);
+
+    static vector<int> chunkBoundaries(const char *str, int len, int chunks);
+
+    static int statementsEnd(StatementStream &stream);
+
+    void matchBrackets();
+
+    void fuseTokens();
+
+    //TINYJS_PAIR_REPORT: how often getNextToken stepped from a token of one type to one of another, over
+    //every lex while it is set. what fuseTokens fuses was picked from these counts. one interpreter at a time
+    static vector<long long> *pairCounts;
+
+    static void countPair(TOKEN_TYPES from, TOKEN_TYPES to);
+
+    //the top most frequent pairs of pairCounts, most frequent first
+    static void pairReport(ostream &os, int top);
 
 
     void match(TOKEN_TYPES expected_token);
 
-    string getTokenStr(TOKEN_TYPES token);
+    static string getTokenStr(TOKEN_TYPES token);
 
     void reset();
 
-    string getFunctionBody();
+    void skipFunctionBody();
 
     Lex *getSubLex(int lastPosition);
 
 
     void getNextToken() {
-
         lastTk = token;
-        if (posNow > 0) {
-            tokenLastEnd = posNow - 1;
-        }
-
-        token.type = TK_NOT_VALID;
-        while (posNow < originalStr.length() && token.type == TK_NOT_VALID) {
-            posNow = getNextTokenInner(originalStr, posNow, token, lastTk);
-        }
-        if (posNow == originalStr.length() && token.type == TK_NOT_VALID) {
+        //the current token is always (*tokens)[posNow - 1], tokenEnd stands for eof
+        if (posNow < tokenEnd) {
+            token = (*tokens)[posNow++];
+        } else {
             token.type = TK_EOF;
+            token.value.clear();
+            posNow = tokenEnd + 1;
         }
+        if (pairCounts) {
+            countPair(lastTk.type, token.type);
+        }
+    }
 
+    //continue at the token at index, skipping everything before it
+    void jumpTo(int index) {
+        posNow = index;
+        getNextToken();
     }
 
 };
@@ -0,0 +1,271 @@
+//
+// Scanning kernels of the lexer: whitespace, comments, strings and identifiers, 16 or 32 bytes at a time
+// with SSE2/AVX2 where the CPU has it.
+//
+
+#include "LexScan.h"
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define TINYJS_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static inline bool isSpaceChar(unsigned char c) {
+    return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+static inline bool isIdentifierChar(unsigned char c) {
+    return (unsigned char) ((c | 0x20) - 'a') <= 'z' - 'a' || (unsigned char) (c - '0') <= 9 || c == '_';
+}
+
+static int scalarSpace(const char *s, int i, int len) {
+    while (i < len && isSpaceChar(s[i])) {
+        i++;
+    }
+    return i;
+}
+
+static int scalarIdentifier(const char *s, int i, int len) {
+    while (i < len && isIdentifierChar(s[i])) {
+        i++;
+    }
+    return i;
+}
+
+static int scalarChar(const char *s, int i, int len, char c) {
+    while (i < len && s[i] != c) {
+        i++;
+    }
+    return i;
+}
+
+static int scalarQuote(const char *s, int i, int len, char quote) {
+    while (i < len && s[i] != quote && s[i] != '\\') {
+        i++;
+    }
+    return i;
+}
+
+#ifdef TINYJS_SCAN_X86
+
+// a block is scanned whole when it fits, the tail goes through the scalar loop: nothing past len is read.
+// each mask has a bit set for the bytes the scan stops at
+
+static int sse2Space(const char *s, int i, int len) {
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), range = _mm_set1_epi8('\r' - '\t');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i t = _mm_sub_epi8(v, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(_mm_min_epu8(t, range), t));
+        int mask = ~_mm_movemask_epi8(ws) & 0xFFFF;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scalarSpace(s, i, len);
+}
+
+static int sse2Identifier(const char *s, int i, int len) {
+    const __m128i lower = _mm_set1_epi8(0x20), a = _mm_set1_epi8('a'), letters = _mm_set1_epi8('z' - 'a');
+    const __m128i zero = _mm_set1_epi8('0'), digits = _mm_set1_epi8(9), underscore = _mm_set1_epi8('_');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i l = _mm_sub_epi8(_mm_or_si128(v, lower), a);
+        __m128i d = _mm_sub_epi8(v, zero);
+        __m128i id = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(l, letters), l),
+                                               _mm_cmpeq_epi8(_mm_min_epu8(d, digits), d)),
+                                  _mm_cmpeq_epi8(v, underscore));
+        int mask = ~_mm_movemask_epi8(id) & 0xFFFF;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scalarIdentifier(s, i, len);
+}
+
+static int sse2Char(const char *s, int i, int len, char c) {
+    const __m128i target = _mm_set1_epi8(c);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, target));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scalarChar(s, i, len, c);
+}
+
+static int sse2Quote(const char *s, int i, int len, char quote) {
+    const __m128i target = _mm_set1_epi8(quote), backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, target), _mm_cmpeq_epi8(v, backslash)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scalarQuote(s, i, len, quote);
+}
+
+__attribute__((target("avx2")))
+static int avx2Space(const char *s, int i, int len) {
+    const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i range = _mm256_set1_epi8('\r' - '\t');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i t = _mm256_sub_epi8(v, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                     _mm256_cmpeq_epi8(_mm256_min_epu8(t, range), t));
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(ws);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return sse2Space(s, i, len);
+}
+
+__attribute__((target("avx2")))
+static int avx2Identifier(const char *s, int i, int len) {
+    const __m256i lower = _mm256_set1_epi8(0x20), a = _mm256_set1_epi8('a');
+    const __m256i letters = _mm256_set1_epi8('z' - 'a');
+    const __m256i zero = _mm256_set1_epi8('0'), digits = _mm256_set1_epi8(9);
+    const __m256i underscore = _mm256_set1_epi8('_');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        __m256i l = _mm256_sub_epi8(_mm256_or_si256(v, lower), a);
+        __m256i d = _mm256_sub_epi8(v, zero);
+        __m256i id = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(l, letters), l),
+                                                     _mm256_cmpeq_epi8(_mm256_min_epu8(d, digits), d)),
+                                     _mm256_cmpeq_epi8(v, underscore));
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(id);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return sse2Identifier(s, i, len);
+}
+
+__attribute__((target("avx2")))
+static int avx2Char(const char *s, int i, int len, char c) {
+    const __m256i target = _mm256_set1_epi8(c);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, target));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return sse2Char(s, i, len, c);
+}
+
+__attribute__((target("avx2")))
+static int avx2Quote(const char *s, int i, int len, char quote) {
+    const __m256i target = _mm256_set1_epi8(quote), backslash = _mm256_set1_epi8('\\');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, target),
+                                                                        _mm256_cmpeq_epi8(v, backslash)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return sse2Quote(s, i, len, quote);
+}
+
+#endif
+
+struct ScanKernel {
+    LEX_SCAN_KERNELS kind;
+    int (*space)(const char *s, int i, int len);
+    int (*identifier)(const char *s, int i, int len);
+    int (*character)(const char *s, int i, int len, char c);
+    int (*quote)(const char *s, int i, int len, char quote);
+};
+
+static const ScanKernel scalarKernel{SCAN_SCALAR, scalarSpace, scalarIdentifier, scalarChar, scalarQuote};
+#ifdef TINYJS_SCAN_X86
+static const ScanKernel sse2Kernel{SCAN_SSE2, sse2Space, sse2Identifier, sse2Char, sse2Quote};
+static const ScanKernel avx2Kernel{SCAN_AVX2, avx2Space, avx2Identifier, avx2Char, avx2Quote};
+#endif
+
+static bool supported(LEX_SCAN_KERNELS kernel) {
+#ifdef TINYJS_SCAN_X86
+    __builtin_cpu_init();
+    return kernel != SCAN_AVX2 || __builtin_cpu_supports("avx2");
+#else
+    return kernel == SCAN_SCALAR;
+#endif
+}
+
+static const ScanKernel *kernelOf(LEX_SCAN_KERNELS kernel) {
+#ifdef TINYJS_SCAN_X86
+    if (kernel == SCAN_AVX2) {
+        return &avx2Kernel;
+    } else if (kernel == SCAN_SSE2) {
+        return &sse2Kernel;
+    }
+#endif
+    return &scalarKernel;
+}
+
+static const ScanKernel *best() {
+    return kernelOf(supported(SCAN_AVX2) ? SCAN_AVX2 : supported(SCAN_SSE2) ? SCAN_SSE2 : SCAN_SCALAR);
+}
+
+// read with relaxed loads (a plain load) by lexers on any thread, set on startup
+static atomic<const ScanKernel *> active{best()};
+
+int scanSpace(const char *s, int i, int len) {
+    return active.load(memory_order_relaxed)->space(s, i, len);
+}
+
+int scanIdentifier(const char *s, int i, int len) {
+    return active.load(memory_order_relaxed)->identifier(s, i, len);
+}
+
+int scanChar(const char *s, int i, int len, char c) {
+    return active.load(memory_order_relaxed)->character(s, i, len, c);
+}
+
+int scanString(const char *s, int i, int len, char quote) {
+    const ScanKernel *kernel = active.load(memory_order_relaxed);
+    while (true) {
+        //a short string, or the rest of one right after an escape, ends before a block would pay off
+        int head = min(i + 8, len);
+        while (i < head && s[i] != quote && s[i] != '\\') {
+            i++;
+        }
+        if (i == head && i < len) {
+            i = kernel->quote(s, i, len, quote);
+        }
+        if (i >= len || s[i] == quote) {
+            return i;
+        }
+        //skip the backslash and what it escapes
+        i += 2;
+        if (i >= len) {
+            return len;
+        }
+    }
+}
+
+LEX_SCAN_KERNELS lexScanKernel() {
+    return active.load(memory_order_relaxed)->kind;
+}
+
+bool setLexScanKernel(LEX_SCAN_KERNELS kernel) {
+    if (!supported(kernel)) {
+        return false;
+    }
+    active.store(kernelOf(kernel), memory_order_relaxed);
+    return true;
+}
+
+const char *lexScanKernelName(LEX_SCAN_KERNELS kernel) {
+    static const char *names[] = {"scalar", "sse2", "avx2"};
+    return names[kernel];
+}
@@ -0,0 +1,37 @@
+//
+// Scanning kernels of the lexer: whitespace, comments, strings and identifiers, 16 or 32 bytes at a time
+// with SSE2/AVX2 where the CPU has it.
+//
+
+#ifndef TINYJS_LEXSCAN_H
+#define TINYJS_LEXSCAN_H
+
+enum LEX_SCAN_KERNELS {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+};
+
+// every scan reads s[i, len) and returns the offset it stopped at, len when it ran off the end
+
+// first character that is not whitespace (isspace in the C locale)
+int scanSpace(const char *s, int i, int len);
+
+// first character that is not a letter, digit or _
+int scanIdentifier(const char *s, int i, int len);
+
+// first c
+int scanChar(const char *s, int i, int len, char c);
+
+// the quote closing a string whose body starts at i, a backslash escapes the character after it
+int scanString(const char *s, int i, int len, char quote);
+
+// the best kernel this CPU runs is picked on startup
+LEX_SCAN_KERNELS lexScanKernel();
+
+// false when the CPU cannot run it
+bool setLexScanKernel(LEX_SCAN_KERNELS kernel);
+
+const char *lexScanKernelName(LEX_SCAN_KERNELS kernel);
+
+#endif //TINYJS_LEXSCAN_H
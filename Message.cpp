@@ -0,0 +1,246 @@
+//
+// A value on its way from one isolate to another: cloned into bytes, or moved.
+//
+
+#include "Message.h"
+#include <string.h>
+
+template<typename T>
+static void put(string &data, T value) {
+    data.append((const char *) &value, sizeof(T));
+}
+
+template<typename T>
+static T get(const string &data, size_t &pos) {
+    T value = T();
+    if (pos + sizeof(T) <= data.size()) {
+        memcpy(&value, data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+    }
+    return value;
+}
+
+static void putString(string &data, const string &s) {
+    put(data, (uint32_t) s.size());
+    data.append(s);
+}
+
+static string getString(const string &data, size_t &pos) {
+    size_t n = min((size_t) get<uint32_t>(data, pos), data.size() - pos);
+    pos += n;
+    return data.substr(pos - n, n);
+}
+
+// name is i written out, without making a string of i
+static bool isIndex(const string &name, uint32_t i) {
+    char digits[12];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - ++n] = (char) ('0' + i % 10);
+        i /= 10;
+    } while (i);
+    return name.size() == n && memcmp(name.data(), digits + sizeof(digits) - n, n) == 0;
+}
+
+// the elements of array, taken from it into an array of their own, when all of them are plain values.
+// nullptr otherwise, and array is left as it was. an element some other var holds too is copied, the rest
+// only change owner
+static Var *detach(Var *array) {
+    if (!array->isArray() || array->frozen || !array->firstChild) {
+        return nullptr;
+    }
+    Var *moved = new Var("", VAR_ARRAY);
+    //raw pointers: the list stays as it is, and walking it should not touch every count
+    for (VarLink *link = array->firstChild.get(); link; link = link->nextSibling.get()) {
+        if (!link->var->isBasic() || link->var->isFunction() || link->var->frozen) {
+            for (VarLink *back = link->prevSibling.get(); back; back = back->prevSibling.get()) {
+                back->owner = array;
+            }
+            delete moved;
+            return nullptr;
+        }
+        link->owner = moved;
+        if (link->var->getRefNum() > 1) {
+            Var *copy = new Var();
+            copy->copy(link->var);
+            link->replaceWith(copy);
+        }
+    }
+    moved->firstChild = move(array->firstChild);
+    moved->lastChild = move(array->lastChild);
+    return moved;
+}
+
+// the arrays under var, each once. an array is not looked into, its elements move with it or not at all
+static void findArrays(Var *var, unordered_map<Var *, bool> &seen, vector<Var *> &arrays) {
+    if (var->isBasic() || seen.count(var)) {
+        return;
+    }
+    seen[var] = true;
+    if (var->isArray()) {
+        arrays.push_back(var);
+        return;
+    }
+    for (VarLink *link = var->firstChild.get(); link; link = link->nextSibling.get()) {
+        findArrays(link->var, seen, arrays);
+    }
+}
+
+vector<Var *> Message::arraysIn(Var *value) {
+    unordered_map<Var *, bool> seen;
+    vector<Var *> arrays;
+    findArrays(value, seen, arrays);
+    return arrays;
+}
+
+Message::~Message() {
+    for (auto var: moved) {
+        if (var && var->getRefNum() == 0) {
+            delete var;
+        }
+    }
+}
+
+bool Message::write(Var *value, const vector<Var *> &transfer) {
+    unordered_map<Var *, uint32_t> moving;
+    for (auto var: transfer) {
+        if (moving.count(var)) {
+            continue;
+        }
+        Var *elements = detach(var);
+        if (elements) {
+            moving[var] = (uint32_t) moved.size();
+            moved.push_back(elements);
+        }
+    }
+    unordered_map<Var *, uint32_t> seen;
+    return writeVar(value, seen, moving);
+}
+
+bool Message::writeVar(Var *var, unordered_map<Var *, uint32_t> &seen,
+                       const unordered_map<Var *, uint32_t> &moving) {
+    auto move = moving.find(var);
+    if (move != moving.end()) {
+        data += 'x';
+        put(data, move->second);
+        return true;
+    }
+    if (var->isFunction()) {
+        cout << "error: a function cannot be sent to another isolate" << endl;
+        data += 'u';
+        return false;
+    }
+    if (var->isBasic() && !var->isArray() && !var->isObject()) {
+        switch (var->type) {
+            case VAR_NULL:
+                data += 'n';
+                break;
+            case VAR_BOOLEAN:
+                data += var->getBool() ? 't' : 'f';
+                break;
+            case VAR_INTEGER:
+                data += 'i';
+                put(data, (int32_t) var->getInt());
+                break;
+            case VAR_DOUBLE:
+                data += 'd';
+                put(data, var->getDouble());
+                break;
+            case VAR_STRING:
+                data += 's';
+                putString(data, var->getString());
+                break;
+            default:
+                data += 'u';
+        }
+        return true;
+    }
+
+    auto found = seen.find(var);
+    if (found != seen.end()) {
+        data += 'r';
+        put(data, found->second);
+        return true;
+    }
+    uint32_t id = (uint32_t) seen.size();
+    seen[var] = id;
+
+    uint32_t n = 0;
+    bool dense = var->isArray();
+    for (VarLink *link = var->firstChild.get(); link; link = link->nextSibling.get()) {
+        dense = dense && isIndex(link->name, n);
+        n++;
+    }
+    //a dense array is its elements in order, anything else has its children named
+    bool ok = true;
+    if (dense) {
+        data += 'a';
+        put(data, n);
+    } else {
+        data += 'c';
+        put(data, (uint8_t) var->type);
+        put(data, n);
+    }
+    for (VarLink *link = var->firstChild.get(); link; link = link->nextSibling.get()) {
+        if (!dense) {
+            putString(data, link->name);
+        }
+        ok = writeVar(link->var, seen, moving) && ok;
+    }
+    return ok;
+}
+
+Var *Message::read() {
+    pos = 0;
+    vector<Var *> seen;
+    Var *value = data.empty() ? nullptr : readVar(seen);
+    data.clear();
+    //a moved array the value does not reach is let go with the message
+    for (auto &var: moved) {
+        if (var == value || var->getRefNum() > 0) {
+            var = nullptr;
+        }
+    }
+    return value;
+}
+
+Var *Message::readVar(vector<Var *> &seen) {
+    char tag = get<char>(data, pos);
+    switch (tag) {
+        case 'n':
+            return new Var("null", VAR_NULL);
+        case 't':
+            return new Var(true);
+        case 'f':
+            return new Var(false);
+        case 'i':
+            return new Var((int) get<int32_t>(data, pos));
+        case 'd':
+            return new Var(get<double>(data, pos));
+        case 's':
+            return new Var(getString(data, pos));
+        case 'x': {
+            uint32_t index = get<uint32_t>(data, pos);
+            return index < moved.size() ? moved[index] : new Var();
+        }
+        case 'r': {
+            uint32_t index = get<uint32_t>(data, pos);
+            return index < seen.size() ? seen[index] : new Var();
+        }
+        case 'a':
+        case 'c': {
+            int type = tag == 'a' ? (int) VAR_ARRAY : get<uint8_t>(data, pos);
+            Var *var = new Var("", type);
+            seen.push_back(var);
+            uint32_t n = get<uint32_t>(data, pos);
+            for (uint32_t i = 0; i < n && pos < data.size(); i++) {
+                string name = tag == 'a' ? to_string(i) : getString(data, pos);
+                var->addChild(name, readVar(seen));
+            }
+            var->type = type;
+            return var;
+        }
+        default:
+            return new Var();
+    }
+}
@@ -0,0 +1,54 @@
+//
+// A value on its way from one isolate to another: cloned into bytes, or moved.
+//
+
+#ifndef TINYJS_MESSAGE_H
+#define TINYJS_MESSAGE_H
+
+#include "var.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+using namespace std;
+
+// the clone is a compact binary form of the value, with ints and doubles as they are in memory and dense
+// arrays without their index names. vars reached twice are written once, so shared parts and cycles stay
+// that way. an array in transfer is not cloned but moved: its elements go over as they are, and the sender
+// is left with an empty array. only arrays of plain values (numbers, strings, booleans) can be moved, any
+// other array in transfer is cloned
+class Message {
+public:
+    Message() { };
+
+    Message(const Message &) = delete;
+
+    Message &operator=(const Message &) = delete;
+
+    //the arrays moved and never read go with the message
+    ~Message();
+
+    //value, with the arrays in transfer moved. functions cannot be sent: they arrive as undefined, and false
+    //is returned
+    bool write(Var *value, const vector<Var *> &transfer);
+
+    //the value as vars of the reading isolate, once. nullptr for undefined
+    Var *read();
+
+    //the arrays value is or holds through objects, for transfer
+    static vector<Var *> arraysIn(Var *value);
+
+    size_t size() { return data.size(); }
+
+private:
+    string data;
+    vector<Var *> moved;
+    size_t pos = 0;
+
+    bool writeVar(Var *var, unordered_map<Var *, uint32_t> &seen, const unordered_map<Var *, uint32_t> &moving);
+
+    Var *readVar(vector<Var *> &seen);
+};
+
+#endif //TINYJS_MESSAGE_H
@@ -0,0 +1,606 @@
+//
+// Parse time optimizations over the token stream.
+//
+// Constant folding: an expression made only of literals and operators, standing where the
+// interpreter calls eval (after =, +=, -=, return, (, [ or , and before ;, ), ] or ,), is evaluated
+// once with the interpreter's grammar and Var::mathOp and replaced by one literal token. Operations
+// that would assert or trap in mathOp (bool == bool, x / 0, ...) are left to run time.
+//
+// Dead-branch elimination: if (literal) and literal ? a : b keep only the branch that runs. A skipped
+// branch is not free of effects in this interpreter (var and function still declare their names,
+// calls are still made), so branches with those are kept.
+//
+
+#include "Optimizer.h"
+#include <limits.h>
+#include <stdio.h>
+
+static const size_t NONE = (size_t) -1;
+
+static bool isLiteral(TOKEN_TYPES type) {
+    return type == TK_DEC_INT || type == TK_HEX_INT || type == TK_OCTAL_INT || type == TK_FLOAT ||
+           type == TK_STRING || type == TK_TRUE || type == TK_FALSE;
+}
+
+static bool isFoldable(TOKEN_TYPES type) {
+    switch (type) {
+        case TK_PLUS:
+        case TK_MINUS:
+        case TK_MULTIPLY:
+        case TK_DIVIDE:
+        case TK_MOD:
+        case TK_BITWISE_AND:
+        case TK_BITWISE_OR:
+        case TK_BITWISE_XOR:
+        case TK_AND_AND:
+        case TK_OR_OR:
+        case TK_EQUAL:
+        case TK_N_EQUAL:
+        case TK_TYPEEQUAL:
+        case TK_N_TYPEEQUAL:
+        case TK_LESS:
+        case TK_GREATER:
+        case TK_L_EQUAL:
+        case TK_G_EQUAL:
+        case TK_L_SHIFT:
+        case TK_R_SHIFT:
+        case TK_NOT:
+        case TK_BITWISE_NOT:
+        case TK_QUESTION_MARK:
+        case TK_COLON:
+        case TK_L_BRACKET:
+        case TK_R_BRACKET:
+            return true;
+        default:
+            return isLiteral(type);
+    }
+}
+
+// tokens after which the interpreter parses a whole expression with eval
+static bool isExpressionStart(TOKEN_TYPES type) {
+    return type == TK_ASSIGN || type == TK_PLUS_EQUAL || type == TK_MINUS_EQUAL || type == TK_RETURN ||
+           type == TK_L_BRACKET || type == TK_L_SQUARE_BRACKET || type == TK_COMMA;
+}
+
+static bool isExpressionEnd(TOKEN_TYPES type) {
+    return type == TK_SEMICOLON || type == TK_R_BRACKET || type == TK_R_SQUARE_BRACKET || type == TK_COMMA;
+}
+
+static bool isOpen(TOKEN_TYPES type) {
+    return type == TK_L_BRACKET || type == TK_L_SQUARE_BRACKET || type == TK_L_LARGE_BRACKET;
+}
+
+static bool isClose(TOKEN_TYPES type) {
+    return type == TK_R_BRACKET || type == TK_R_SQUARE_BRACKET || type == TK_R_LARGE_BRACKET;
+}
+
+// the cases of Var::mathOp that return a value instead of asserting or trapping
+static bool safe(Var *a, Var *b, TOKEN_TYPES op) {
+    if (op == TK_TYPEEQUAL || op == TK_N_TYPEEQUAL) {
+        return a->type != b->type || safe(a, b, TK_EQUAL);
+    }
+    if ((a->isUndefined() || a->isNull()) && (b->isUndefined() || b->isNull())) {
+        return true;
+    }
+    if (a->isBoolean() && b->isBoolean()) {
+        return op == TK_AND_AND || op == TK_OR_OR;
+    }
+    bool compare = op == TK_EQUAL || op == TK_N_EQUAL || op == TK_LESS || op == TK_GREATER ||
+                   op == TK_L_EQUAL || op == TK_G_EQUAL;
+    if ((a->isNumber() || a->isUndefined()) && (b->isNumber() || b->isUndefined())) {
+        if (!a->isDouble() && !b->isDouble()) {
+            if (op == TK_DIVIDE || op == TK_MOD) {
+                return b->getInt() != 0 && !(a->getInt() == INT_MIN && b->getInt() == -1);
+            }
+            return compare || op == TK_PLUS || op == TK_MINUS || op == TK_MULTIPLY || op == TK_BITWISE_AND ||
+                   op == TK_BITWISE_OR || op == TK_BITWISE_XOR;
+        }
+        return compare || op == TK_PLUS || op == TK_MINUS || op == TK_MULTIPLY || op == TK_DIVIDE;
+    }
+    if (a->isArray() || a->isObject()) {
+        return false;
+    }
+    return compare || op == TK_PLUS;
+}
+
+// an int literal stoi can read, so folding never throws where the interpreter would not run
+static bool intLiteral(const Token &tk) {
+    int base = tk.type == TK_HEX_INT ? 16 : tk.type == TK_OCTAL_INT ? 8 : 10;
+    long long value = strtoll(tk.value.str().c_str(), nullptr, base);
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+static bool toToken(Var *v, Token &tk) {
+    if (v->isInt()) {
+        tk.setToken(TK_DEC_INT, to_string(v->getInt()));
+    } else if (v->isDouble()) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.17g", v->getDouble());
+        tk.setToken(TK_FLOAT, buf);
+    } else if (v->isBoolean()) {
+        tk.setToken(v->getBool() ? TK_TRUE : TK_FALSE, v->getBool() ? "true" : "false");
+    } else if (v->isString()) {
+        tk.setToken(TK_STRING, "\"" + v->getString() + "\"");
+    } else {
+        return false;
+    }
+    tk.fused = FUSED_NONE;
+    return true;
+}
+
+// index after the bracket matching the one at begin
+static size_t closing(const vector<Token> &tokens, size_t begin, size_t finish) {
+    int depth = 0;
+    for (size_t i = begin; i < finish; i++) {
+        if (isOpen(tokens[i].type)) {
+            depth++;
+        } else if (isClose(tokens[i].type) && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return NONE;
+}
+
+// index after the statement starting at begin, the way Interpreter::statement reads it
+static size_t statementEnd(const vector<Token> &tokens, size_t begin, size_t finish) {
+    if (begin >= finish) {
+        return NONE;
+    }
+    switch (tokens[begin].type) {
+        case TK_L_LARGE_BRACKET:
+            return closing(tokens, begin, finish);
+        case TK_SEMICOLON:
+        case TK_BREAK:
+        case TK_CONTINUE: //the ; after them is an empty statement of its own
+            return begin + 1;
+        case TK_IF: {
+            if (begin + 1 >= finish || tokens[begin + 1].type != TK_L_BRACKET) {
+                return NONE;
+            }
+            size_t cond = closing(tokens, begin + 1, finish);
+            size_t then = cond == NONE ? NONE : statementEnd(tokens, cond, finish);
+            if (then != NONE && then < finish && tokens[then].type == TK_ELSE) {
+                return statementEnd(tokens, then + 1, finish);
+            }
+            return then;
+        }
+        case TK_WHILE:
+        case TK_FOR: {
+            if (begin + 1 >= finish || tokens[begin + 1].type != TK_L_BRACKET) {
+                return NONE;
+            }
+            size_t header = closing(tokens, begin + 1, finish);
+            return header == NONE ? NONE : statementEnd(tokens, header, finish);
+        }
+        case TK_FUNCTION: {
+            if (begin + 2 >= finish || tokens[begin + 2].type != TK_L_BRACKET) {
+                return NONE;
+            }
+            size_t params = closing(tokens, begin + 2, finish);
+            if (params != NONE && params < finish && tokens[params].type == TK_FUNCTION_BODY) {
+                return params + 1;
+            }
+            if (params == NONE || params >= finish || tokens[params].type != TK_L_LARGE_BRACKET) {
+                return NONE;
+            }
+            return closing(tokens, params, finish);
+        }
+        default: {
+            int depth = 0;
+            for (size_t i = begin; i < finish; i++) {
+                if (isOpen(tokens[i].type)) {
+                    depth++;
+                } else if (isClose(tokens[i].type) && --depth < 0) {
+                    return NONE;
+                } else if (depth == 0 && tokens[i].type == TK_SEMICOLON) {
+                    return i + 1;
+                }
+            }
+            return NONE;
+        }
+    }
+}
+
+// would skipping these tokens still do something: declare a name, build an object or call a function
+static bool hasEffects(const vector<Token> &tokens, size_t begin, size_t finish) {
+    for (size_t i = begin; i < finish; i++) {
+        TOKEN_TYPES type = tokens[i].type;
+        if (type == TK_VAR || type == TK_FUNCTION || type == TK_NEW) {
+            return true;
+        }
+        if (type == TK_L_BRACKET && i > begin && (tokens[i - 1].type == TK_IDENTIFIER ||
+                                                  tokens[i - 1].type == TK_R_SQUARE_BRACKET ||
+                                                  tokens[i - 1].type == TK_R_BRACKET)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Optimizer::run(Lex &lex) {
+    vector<Token> &tokens = *lex.tokens;
+    fold(tokens);
+
+    vector<Token> out;
+    out.reserve(tokens.size());
+    eliminate(tokens, 0, tokens.size(), out);
+    tokens.swap(out);
+
+    //the superinstructions and bracket pairs point at other tokens, mark them again on the new stream
+    for (auto &tk: tokens) {
+        tk.fused = FUSED_NONE;
+    }
+    lex.tokenBegin = 0;
+    lex.tokenEnd = (int) tokens.size();
+    lex.matchBrackets();
+    lex.fuseTokens();
+    lex.reset();
+}
+
+void Optimizer::fold(vector<Token> &tokens) {
+    vector<Token> out;
+    out.reserve(tokens.size());
+    size_t n = tokens.size();
+    for (size_t i = 0; i < n; i++) {
+        out.push_back(tokens[i]);
+        if (!isExpressionStart(tokens[i].type)) {
+            continue;
+        }
+        size_t j = i + 1;
+        int depth = 0;
+        while (j < n && isFoldable(tokens[j].type)) {
+            if (tokens[j].type == TK_L_BRACKET) {
+                depth++;
+            } else if (tokens[j].type == TK_R_BRACKET && --depth < 0) {
+                break;
+            }
+            j++;
+        }
+        Token folded;
+        if (j - (i + 1) < 2 || j >= n || !isExpressionEnd(tokens[j].type) || !foldRange(tokens, i + 1, j, folded)) {
+            continue;
+        }
+        folded.pos = tokens[i + 1].pos;
+        out.push_back(folded);
+        stats.foldedExpressions++;
+        stats.foldedNodes += nodes;
+        i = j - 1;
+    }
+    tokens.swap(out);
+}
+
+bool Optimizer::foldRange(const vector<Token> &tokens, size_t begin, size_t finish, Token &folded) {
+    in = &tokens;
+    pos = begin;
+    end = finish;
+    failed = false;
+    nodes = 0;
+    auto v = eval(false);
+    return !failed && v && pos == end && toToken(v->var, folded);
+}
+
+// the condition the interpreter sees for a literal
+bool Optimizer::literalBool(const vector<Token> &tokens, size_t at) {
+    in = &tokens;
+    pos = at;
+    end = at + 1;
+    failed = false;
+    auto v = factor(false);
+    return v && v->var->getBool();
+}
+
+void Optimizer::eliminate(const vector<Token> &tokens, size_t begin, size_t finish, vector<Token> &out) {
+    size_t i = begin;
+    while (i < finish) {
+        const Token &tk = tokens[i];
+
+        // if (literal) statement [else statement]
+        if (tk.type == TK_IF && i + 3 < finish && tokens[i + 1].type == TK_L_BRACKET &&
+            isLiteral(tokens[i + 2].type) && tokens[i + 3].type == TK_R_BRACKET) {
+            size_t thenEnd = statementEnd(tokens, i + 4, finish);
+            bool hasElse = thenEnd != NONE && thenEnd < finish && tokens[thenEnd].type == TK_ELSE;
+            size_t elseEnd = hasElse ? statementEnd(tokens, thenEnd + 1, finish) : thenEnd;
+            if (thenEnd != NONE && elseEnd != NONE) {
+                bool cond = literalBool(tokens, i + 2);
+                size_t dropBegin = cond ? thenEnd : i + 4, dropEnd = cond ? elseEnd : thenEnd;
+                if (!hasEffects(tokens, dropBegin, dropEnd)) {
+                    if (cond) {
+                        eliminate(tokens, i + 4, thenEnd, out);
+                    } else if (hasElse) {
+                        eliminate(tokens, thenEnd + 1, elseEnd, out);
+                    } else {
+                        //still a statement, the if may be the body of a loop or another if
+                        Token empty(TK_SEMICOLON, ";");
+                        empty.pos = tk.pos;
+                        out.push_back(empty);
+                    }
+                    stats.deadBranches++;
+                    i = elseEnd;
+                    continue;
+                }
+            }
+        }
+
+        // literal ? a : b, the literal being the whole condition
+        if (isExpressionStart(tk.type) && i + 2 < finish && isLiteral(tokens[i + 1].type) &&
+            tokens[i + 2].type == TK_QUESTION_MARK) {
+            size_t colon = NONE, armEnd = NONE;
+            int depth = 0;
+            for (size_t j = i + 3; j < finish; j++) {
+                TOKEN_TYPES type = tokens[j].type;
+                if (depth == 0) {
+                    if (type == TK_ASSIGN || type == TK_PLUS_EQUAL || type == TK_MINUS_EQUAL) {
+                        break;
+                    }
+                    bool stop = type == TK_QUESTION_MARK || isExpressionEnd(type) || isClose(type);
+                    if (colon == NONE && type == TK_COLON) {
+                        colon = j;
+                        continue;
+                    } else if (colon == NONE && stop) {
+                        break;
+                    } else if (colon != NONE && (stop || type == TK_COLON)) {
+                        armEnd = j;
+                        break;
+                    }
+                }
+                if (isOpen(type)) {
+                    depth++;
+                } else if (isClose(type)) {
+                    depth--;
+                }
+            }
+            if (colon != NONE && armEnd != NONE && tokens[armEnd].type != TK_COLON &&
+                tokens[armEnd].type != TK_R_LARGE_BRACKET && colon > i + 3 && armEnd > colon + 1) {
+                bool cond = literalBool(tokens, i + 1);
+                size_t dropBegin = cond ? colon + 1 : i + 3, dropEnd = cond ? armEnd : colon;
+                if (!hasEffects(tokens, dropBegin, dropEnd)) {
+                    out.push_back(tk);
+                    if (cond) {
+                        eliminate(tokens, i + 3, colon, out);
+                    } else {
+                        eliminate(tokens, colon + 1, armEnd, out);
+                    }
+                    stats.deadBranches++;
+                    i = armEnd;
+                    continue;
+                }
+            }
+        }
+
+        out.push_back(tk);
+        i++;
+    }
+}
+
+TOKEN_TYPES Optimizer::peek() {
+    return pos < end ? (*in)[pos].type : TK_EOF;
+}
+
+void Optimizer::next() {
+    pos++;
+}
+
+shared_ptr<VarLink> Optimizer::fail() {
+    failed = true;
+    return nullptr;
+}
+
+shared_ptr<VarLink> Optimizer::apply(shared_ptr<VarLink> lhs, Var *rhs, TOKEN_TYPES op) {
+    if (!safe(lhs->var, rhs, op)) {
+        return fail();
+    }
+    return make_shared<VarLink>(lhs->var->mathOp(rhs, op));
+}
+
+// the functions below follow Interpreter::eval ... factor, skip standing for the SKIPPING state
+
+shared_ptr<VarLink> Optimizer::eval(bool skip) {
+    auto lhs = ternary(skip);
+    if (peek() == TK_ASSIGN || peek() == TK_PLUS_EQUAL || peek() == TK_MINUS_EQUAL) {
+        return fail();
+    }
+    return lhs;
+}
+
+shared_ptr<VarLink> Optimizer::ternary(bool skip) {
+    auto lhs = logic(skip);
+    while (!failed && peek() == TK_QUESTION_MARK) {
+        next();
+        nodes++;
+        bool first = !skip && lhs->var->getBool();
+        auto a = logic(skip || !first);
+        if (failed || peek() != TK_COLON) {
+            return fail();
+        }
+        next();
+        auto b = logic(skip || first);
+        if (failed) {
+            return nullptr;
+        }
+        lhs = first ? a : b;
+    }
+    return failed ? nullptr : lhs;
+}
+
+shared_ptr<VarLink> Optimizer::logic(bool skip) {
+    auto lhs = compare(skip);
+    while (!failed && (peek() == TK_BITWISE_AND || peek() == TK_BITWISE_OR || peek() == TK_BITWISE_XOR ||
+                       peek() == TK_AND_AND || peek() == TK_OR_OR)) {
+        auto op = peek();
+        next();
+        nodes++;
+        bool getBool = false, shortCircuit = false;
+        if (!skip) {
+            if (op == TK_AND_AND) {
+                shortCircuit = !lhs->var->getBool();
+                getBool = true;
+            } else if (op == TK_OR_OR) {
+                shortCircuit = lhs->var->getBool();
+                getBool = true;
+            }
+        }
+
+        auto rhs = compare(skip || shortCircuit);
+        if (failed) {
+            return nullptr;
+        }
+        if (!skip && !shortCircuit) {
+            if (getBool) {
+                lhs = make_shared<VarLink>(new Var(lhs->var->getBool()));
+                rhs = make_shared<VarLink>(new Var(rhs->var->getBool()));
+            }
+            lhs = apply(lhs, rhs->var, op);
+        }
+    }
+    return failed ? nullptr : lhs;
+}
+
+shared_ptr<VarLink> Optimizer::compare(bool skip) {
+    auto lhs = shift(skip);
+    while (!failed && (peek() == TK_EQUAL || peek() == TK_N_EQUAL || peek() == TK_TYPEEQUAL ||
+                       peek() == TK_N_TYPEEQUAL || peek() == TK_LESS || peek() == TK_L_EQUAL ||
+                       peek() == TK_GREATER || peek() == TK_G_EQUAL)) {
+        auto op = peek();
+        next();
+        nodes++;
+        auto rhs = shift(skip);
+        if (failed) {
+            return nullptr;
+        }
+        if (!skip) {
+            lhs = apply(lhs, rhs->var, op);
+        }
+    }
+    return failed ? nullptr : lhs;
+}
+
+shared_ptr<VarLink> Optimizer::shift(bool skip) {
+    auto ret = expression(skip);
+    if (!failed && (peek() == TK_L_SHIFT || peek() == TK_R_SHIFT)) {
+        auto op = peek();
+        next();
+        nodes++;
+        auto opNum = expression(skip);
+        if (failed) {
+            return nullptr;
+        }
+        if (!skip) {
+            int a = ret->var->getInt(), b = opNum->var->getInt();
+            if (b < 0 || b >= 32) {
+                return fail();
+            }
+            ret = make_shared<VarLink>(new Var(op == TK_L_SHIFT ? a << b : a >> b));
+        }
+    }
+    return failed ? nullptr : ret;
+}
+
+shared_ptr<VarLink> Optimizer::expression(bool skip) {
+    bool negative = false;
+    if (peek() == TK_MINUS) {
+        next();
+        negative = true;
+    }
+    auto lhs = term(skip);
+    if (failed) {
+        return nullptr;
+    }
+    if (!skip && negative) {
+        Var zero(0);
+        if (!safe(&zero, lhs->var, TK_MINUS)) {
+            return fail();
+        }
+        nodes++;
+        lhs = make_shared<VarLink>(zero.mathOp(lhs->var, TK_MINUS));
+    }
+    while (!failed && (peek() == TK_PLUS || peek() == TK_MINUS)) {
+        auto op = peek();
+        next();
+        nodes++;
+        auto rhs = term(skip);
+        if (failed) {
+            return nullptr;
+        }
+        if (!skip) {
+            lhs = apply(lhs, rhs->var, op);
+        }
+    }
+    return failed ? nullptr : lhs;
+}
+
+shared_ptr<VarLink> Optimizer::term(bool skip) {
+    auto lhs = unary(skip);
+    while (!failed && (peek() == TK_MULTIPLY || peek() == TK_DIVIDE || peek() == TK_MOD)) {
+        auto op = peek();
+        next();
+        nodes++;
+        auto rhs = unary(skip);
+        if (failed) {
+            return nullptr;
+        }
+        if (!skip) {
+            lhs = apply(lhs, rhs->var, op);
+        }
+    }
+    return failed ? nullptr : lhs;
+}
+
+shared_ptr<VarLink> Optimizer::unary(bool skip) {
+    if (peek() == TK_NOT || peek() == TK_BITWISE_NOT) {
+        bool logicalNot = peek() == TK_NOT;
+        next();
+        nodes++;
+        auto ret = factor(skip);
+        if (failed || skip) {
+            return ret;
+        }
+        if (logicalNot) {
+            return make_shared<VarLink>(new Var(!ret->var->getBool()));
+        }
+        return make_shared<VarLink>(new Var(~ret->var->getInt()));
+    }
+    return factor(skip);
+}
+
+shared_ptr<VarLink> Optimizer::factor(bool skip) {
+    if (failed || pos >= end) {
+        return fail();
+    }
+    const Token &tk = (*in)[pos];
+    shared_ptr<VarLink> ret;
+    switch (tk.type) {
+        case TK_L_BRACKET:
+            next();
+            ret = eval(skip);
+            if (failed || peek() != TK_R_BRACKET) {
+                return fail();
+            }
+            next();
+            return ret;
+        case TK_DEC_INT:
+        case TK_HEX_INT:
+        case TK_OCTAL_INT:
+            if (!intLiteral(tk)) {
+                return fail();
+            }
+            ret = make_shared<VarLink>(new Var(tk.getIntData()));
+            break;
+        case TK_FLOAT:
+            ret = make_shared<VarLink>(new Var(tk.getFloatData()));
+            break;
+        case TK_STRING:
+            ret = make_shared<VarLink>(new Var(tk.value.substr(1, tk.value.length() - 2)));
+            break;
+        case TK_TRUE:
+            ret = make_shared<VarLink>(new Var(true));
+            break;
+        case TK_FALSE:
+            ret = make_shared<VarLink>(new Var(false));
+            break;
+        default:
+            return fail();
+    }
+    next();
+    nodes++;
+    return ret;
+}
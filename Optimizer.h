@@ -0,0 +1,69 @@
+//
+// Parse time optimizations over the token stream: constant folding and dead-branch elimination.
+//
+
+#ifndef TINYJS_OPTIMIZER_H
+#define TINYJS_OPTIMIZER_H
+
+#include "Lex.h"
+#include "Var.h"
+#include <vector>
+
+using namespace std;
+
+struct OptimizerStats {
+    int foldedExpressions = 0;
+    int foldedNodes = 0; //literals and operators replaced by folded literals
+    int deadBranches = 0;
+};
+
+class Optimizer {
+public:
+    OptimizerStats stats;
+
+    // rewrite the token stream of lex, it has to be run before the interpreter walks it
+    void run(Lex &lex);
+
+private:
+    //the constant expression being folded, parsed with the interpreter's grammar
+    const vector<Token> *in = nullptr;
+    size_t pos = 0, end = 0;
+    bool failed = false;
+    int nodes = 0;
+
+    void fold(vector<Token> &tokens);
+
+    bool foldRange(const vector<Token> &tokens, size_t begin, size_t finish, Token &folded);
+
+    bool literalBool(const vector<Token> &tokens, size_t at);
+
+    void eliminate(const vector<Token> &tokens, size_t begin, size_t finish, vector<Token> &out);
+
+    TOKEN_TYPES peek();
+
+    void next();
+
+    shared_ptr<VarLink> fail();
+
+    shared_ptr<VarLink> apply(shared_ptr<VarLink> lhs, Var *rhs, TOKEN_TYPES op);
+
+    shared_ptr<VarLink> eval(bool skip);
+
+    shared_ptr<VarLink> ternary(bool skip);
+
+    shared_ptr<VarLink> logic(bool skip);
+
+    shared_ptr<VarLink> compare(bool skip);
+
+    shared_ptr<VarLink> shift(bool skip);
+
+    shared_ptr<VarLink> expression(bool skip);
+
+    shared_ptr<VarLink> term(bool skip);
+
+    shared_ptr<VarLink> unary(bool skip);
+
+    shared_ptr<VarLink> factor(bool skip);
+};
+
+#endif //TINYJS_OPTIMIZER_H
@@ -0,0 +1,123 @@
+//
+// One script compiled once and run over many inputs, with the inputs set as values instead of source text.
+//
+
+#include "Program.h"
+
+Program::Program(const string &file) : interpreter(new Interpreter(file)) {
+    interpreter->compile();
+}
+
+Program::Program(const shared_ptr<const Source> &script) : interpreter(new Interpreter(script)) {
+    interpreter->compile();
+}
+
+Program *Program::fromText(const string &text) {
+    return new Program(make_shared<const Source>(text));
+}
+
+Program::~Program() {
+    //the links go before the heap they point into
+    inputs.clear();
+    functions.clear();
+    outputLink = nullptr;
+    returned = nullptr;
+    delete interpreter;
+}
+
+int Program::bind(const string &name) {
+    inputs.push_back(interpreter->root->findChildOrCreate(name));
+    return (int) inputs.size() - 1;
+}
+
+int Program::parameter() {
+    inputs.push_back(make_shared<VarLink>(new Var()));
+    parameters.push_back((int) inputs.size() - 1);
+    return (int) inputs.size() - 1;
+}
+
+Var *Program::writable(int input) {
+    if (input < 0 || input >= (int) inputs.size()) {
+        cout << "error: there is no input " << input << endl;
+        return nullptr;
+    }
+    Var *var = inputs[input]->var;
+    //the script may have kept the value somewhere, or made it an object
+    if (var->getRefNum() != 1 || var->frozen || !var->isBasic() || var->isFunction()) {
+        var = new Var();
+        inputs[input]->replaceWith(var);
+    }
+    return var;
+}
+
+void Program::set(int input, int value) {
+    Var *var = writable(input);
+    if (var) {
+        var->setInt(value);
+    }
+}
+
+void Program::set(int input, double value) {
+    Var *var = writable(input);
+    if (var) {
+        var->setDouble(value);
+    }
+}
+
+void Program::set(int input, bool value) {
+    Var *var = writable(input);
+    if (var) {
+        var->setBool(value);
+    }
+}
+
+void Program::set(int input, const string &value) {
+    Var *var = writable(input);
+    if (var) {
+        var->setString(value);
+    }
+}
+
+void Program::set(int input, Var *value) {
+    if (input < 0 || input >= (int) inputs.size()) {
+        cout << "error: there is no input " << input << endl;
+        return;
+    }
+    inputs[input]->replaceWith(value);
+}
+
+Var *Program::run() {
+    interpreter->execute();
+    runs++;
+    if (!outputLink || outputName != output) {
+        //a global keeps its link once made, the script assigns through it
+        outputLink = interpreter->root->findChild(output);
+        outputName = output;
+    }
+    return outputLink ? outputLink->var : nullptr;
+}
+
+int Program::function(const string &name) {
+    auto link = interpreter->root->findChild(name);
+    if (!link) {
+        cout << "error: there is no global function " << name << endl;
+        return -1;
+    }
+    functions.push_back(link);
+    return (int) functions.size() - 1;
+}
+
+Var *Program::call(int function) {
+    if (function < 0 || function >= (int) functions.size()) {
+        cout << "error: there is no function " << function << endl;
+        return nullptr;
+    }
+    vector<Var *> args;
+    args.reserve(parameters.size());
+    for (int input: parameters) {
+        args.push_back(inputs[input]->var);
+    }
+    returned = interpreter->execute(functions[function]->var, args);
+    runs++;
+    return returned->var;
+}
@@ -0,0 +1,81 @@
+//
+// One script compiled once and run over many inputs, with the inputs set as values instead of source text.
+//
+
+#ifndef TINYJS_PROGRAM_H
+#define TINYJS_PROGRAM_H
+
+#include "Interpreter.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+// the script is lexed and optimized when the program is made, and every run after that reuses its tokens,
+// functions, loops and machine code (see Interpreter::execute(file)). an input is a global or an argument
+// whose value the host sets before each run: a number, boolean or string overwrites the value in place when
+// nothing but the input holds it, so a run allocates nothing for its inputs. globals the script sets are kept
+// from one run to the next, as with execute(file)
+class Program {
+public:
+    //the script in file, mapped
+    explicit Program(const string &file);
+
+    //the script in text
+    static Program *fromText(const string &text);
+
+    ~Program();
+
+    //the global name as an input, made undefined if the script does not declare it. the index for set()
+    int bind(const string &name);
+
+    //an argument for call(), in the order they are made. the index for set()
+    int parameter();
+
+    void set(int input, int value);
+
+    void set(int input, double value);
+
+    void set(int input, bool value);
+
+    void set(int input, const string &value);
+
+    //any var, held by the input from now on
+    void set(int input, Var *value);
+
+    //run the script, then return the global output: held by the global, so valid until the next run.
+    //nullptr when the script set no such global
+    Var *run();
+
+    //the global function name, looked up once: so after the run() that declared it. the index for call()
+    int function(const string &name);
+
+    //call function with the parameters as its arguments, as a run of its own (budgets, timing). what it
+    //returned is held by the program until the next call
+    Var *call(int function);
+
+    //the global run() returns
+    string output = "result";
+
+    Interpreter *interpreter;
+
+    //runs and calls made
+    long long runs = 0;
+
+private:
+    explicit Program(const shared_ptr<const Source> &script);
+
+    vector<shared_ptr<VarLink>> inputs;
+    vector<int> parameters; //the input of each argument, in order
+    vector<shared_ptr<VarLink>> functions;
+
+    shared_ptr<VarLink> outputLink;
+    string outputName;
+    shared_ptr<VarLink> returned;
+
+    //a var set() can overwrite in place
+    Var *writable(int input);
+};
+
+#endif //TINYJS_PROGRAM_H
@@ -0,0 +1,280 @@
+//
+// Saving the heap reachable from root into a snapshot file and starting an interpreter from one.
+//
+
+#include "Interpreter.h"
+#include "Snapshot.h"
+#include <string.h>
+
+// appends the records and the string blob of a snapshot while the heap is walked
+class SnapshotWriter {
+public:
+    vector<SnapshotVar> vars;
+    vector<SnapshotLink> links;
+    vector<SnapshotFunction> functions;
+    vector<SnapshotString> params;
+    string strings;
+
+    SnapshotString addString(const char *text, size_t length) {
+        SnapshotString s{(uint32_t) strings.size(), (uint32_t) length};
+        strings.append(text, length);
+        return s;
+    }
+
+    //names and values repeat a lot (every closure has its __builtin__scope, arrays their 0, 1, ...),
+    //each is stored once
+    SnapshotString intern(const string &text) {
+        auto found = interned.find(text);
+        if (found == interned.end()) {
+            found = interned.insert(make_pair(text, addString(text.data(), text.size()))).first;
+        }
+        return found->second;
+    }
+
+private:
+    unordered_map<string, SnapshotString> interned;
+};
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+// the { ... } of a function in the source it was lexed from
+static void bodyText(FunctionInfo *info, const char *&text, int &length) {
+    if (!info->body) {
+        text = info->source->data() + info->sourceBegin;
+        length = info->sourceEnd - info->sourceBegin;
+        return;
+    }
+    const vector<Token> &tokens = *info->body->tokens;
+    const Token &open = tokens[info->body->tokenBegin], &close = tokens[info->body->tokenEnd - 1];
+    text = info->body->source->data() + open.pos;
+    length = close.pos + 1 - open.pos;
+}
+
+bool Interpreter::saveSnapshot(const string &file) {
+    SnapshotWriter writer;
+
+    //number every reachable var breadth first, shared vars and cycles (a closure's scope holding the
+    //closure) get one record
+    unordered_map<Var *, uint32_t> ids;
+    vector<Var *> order;
+    ids[root] = 0;
+    order.push_back(root);
+    for (size_t i = 0; i < order.size(); i++) {
+        for (auto link = order[i]->firstChild; link; link = link->nextSibling) {
+            if (ids.insert(make_pair(link->var, (uint32_t) order.size())).second) {
+                order.push_back(link->var);
+            }
+        }
+    }
+
+    map<int, int> functionIds; //index in functions -> index in the snapshot
+    for (Var *var: order) {
+        SnapshotVar record{};
+        record.type = var->type;
+        record.function = -1;
+        if (var->isString()) {
+            record.stringData = writer.intern(var->getString());
+        } else if (var->isInt() || var->isBoolean()) {
+            record.intData = var->getInt();
+        } else if (var->isDouble()) {
+            record.doubleData = var->getDouble();
+        } else if (var->isFunction() && var->findChild(JS_FUNCINFO_VAR)) {
+            int id = var->findChild(JS_FUNCINFO_VAR)->var->getInt();
+            auto found = functionIds.find(id);
+            if (found == functionIds.end()) {
+                FunctionInfo *info = functionInfo(id);
+                SnapshotFunction function{};
+                function.name = writer.intern(info->name);
+                function.firstParam = (uint32_t) writer.params.size();
+                function.params = (uint32_t) info->params.size();
+                for (auto &param: info->params) {
+                    writer.params.push_back(writer.intern(param));
+                }
+                const char *text;
+                int length;
+                bodyText(info, text, length);
+                function.body = writer.addString(text, (size_t) length);
+                found = functionIds.insert(make_pair(id, (int) writer.functions.size())).first;
+                writer.functions.push_back(function);
+            }
+            record.function = found->second;
+        }
+        record.firstLink = (uint32_t) writer.links.size();
+        for (auto link = var->firstChild; link; link = link->nextSibling) {
+            writer.links.push_back(SnapshotLink{writer.intern(link->name), ids[link->var]});
+            record.links++;
+        }
+        writer.vars.push_back(record);
+    }
+    //the info of a function holds its index in the snapshot, loading adds where the functions start
+    for (size_t i = 0; i < order.size(); i++) {
+        if (writer.vars[i].function >= 0) {
+            writer.vars[ids[order[i]->findChild(JS_FUNCINFO_VAR)->var]].intData = writer.vars[i].function;
+        }
+    }
+
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.root = 0;
+    header.vars = (uint32_t) writer.vars.size();
+    header.links = (uint32_t) writer.links.size();
+    header.functions = (uint32_t) writer.functions.size();
+    header.params = (uint32_t) writer.params.size();
+    header.varsOffset = align8(sizeof(header));
+    header.linksOffset = align8(header.varsOffset + writer.vars.size() * sizeof(SnapshotVar));
+    header.functionsOffset = align8(header.linksOffset + writer.links.size() * sizeof(SnapshotLink));
+    header.paramsOffset = align8(header.functionsOffset + writer.functions.size() * sizeof(SnapshotFunction));
+    header.stringsOffset = align8(header.paramsOffset + writer.params.size() * sizeof(SnapshotString));
+    header.stringsLength = writer.strings.size();
+
+    string image(header.stringsOffset + header.stringsLength, '\0');
+    memcpy(&image[0], &header, sizeof(header));
+    memcpy(&image[header.varsOffset], writer.vars.data(), writer.vars.size() * sizeof(SnapshotVar));
+    memcpy(&image[header.linksOffset], writer.links.data(), writer.links.size() * sizeof(SnapshotLink));
+    memcpy(&image[header.functionsOffset], writer.functions.data(),
+           writer.functions.size() * sizeof(SnapshotFunction));
+    memcpy(&image[header.paramsOffset], writer.params.data(), writer.params.size() * sizeof(SnapshotString));
+    memcpy(&image[header.stringsOffset], writer.strings.data(), writer.strings.size());
+
+    FILE *out = fopen(file.c_str(), "wb");
+    if (!out) {
+        cout << "error: cannot write snapshot " << file << endl;
+        return false;
+    }
+    bool written = fwrite(image.data(), 1, image.size(), out) == image.size();
+    written = fclose(out) == 0 && written;
+    if (!written) {
+        cout << "error: cannot write snapshot " << file << endl;
+    }
+    return written;
+}
+
+// [offset, offset + count * size) lies in a file of length bytes
+static bool inFile(uint64_t offset, uint64_t count, uint64_t size, uint64_t length) {
+    return offset <= length && count <= (length - offset) / size;
+}
+
+static bool inStrings(const SnapshotString &s, uint64_t length) {
+    return (uint64_t) s.offset + s.length <= length;
+}
+
+bool Interpreter::loadSnapshot(const string &file) {
+    auto image = Source::map(file);
+    uint64_t length = (uint64_t) image->length();
+    const SnapshotHeader *header = (const SnapshotHeader *) image->data();
+    if (length < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        cout << "error: " << file << " is not a snapshot" << endl;
+        return false;
+    }
+    if (header->version != SNAPSHOT_VERSION) {
+        cout << "error: snapshot " << file << " is version " << header->version << ", expected "
+        << SNAPSHOT_VERSION << endl;
+        return false;
+    }
+    if (!inFile(header->varsOffset, header->vars, sizeof(SnapshotVar), length) ||
+        !inFile(header->linksOffset, header->links, sizeof(SnapshotLink), length) ||
+        !inFile(header->functionsOffset, header->functions, sizeof(SnapshotFunction), length) ||
+        !inFile(header->paramsOffset, header->params, sizeof(SnapshotString), length) ||
+        !inFile(header->stringsOffset, header->stringsLength, 1, length) || header->root >= header->vars) {
+        cout << "error: snapshot " << file << " is truncated" << endl;
+        return false;
+    }
+
+    //the records are read in place from the mapping
+    const SnapshotVar *varRecords = (const SnapshotVar *) (image->data() + header->varsOffset);
+    const SnapshotLink *linkRecords = (const SnapshotLink *) (image->data() + header->linksOffset);
+    const SnapshotFunction *functionRecords = (const SnapshotFunction *) (image->data() + header->functionsOffset);
+    const SnapshotString *paramRecords = (const SnapshotString *) (image->data() + header->paramsOffset);
+    const char *strings = image->data() + header->stringsOffset;
+    uint64_t stringsLength = header->stringsLength;
+
+    for (uint32_t i = 0; i < header->vars; i++) {
+        const SnapshotVar &v = varRecords[i];
+        if (!inStrings(v.stringData, stringsLength) || (uint64_t) v.firstLink + v.links > header->links ||
+            v.function >= (int32_t) header->functions || v.type < VAR_UNDEFINED || v.type > VAR_ARRAY) {
+            cout << "error: snapshot " << file << " is corrupt" << endl;
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->links; i++) {
+        if (!inStrings(linkRecords[i].name, stringsLength) || linkRecords[i].var >= header->vars) {
+            cout << "error: snapshot " << file << " is corrupt" << endl;
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->functions; i++) {
+        const SnapshotFunction &f = functionRecords[i];
+        if (!inStrings(f.name, stringsLength) || !inStrings(f.body, stringsLength) ||
+            (uint64_t) f.firstParam + f.params > header->params) {
+            cout << "error: snapshot " << file << " is corrupt" << endl;
+            return false;
+        }
+        for (uint32_t p = f.firstParam; p < f.firstParam + f.params; p++) {
+            if (!inStrings(paramRecords[p], stringsLength)) {
+                cout << "error: snapshot " << file << " is corrupt" << endl;
+                return false;
+            }
+        }
+    }
+
+    //function bodies stay in the mapped file, each is lexed from there on its first call
+    int base = (int) functions.size();
+    for (uint32_t i = 0; i < header->functions; i++) {
+        const SnapshotFunction &f = functionRecords[i];
+        auto info = new FunctionInfo();
+        info->name.assign(strings + f.name.offset, f.name.length);
+        for (uint32_t p = f.firstParam; p < f.firstParam + f.params; p++) {
+            info->params.push_back(string(strings + paramRecords[p].offset, paramRecords[p].length));
+        }
+        info->source = image;
+        info->sourceBegin = (int) (header->stringsOffset + f.body.offset);
+        info->sourceEnd = info->sourceBegin + (int) f.body.length;
+        functions.push_back(info);
+    }
+
+    vector<Var *> vars(header->vars);
+    for (uint32_t i = 0; i < header->vars; i++) {
+        const SnapshotVar &v = varRecords[i];
+        switch (v.type) {
+            case VAR_STRING:
+                vars[i] = new Var(string(strings + v.stringData.offset, v.stringData.length));
+                break;
+            case VAR_INTEGER:
+                vars[i] = new Var((int) v.intData);
+                break;
+            case VAR_BOOLEAN:
+                vars[i] = new Var(v.intData != 0);
+                break;
+            case VAR_DOUBLE:
+                vars[i] = new Var(v.doubleData);
+                break;
+            default:
+                vars[i] = new Var();
+                break;
+        }
+    }
+
+    //the fix-ups: indexes become links between the new vars
+    for (uint32_t i = 0; i < header->vars; i++) {
+        const SnapshotVar &v = varRecords[i];
+        for (uint32_t l = v.firstLink; l < v.firstLink + v.links; l++) {
+            const SnapshotLink &link = linkRecords[l];
+            vars[i]->addChild(string(strings + link.name.offset, link.name.length), vars[link.var]);
+        }
+        vars[i]->type = v.type;
+        if (v.function >= 0) {
+            auto id = vars[i]->findChild(JS_FUNCINFO_VAR);
+            if (id) {
+                id->var->setInt(base + v.function);
+            }
+        }
+    }
+
+    Var *old = root;
+    root = vars[header->root]->ref();
+    old->unref();
+    return true;
+}
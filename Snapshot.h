@@ -0,0 +1,65 @@
+//
+// Binary snapshot of the heap reachable from Interpreter::root, see Interpreter::saveSnapshot.
+//
+
+#ifndef TINYJS_SNAPSHOT_H
+#define TINYJS_SNAPSHOT_H
+
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC   "TJSSNAP"
+#define SNAPSHOT_VERSION 1
+
+// the file is the header, then the four record arrays, then one blob holding every string and function
+// body. records refer to each other by index and to strings by offset into the blob, nothing in the file
+// is a pointer: loading maps it and turns indexes into pointers
+
+struct SnapshotString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t root; //index of the var that becomes root
+
+    uint32_t vars;
+    uint32_t links;
+    uint32_t functions;
+    uint32_t params;
+
+    uint64_t varsOffset;
+    uint64_t linksOffset;
+    uint64_t functionsOffset;
+    uint64_t paramsOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsLength;
+};
+
+// the children of a var are links [firstLink, firstLink + links)
+struct SnapshotVar {
+    int32_t type;
+    int32_t intData;
+    double doubleData;
+    SnapshotString stringData;
+    uint32_t firstLink;
+    uint32_t links;
+    int32_t function; //for a function, the index of its SnapshotFunction, else -1
+    int32_t unused;
+};
+
+struct SnapshotLink {
+    SnapshotString name;
+    uint32_t var;
+};
+
+// a FunctionInfo, the body is the source text of its { ... } and is tokenized on the first call
+struct SnapshotFunction {
+    SnapshotString name;
+    uint32_t firstParam;
+    uint32_t params;
+    SnapshotString body;
+};
+
+#endif //TINYJS_SNAPSHOT_H
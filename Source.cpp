@@ -0,0 +1,86 @@
+//
+// The text of a script: a file mapped into memory, or a string of its own. Immutable once made.
+//
+
+#include "Source.h"
+#include "Lex.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TINYJS_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+Source::~Source() {
+#if TINYJS_MMAP
+    if (mapping) {
+        munmap(mapping, mappedSize);
+    }
+#endif
+}
+
+shared_ptr<const Source> Source::map(const string &file) {
+    auto source = make_shared<Source>();
+#if TINYJS_MMAP
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return source;
+    }
+    struct stat st;
+    off_t size = fstat(fd, &st) == 0 ? st.st_size : -1;
+    if (size > 0) {
+        void *p = mmap(nullptr, (size_t) size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            //read front to back once by the lexer
+            madvise(p, (size_t) size, MADV_SEQUENTIAL);
+            source->mapping = p;
+            source->mappedSize = (size_t) size;
+            source->ptr = (const char *) p;
+            source->len = (size_t) size;
+        }
+    }
+    close(fd);
+    if (source->mapping || (size == 0 && S_ISREG(st.st_mode))) {
+        return source;
+    }
+#endif
+    //no mmap here, or a file that cannot be mapped (a pipe): read it whole
+    FILE *fin = fopen(file.c_str(), "rb");
+    if (fin) {
+        char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), fin)) > 0) {
+            source->text.append(buffer, n);
+        }
+        fclose(fin);
+    }
+    source->ptr = source->text.data();
+    source->len = source->text.size();
+    return source;
+}
+
+shared_ptr<const Source> Source::readStatements(FILE *in, StatementStream &stream) {
+    string &pending = stream.pending;
+    char line[65536];
+    while (true) {
+        //what was read already may hold the token that confirms the last cut
+        int end = Lex::statementsEnd(stream);
+        if (end > 0) {
+            auto source = make_shared<Source>(pending.substr(0, (size_t) end));
+            pending.erase(0, (size_t) end);
+            return source;
+        }
+        if (!fgets(line, sizeof(line), in)) {
+            break;
+        }
+        pending += line;
+    }
+    if (pending.empty()) {
+        return nullptr;
+    }
+    auto source = make_shared<Source>(pending);
+    stream = StatementStream();
+    return source;
+}
@@ -0,0 +1,74 @@
+//
+// The text of a script: a file mapped into memory, or a string of its own. Immutable once made.
+//
+
+#ifndef TINYJS_SOURCE_H
+#define TINYJS_SOURCE_H
+
+#include <string>
+#include <memory>
+#include <stdio.h>
+
+using namespace std;
+
+//what Source::readStatements carries from one call to the next
+struct StatementStream {
+    string pending; //read past the statements returned so far
+
+    //the scan of pending resumes at scanned, in this state
+    int scanned = 0;
+    int depth = 0;
+    char last = 0; //last character outside of comments and whitespace
+    int cut = 0; //end of a statement, taken once the next token is known not to be else
+    bool stopped = false; //something malformed, the rest is run as one piece
+};
+
+class Source {
+public:
+    Source() { };
+
+    explicit Source(const string &text) : text(text), ptr(this->text.data()), len(this->text.size()) { };
+
+    Source(const Source &) = delete;
+
+    Source &operator=(const Source &) = delete;
+
+    ~Source();
+
+    //the file's pages mapped read-only, nothing is copied; empty when it cannot be read
+    static shared_ptr<const Source> map(const string &file);
+
+    //the next run of complete top-level statements read from in, nullptr once in is at its end.
+    //stream carries what was read past the statements into the next call
+    static shared_ptr<const Source> readStatements(FILE *in, StatementStream &stream);
+
+    const char *data() const {
+        return ptr;
+    }
+
+    int length() const {
+        return (int) len;
+    }
+
+    const char *begin() const {
+        return ptr;
+    }
+
+    const char *end() const {
+        return ptr + len;
+    }
+
+    bool mapped() const {
+        return mapping != nullptr;
+    }
+
+private:
+    string text;
+    const char *ptr = "";
+    size_t len = 0;
+
+    void *mapping = nullptr;
+    size_t mappedSize = 0;
+};
+
+#endif //TINYJS_SOURCE_H
@@ -0,0 +1,12 @@
+var sum = 0;
+var odd = 0;
+var i = 0;
+while (i < 300000) {
+    if (i % 2 == 1) {
+        odd++;
+    }
+    sum = sum + 3;
+    sum -= 1;
+    i++;
+}
+var result = "" + sum + "," + odd;
@@ -0,0 +1,11 @@
+var a = [10, 20, 30, 40, 50, 60, 70, 80];
+var s = 0;
+var t = 0;
+for (var i = 0; i < a.length; i++) {
+    s = s + a[i];
+    if (i == 3) {
+        a = [1];
+    }
+    t = a[i];
+}
+var result = "" + s + "," + t;
@@ -0,0 +1,42 @@
+var data = [];
+for (var i = 0; i < 3000; i++) {
+    data[i] = i % 7;
+}
+var cfg = {scale: 3, offset: 7};
+var base = 4;
+var step = 2;
+var total = 0;
+for (var r = 0; r < 10; r++) {
+    var k = 0;
+    while (k < data.length) {
+        total = total + data[k] * cfg.scale + cfg.offset + (base * step + 1);
+        k++;
+    }
+}
+var grow = [1, 2, 3];
+var g = 0;
+var seen = 0;
+while (g < grow.length && g < 10) {
+    if (g == 1) { grow[3] = 4; }
+    seen = seen + grow.length;
+    g++;
+}
+var o = {n: 1};
+var s = 0;
+for (var m = 0; m < 4; m++) {
+    s = s + o.n;
+    o = {n: 10};
+}
+var x = 1;
+var t = 0;
+for (var q = 0; q < 3; q++) {
+    t = t + (x * 2);
+    x = x + 1;
+}
+var p = {v: 1};
+var u = 0;
+for (var z = 0; z < 3; z++) {
+    u = u + p.v;
+    p.v = p.v + 1;
+}
+var result = total + "," + seen + "," + s + "," + t + "," + u;
@@ -0,0 +1,19 @@
+var result = 0;
+if (1 == 2) {
+    result = 1;
+}
+else {
+    result = 2;
+}
+var x;
+if (result == 1)
+    x = 1;
+else
+    x = 2;
+/* a comment between } and else */
+if (x == 1) {
+    result = 5;
+}
+// and a line comment
+else
+    result = result + x;
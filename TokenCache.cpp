@@ -0,0 +1,211 @@
+//
+// Token streams of scripts kept on disk between runs, keyed by a hash of the source.
+//
+
+#include "TokenCache.h"
+#include <string.h>
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TINYJS_POSIX 1
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TOKEN_CACHE_MAGIC "TJSTOKS"
+
+// a cache file is the header, a record per token, then the text of the values that are not in the source
+// (folded literals). the header names the source by hash and length, and the checksum covers the rest
+struct TokenCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t optimized;
+    uint64_t sourceHash;
+    uint32_t sourceLength;
+    uint32_t tokens;
+    int32_t foldedExpressions;
+    int32_t foldedNodes;
+    int32_t deadBranches;
+    uint32_t textLength;
+    uint64_t checksum;
+};
+
+struct CachedToken {
+    int32_t type;
+    int32_t pos;
+    int32_t match;
+    int32_t end;
+    uint32_t valueOffset; //into the source, or into the text after the records
+    uint32_t valueLength;
+    uint8_t fused;
+    uint8_t inSource;
+    uint8_t unused[2];
+};
+
+// 8 bytes per step, a multiply and a fold each
+uint64_t hashSource(const char *data, int length) {
+    const uint64_t m = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = (uint64_t) length * m;
+    int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * m;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, (size_t) (length - i));
+    h = (h ^ tail) * m;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+static string cachePath(const string &dir, uint64_t hash, bool optimized) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long) hash);
+    return dir + "/" + name + (optimized ? ".opt" : "") + ".tokens";
+}
+
+// the records and text of a cache file are sane for a source of length bytes: every offset stays in the
+// source or in the text, every bracket pairs with a token of the stream
+static bool validTokens(const CachedToken *records, uint32_t count, uint32_t textLength, uint32_t length) {
+    for (uint32_t i = 0; i < count; i++) {
+        const CachedToken &r = records[i];
+        uint64_t valueEnd = (uint64_t) r.valueOffset + r.valueLength;
+        if (r.type <= TK_NOT_VALID || r.type >= TK_EOF || r.pos < 0 || (uint32_t) r.pos > length ||
+            r.match < -1 || r.match >= (int32_t) count || r.end < 0 || (uint32_t) r.end > length ||
+            valueEnd > (r.inSource ? length : textLength)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Lex *loadCachedTokens(const string &dir, const shared_ptr<const Source> &source, bool optimized,
+                      TokenCacheStats &stats, OptimizerStats &optimizerStats) {
+    uint64_t hash = hashSource(source->data(), source->length());
+    auto image = Source::map(cachePath(dir, hash, optimized));
+    if (image->length() == 0) {
+        stats.misses++;
+        return nullptr;
+    }
+
+    const TokenCacheHeader *header = (const TokenCacheHeader *) image->data();
+    size_t length = (size_t) image->length();
+    if (length < sizeof(TokenCacheHeader) || memcmp(header->magic, TOKEN_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != TOKEN_CACHE_VERSION || header->optimized != (uint32_t) optimized ||
+        header->sourceHash != hash || header->sourceLength != (uint32_t) source->length() ||
+        (length - sizeof(TokenCacheHeader)) != (uint64_t) header->tokens * sizeof(CachedToken) + header->textLength ||
+        hashSource(image->data() + sizeof(TokenCacheHeader), (int) (length - sizeof(TokenCacheHeader))) !=
+        header->checksum) {
+        stats.rejected++;
+        return nullptr;
+    }
+    const CachedToken *records = (const CachedToken *) (image->data() + sizeof(TokenCacheHeader));
+    const char *text = (const char *) (records + header->tokens);
+    if (!validTokens(records, header->tokens, header->textLength, header->sourceLength)) {
+        stats.rejected++;
+        return nullptr;
+    }
+
+    auto lex = new Lex();
+    lex->source = source;
+    lex->tokens->reserve(header->tokens);
+    const char *data = source->data();
+    for (uint32_t i = 0; i < header->tokens; i++) {
+        const CachedToken &r = records[i];
+        Token tk;
+        tk.type = (TOKEN_TYPES) r.type;
+        if (r.inSource) {
+            tk.value = TokenText(data + r.valueOffset, (int) r.valueLength);
+        } else if (r.valueLength) {
+            tk.value = TokenText(string(text + r.valueOffset, r.valueLength));
+        }
+        tk.pos = r.pos;
+        tk.match = r.match;
+        tk.end = r.end;
+        tk.fused = r.fused;
+        lex->tokens->push_back(tk);
+    }
+    lex->tokenBegin = 0;
+    lex->tokenEnd = (int) lex->tokens->size();
+    lex->reset();
+
+    optimizerStats.foldedExpressions += header->foldedExpressions;
+    optimizerStats.foldedNodes += header->foldedNodes;
+    optimizerStats.deadBranches += header->deadBranches;
+    stats.hits++;
+    return lex;
+}
+
+void storeCachedTokens(const string &dir, const Lex &lex, bool optimized, TokenCacheStats &stats,
+                       const OptimizerStats &optimizerStats) {
+    //tokens cut short by an error are not cached, the next run reports it again
+    if (!lex.complete) {
+        return;
+    }
+    const char *data = lex.source->data();
+    int length = lex.source->length();
+
+    vector<CachedToken> records;
+    records.reserve(lex.tokens->size());
+    string text;
+    for (auto &tk: *lex.tokens) {
+        CachedToken r{};
+        r.type = tk.type;
+        r.pos = tk.pos;
+        r.match = tk.match;
+        r.end = tk.end;
+        r.fused = tk.fused;
+        r.valueLength = (uint32_t) tk.value.length();
+        const char *value = tk.value.data();
+        if (value >= data && value + tk.value.length() <= data + length) {
+            r.inSource = 1;
+            r.valueOffset = (uint32_t) (value - data);
+        } else {
+            r.valueOffset = (uint32_t) text.size();
+            text.append(value, (size_t) tk.value.length());
+        }
+        records.push_back(r);
+    }
+
+    string body((const char *) records.data(), records.size() * sizeof(CachedToken));
+    body += text;
+
+    TokenCacheHeader header{};
+    memcpy(header.magic, TOKEN_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TOKEN_CACHE_VERSION;
+    header.optimized = optimized;
+    header.sourceHash = hashSource(data, length);
+    header.sourceLength = (uint32_t) length;
+    header.tokens = (uint32_t) records.size();
+    header.foldedExpressions = optimizerStats.foldedExpressions;
+    header.foldedNodes = optimizerStats.foldedNodes;
+    header.deadBranches = optimizerStats.deadBranches;
+    header.textLength = (uint32_t) text.size();
+    header.checksum = hashSource(body.data(), (int) body.size());
+
+#if TINYJS_POSIX
+    mkdir(dir.c_str(), 0755);
+    string file = cachePath(dir, header.sourceHash, optimized);
+    string temp = file + "." + to_string(getpid());
+#else
+    string file = cachePath(dir, header.sourceHash, optimized);
+    string temp = file + ".tmp";
+#endif
+    //written aside and renamed over the old file, a run reading the cache meanwhile sees either one whole
+    FILE *out = fopen(temp.c_str(), "wb");
+    if (!out) {
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                   fwrite(body.data(), 1, body.size(), out) == body.size();
+    written = fclose(out) == 0 && written;
+    if (written && rename(temp.c_str(), file.c_str()) == 0) {
+        stats.stores++;
+    } else {
+        remove(temp.c_str());
+    }
+}
@@ -0,0 +1,36 @@
+//
+// Token streams of scripts kept on disk between runs, keyed by a hash of the source.
+//
+
+#ifndef TINYJS_TOKENCACHE_H
+#define TINYJS_TOKENCACHE_H
+
+#include "Lex.h"
+#include "Optimizer.h"
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+// bumped whenever the lexer or the optimizer changes the tokens they make, older files are then stale
+#define TOKEN_CACHE_VERSION 1
+
+struct TokenCacheStats {
+    int hits = 0;
+    int misses = 0;
+    int rejected = 0; //there was a file for the source, stale or corrupt, and the source was lexed again
+    int stores = 0;
+};
+
+uint64_t hashSource(const char *data, int length);
+
+// the tokens of source, optimized or not, as a previous run left them in dir. nullptr when there are none
+// or they cannot be used. optimizerStats gets what the optimizer did to them back then
+Lex *loadCachedTokens(const string &dir, const shared_ptr<const Source> &source, bool optimized,
+                      TokenCacheStats &stats, OptimizerStats &optimizerStats);
+
+// write the tokens of lex, a whole source just lexed (and optimized), to dir for the next run
+void storeCachedTokens(const string &dir, const Lex &lex, bool optimized, TokenCacheStats &stats,
+                       const OptimizerStats &optimizerStats);
+
+#endif //TINYJS_TOKENCACHE_H
@@ -0,0 +1,132 @@
+//
+// A script on a thread of its own, talking to the script that started it through messages.
+//
+
+#include "Worker.h"
+#include "EventLoop.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TINYJS_POSIX 1
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+Port::Port() {
+#if TINYJS_POSIX
+    if (pipe(ends) == 0) {
+        //a full pipe already wakes the receiver, a sender never waits on it
+        fcntl(ends[0], F_SETFL, fcntl(ends[0], F_GETFL) | O_NONBLOCK);
+        fcntl(ends[1], F_SETFL, fcntl(ends[1], F_GETFL) | O_NONBLOCK);
+    } else {
+        ends[0] = ends[1] = -1;
+    }
+#endif
+}
+
+Port::~Port() {
+    close();
+#if TINYJS_POSIX
+    if (ends[0] >= 0) {
+        ::close(ends[0]);
+    }
+#endif
+}
+
+bool Port::send(unique_ptr<Message> message) {
+    lock_guard<mutex> guard(lock);
+    if (isClosed) {
+        return false;
+    }
+    messages.push_back(move(message));
+    if (!signaled) {
+        signaled = true;
+#if TINYJS_POSIX
+        if (ends[1] >= 0) {
+            (void) ::write(ends[1], "m", 1);
+        }
+#endif
+    }
+    return true;
+}
+
+unique_ptr<Message> Port::take() {
+    lock_guard<mutex> guard(lock);
+    if (messages.empty()) {
+        //the next message has to wake the receiver
+        signaled = false;
+        return nullptr;
+    }
+    auto message = move(messages.front());
+    messages.pop_front();
+    return message;
+}
+
+void Port::close() {
+    lock_guard<mutex> guard(lock);
+    if (isClosed) {
+        return;
+    }
+    isClosed = true;
+#if TINYJS_POSIX
+    //the read end sees the end of the pipe
+    if (ends[1] >= 0) {
+        ::close(ends[1]);
+        ends[1] = -1;
+    }
+#endif
+}
+
+bool Port::closed() {
+    lock_guard<mutex> guard(lock);
+    return isClosed;
+}
+
+void Port::drain() {
+#if TINYJS_POSIX
+    char buffer[64];
+    while (ends[0] >= 0 && ::read(ends[0], buffer, sizeof(buffer)) > 0) {
+    }
+#endif
+}
+
+Worker::Worker(const string &file, const function<void(Interpreter &)> &setup)
+        : inbox(make_shared<Port>()), outbox(make_shared<Port>()) {
+    runner = thread(&Worker::run, this, file, setup);
+}
+
+Worker::~Worker() {
+    inbox->close();
+    if (runner.joinable()) {
+        runner.join();
+    }
+}
+
+void Worker::terminate() {
+    lock_guard<mutex> guard(lock);
+    terminating = true;
+    if (running) {
+        running->terminate();
+    }
+}
+
+void Worker::run(const string &file, const function<void(Interpreter &)> &setup) {
+    {
+        EventLoop loop;
+        Interpreter *interpreter = loop.add(file);
+        if (setup) {
+            setup(*interpreter);
+        }
+        interpreter->root->addChild("parent", new Var(loop.connect(inbox, outbox)));
+        {
+            lock_guard<mutex> guard(lock);
+            running = interpreter;
+            if (terminating) {
+                interpreter->terminate();
+            }
+        }
+        loop.run();
+        lock_guard<mutex> guard(lock);
+        running = nullptr;
+    }
+    outbox->close();
+}
@@ -0,0 +1,77 @@
+//
+// A script on a thread of its own, talking to the script that started it through messages.
+//
+
+#ifndef TINYJS_WORKER_H
+#define TINYJS_WORKER_H
+
+#include "Interpreter.h"
+#include "Message.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <functional>
+
+using namespace std;
+
+// messages one way, from any thread to the one event loop reading them. fd() turns readable once a message
+// may be there or the port is closed, so a loop waits on ports and pipes in the same poll()
+class Port {
+public:
+    Port();
+
+    ~Port();
+
+    //false once the port is closed, the message is dropped
+    bool send(unique_ptr<Message> message);
+
+    //the next message, nullptr when there is none now
+    unique_ptr<Message> take();
+
+    //no more messages: a receiver gets what is queued, then nothing
+    void close();
+
+    bool closed();
+
+    int fd() { return ends[0]; }
+
+    //read away the wakeups, before looking at the port again
+    void drain();
+
+private:
+    mutex lock;
+    deque<unique_ptr<Message>> messages;
+    bool signaled = false; //a wakeup was written since the receiver last found the port empty
+    bool isClosed = false;
+    int ends[2] = {-1, -1};
+};
+
+// the script in file, run by an event loop of its own on a new thread. in the worker the global parent is the
+// port pair to whoever started it: inbox carries messages to the worker, outbox from it. the outbox is closed
+// once the worker's loop has nothing left to do
+class Worker {
+public:
+    //setup is called with the worker's interpreter on its thread before it runs, to turn on the JIT and such
+    Worker(const string &file, const function<void(Interpreter &)> &setup = nullptr);
+
+    //closes the inbox, so a worker waiting for messages gets undefined and can end, then waits for it
+    ~Worker();
+
+    //end the script at its next preemption point, from any thread (see Interpreter::terminate)
+    void terminate();
+
+    shared_ptr<Port> inbox;
+    shared_ptr<Port> outbox;
+
+private:
+    thread runner;
+
+    mutex lock;
+    Interpreter *running = nullptr; //while its loop runs
+    bool terminating = false;
+
+    void run(const string &file, const function<void(Interpreter &)> &setup);
+};
+
+#endif //TINYJS_WORKER_H
@@ -0,0 +1,112 @@
+//
+// Event loop: thousands of scripts waiting at once on one thread, on timers and on pipes. Each script
+// sleeps five times for 10 ms, so however many run, the loop should take about 50 ms plus the time the
+// scripts spend running.
+//
+
+#include "EventLoop.h"
+#include <chrono>
+#include <iomanip>
+#include <fstream>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char *sleeperScript =
+        "var n = 0;\n"
+        "for (var i = 0; i < 5; i++) {\n"
+        "    sleep(10);\n"
+        "    n = n + 1;\n"
+        "}\n"
+        "result = n;\n";
+
+//reads what the host writes to its pipe in two parts, the rest from a timer callback. on a busy machine
+//both parts may be there by the first read
+static const char *readerScript =
+        "var got = read(fd);\n"
+        "setTimeout(function() {\n"
+        "    while (got != \"pingpong\") {\n"
+        "        got = got + read(fd);\n"
+        "    }\n"
+        "    result = got;\n"
+        "}, 1);\n";
+
+// resident memory in kB, 0 where /proc is missing
+static long residentKb() {
+    ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static bool run(int scripts, bool jit, bool pipes) {
+    EventLoop loop;
+    vector<Interpreter *> interpreters;
+    vector<int> fds;
+    for (int i = 0; i < scripts; i++) {
+        Interpreter *interpreter = loop.add(pipes ? "event_bench_reader.js" : "event_bench_sleeper.js");
+        interpreter->jit = jit;
+        if (pipes) {
+            int ends[2];
+            if (pipe(ends) != 0) {
+                cout << "no more pipes after " << i << endl;
+                return false;
+            }
+            interpreter->root->addChild("fd", new Var(ends[0]));
+            fds.push_back(ends[0]);
+            fds.push_back(ends[1]);
+        }
+        interpreters.push_back(interpreter);
+    }
+    //the first half of every message now, the second after 20 ms
+    for (size_t i = 1; i < fds.size(); i += 2) {
+        int fd = fds[i];
+        loop.setTimer(0, [fd] { (void) write(fd, "ping", 4); });
+        loop.setTimer(20, [fd] { (void) write(fd, "pong", 4); });
+    }
+
+    long before = residentKb();
+    long peak = before;
+    loop.setTimer(25, [&peak] { peak = max(peak, residentKb()); });
+    auto start = chrono::steady_clock::now();
+    bool ok = loop.run();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    string expected = pipes ? "pingpong" : "5";
+    for (auto interpreter: interpreters) {
+        auto link = interpreter->root->findChild("result");
+        ok = ok && link && link->var->getString() == expected;
+    }
+    for (int fd: fds) {
+        close(fd);
+    }
+    cout << left << setw(10) << scripts << setw(8) << (pipes ? "pipes" : "timers") << right << setw(12) << ms
+    << setw(10) << loop.stats.tasks << setw(10) << loop.stats.turns << setw(10) << loop.stats.polls << setw(12)
+    << loop.stats.maxWaiting << setw(14) << (double) (peak - before) / scripts << (ok ? "" : "  wrong result")
+    << endl;
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int most = argc > 1 ? atoi(argv[1]) : 10000;
+    bool jit = getenv("TINYJS_JIT") != nullptr;
+    ofstream("event_bench_sleeper.js") << sleeperScript;
+    ofstream("event_bench_reader.js") << readerScript;
+
+    cout << (jit ? "jit\n" : "") << left << setw(10) << "scripts" << setw(8) << "waits" << right << setw(12)
+    << "total(ms)" << setw(10) << "tasks" << setw(10) << "turns" << setw(10) << "polls" << setw(12) << "waiting"
+    << setw(14) << "kB/script" << endl;
+    cout << fixed << setprecision(1);
+    bool ok = true;
+    for (int scripts = 10; scripts <= most; scripts *= 10) {
+        ok = run(scripts, jit, false) && ok;
+    }
+    //two descriptors a script, under the usual limit of 1024
+    for (int scripts = 10; scripts <= min(most, 400); scripts *= 2) {
+        ok = run(scripts, jit, true) && ok;
+    }
+    remove("event_bench_sleeper.js");
+    remove("event_bench_reader.js");
+    return ok ? 0 : 1;
+}
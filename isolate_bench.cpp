@@ -0,0 +1,155 @@
+//
+// Isolate throughput: N threads each run isolates back to back, from 1 thread up to 64, with a fresh heap
+// per script, with forks of one warmed up heap and as jobs of an Executor with N workers. A core of its own
+// per isolate should give N times the scripts per second of one thread.
+//
+
+#include "Isolate.h"
+#include "Executor.h"
+#include <thread>
+#include <chrono>
+#include <iomanip>
+#include <fstream>
+#include <stdlib.h>
+
+using namespace std;
+
+//what every request needs is set up once, a request reads it and writes a global
+static const string warmScript =
+        "function fib(n) {\n"
+        "    if (n < 2) {\n"
+        "        return n;\n"
+        "    }\n"
+        "    return fib(n - 1) + fib(n - 2);\n"
+        "}\n"
+        "var points = [];\n"
+        "for (var i = 0; i < 300; i++) {\n"
+        "    points[i] = {x: i, y: i * 2};\n"
+        "}\n";
+
+static const string requestBody =
+        "var sum = 0;\n"
+        "for (var i = 0; i < points.length; i++) {\n"
+        "    sum = sum + points[i].x * points[i].y;\n"
+        "}\n";
+
+static const string requestScript = requestBody + "result = fib(16) + sum;\n";
+
+//the same work in one script
+static const string jobScript = warmScript + requestScript;
+
+static const string expected = "17911087";
+
+//the job again, tagged with its input as the executor runs it
+static const string taggedScript = warmScript + requestBody + "result = input + \":\" + (fib(16) + sum);\n";
+
+static bool writeFile(const string &file, const string &text) {
+    ofstream out(file);
+    out << text;
+    return (bool) out;
+}
+
+// threads * perThread isolates, the scripts per second and whether every one gave the expected result
+static double run(int threads, int perThread, Interpreter *warm, const string &file, bool jit, bool &ok) {
+    vector<thread> workers;
+    vector<int> wrong((size_t) threads, 0);
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            for (int i = 0; i < perThread; i++) {
+                unique_ptr<Isolate> isolate(warm ? new Isolate(*warm, file) : new Isolate(file));
+                if (!warm) {
+                    isolate->interpreter->jit = jit;
+                }
+                if (!isolate->execute() || isolate->global("result") != expected) {
+                    wrong[t]++;
+                }
+            }
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    ok = true;
+    for (int w: wrong) {
+        ok = ok && w == 0;
+    }
+    return threads * perThread / seconds;
+}
+
+// the same number of jobs through an executor, whose workers keep their isolate from job to job
+static double runExecutor(int threads, int perThread, const string &file, bool jit, bool &ok, bool report) {
+    Executor executor(threads, [jit](Interpreter &interpreter) {
+        interpreter.jit = jit;
+    });
+    vector<future<string>> results;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < threads * perThread; i++) {
+        results.push_back(executor.submit(file, to_string(i)));
+    }
+    ok = true;
+    for (int i = 0; i < threads * perThread; i++) {
+        ok = results[i].get() == to_string(i) + ":" + expected && ok;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (report) {
+        executor.report(cout);
+    }
+    return threads * perThread / seconds;
+}
+
+int main(int argc, char **argv) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 64;
+    int perThread = argc > 2 ? atoi(argv[2]) : 20;
+    bool jit = getenv("TINYJS_JIT") != nullptr;
+    //an isolate lexes on its own thread, the other cores run other isolates
+    Lex::lexThreads = 1;
+
+    string job = "isolate_bench_job.js", warmFile = "isolate_bench_warm.js", request = "isolate_bench_request.js";
+    string tagged = "isolate_bench_tagged.js";
+    if (!writeFile(job, jobScript) || !writeFile(warmFile, warmScript) || !writeFile(request, requestScript) ||
+        !writeFile(tagged, taggedScript)) {
+        cout << "cannot write the scripts to the current directory" << endl;
+        return 1;
+    }
+    Interpreter warm(warmFile);
+    warm.jit = jit;
+    warm.execute();
+
+    unsigned cores = thread::hardware_concurrency();
+    cout << cores << " cores, " << perThread << " scripts per thread" << (jit ? ", jit" : "") << endl;
+    cout << left << setw(10) << "threads" << right << setw(14) << "fresh/s" << setw(10) << "scale" << setw(14)
+    << "fork/s" << setw(10) << "scale" << setw(14) << "executor/s" << setw(10) << "scale" << endl;
+    cout << fixed << setprecision(1);
+    double freshOne = 0, forkOne = 0, executorOne = 0;
+    bool allOk = true;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        bool freshOk, forkOk, executorOk;
+        double fresh = run(threads, perThread, nullptr, job, jit, freshOk);
+        double forked = run(threads, perThread, &warm, request, jit, forkOk);
+        double executed = runExecutor(threads, perThread, tagged, jit, executorOk, false);
+        if (threads == 1) {
+            freshOne = fresh;
+            forkOne = forked;
+            executorOne = executed;
+        }
+        bool ok = freshOk && forkOk && executorOk;
+        cout << left << setw(10) << threads << right << setw(14) << fresh << setw(9) << fresh / freshOne << "x"
+        << setw(14) << forked << setw(9) << forked / forkOne << "x" << setw(14) << executed << setw(9)
+        << executed / executorOne << "x" << (ok ? "" : "  wrong result") << endl;
+        allOk = allOk && ok;
+    }
+
+    //where the jobs of an executor ran
+    cout << endl;
+    bool reportOk;
+    runExecutor(min(maxThreads, 4), perThread, tagged, jit, reportOk, true);
+    allOk = allOk && reportOk;
+
+    remove(job.c_str());
+    remove(warmFile.c_str());
+    remove(request.c_str());
+    remove(tagged.c_str());
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+//
+// Lexer microbenchmark: tokenizes large comment-, string- and whitespace-heavy sources with every scanning
+// kernel the CPU runs and checks they give the same tokens.
+//
+
+#include "Lex.h"
+#include "LexScan.h"
+#include <chrono>
+#include <iomanip>
+#include <atomic>
+#include <new>
+
+using namespace std;
+
+//every heap allocation of the process, to see what lexing a token costs
+static atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+static string commentHeavy(int lines) {
+    string s;
+    for (int i = 0; i < lines; i++) {
+        s += "// a line comment that goes on for a while, as generated code and licence headers do\n";
+        s += "/* a block comment that spans\n   a couple of lines of prose, with no closing mark until here */\n";
+        s += "var value" + to_string(i) + " = " + to_string(i) + ";\n";
+    }
+    return s;
+}
+
+static string stringHeavy(int lines) {
+    string s;
+    for (int i = 0; i < lines; i++) {
+        s += "var text" + to_string(i) + " = \"a long string literal of some data, with an escaped \\\\ backslash "
+             "and more text after it to the end of the line\";\n";
+        s += "var other" + to_string(i) + " = 'single quoted, as long as the one above it, holding a record';\n";
+    }
+    return s;
+}
+
+//many literals of a few characters, as object keys and small values are
+static string shortStrings(int lines) {
+    string s;
+    for (int i = 0; i < lines; i++) {
+        s += "var item" + to_string(i) + " = {k: \"ab\", name: 'short', path: \"a\\\\b\", tag: 'x'};\n";
+    }
+    return s;
+}
+
+static string identifierHeavy(int lines) {
+    string s;
+    for (int i = 0; i < lines; i++) {
+        s += "        someFairlyLongVariableName_" + to_string(i) + " = anotherQuiteLongIdentifier + "
+             "yetAnotherIdentifierHere;\n";
+    }
+    return s;
+}
+
+static bool sameTokens(const Lex &a, const Lex &b) {
+    if (a.tokens->size() != b.tokens->size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.tokens->size(); i++) {
+        const Token &x = (*a.tokens)[i], &y = (*b.tokens)[i];
+        if (x.type != y.type || x.value != y.value || x.pos != y.pos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    Lex::lexThreads = 1;
+    LEX_SCAN_KERNELS best = lexScanKernel();
+    const int rounds = 5;
+
+    vector<pair<string, string>> inputs{
+            {"comments",    commentHeavy(40000)},
+            {"strings",     stringHeavy(40000)},
+            {"short strings", shortStrings(100000)},
+            {"identifiers", identifierHeavy(60000)}
+    };
+
+    cout << left << setw(14) << "input" << setw(10) << "kernel" << right << setw(10) << "MB" << setw(12) << "ms"
+    << setw(12) << "MB/s" << setw(14) << "allocs/token" << endl;
+    cout << fixed << setprecision(2);
+    for (auto &input: inputs) {
+        setLexScanKernel(SCAN_SCALAR);
+        Lex reference(input.second);
+        for (int k = SCAN_SCALAR; k <= SCAN_AVX2; k++) {
+            if (!setLexScanKernel((LEX_SCAN_KERNELS) k)) {
+                continue;
+            }
+            double bestMs = 1e30;
+            double perToken = 0;
+            for (int r = 0; r < rounds; r++) {
+                size_t before = allocations;
+                auto start = chrono::steady_clock::now();
+                Lex lex(input.second);
+                perToken = (double) (allocations - before) / lex.tokens->size();
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                bestMs = min(bestMs, ms);
+                if (r == 0 && !sameTokens(lex, reference)) {
+                    cout << "kernel " << lexScanKernelName((LEX_SCAN_KERNELS) k) << " gives other tokens on "
+                    << input.first << endl;
+                    return 1;
+                }
+            }
+            double mb = input.second.size() / 1e6;
+            cout << left << setw(14) << input.first << setw(10) << lexScanKernelName((LEX_SCAN_KERNELS) k)
+            << right << setw(10) << mb << setw(12) << bestMs << setw(12) << mb / (bestMs / 1e3) << setw(14) << perToken
+            << endl;
+        }
+    }
+
+    //the kernels on their own: every line end of the comment input, as `//` comments are skipped, and every
+    //string body of the two string inputs, as the lexer reads a literal
+    cout << endl << left << setw(14) << "scan" << setw(10) << "kernel" << right << setw(12) << "found"
+    << setw(12) << "ms" << setw(12) << "MB/s" << endl;
+    for (int scan = 0; scan < 3; scan++) {
+        const string &text = inputs[scan].second;
+        const char *s = text.data();
+        int len = (int) text.size();
+        for (int k = SCAN_SCALAR; k <= SCAN_AVX2; k++) {
+            if (!setLexScanKernel((LEX_SCAN_KERNELS) k)) {
+                continue;
+            }
+            double bestMs = 1e30;
+            int found = 0;
+            for (int r = 0; r < rounds; r++) {
+                auto start = chrono::steady_clock::now();
+                found = 0;
+                if (scan == 0) {
+                    for (int i = scanChar(s, 0, len, '\n'); i < len; i = scanChar(s, i + 1, len, '\n')) {
+                        found++;
+                    }
+                } else {
+                    for (int i = 0; i < len; i++) {
+                        if (s[i] == '"' || s[i] == '\'') {
+                            i = scanString(s, i + 1, len, s[i]);
+                            found++;
+                        }
+                    }
+                }
+                bestMs = min(bestMs, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+            }
+            cout << left << setw(14) << (scan == 0 ? "line ends" : inputs[scan].first) << setw(10)
+            << lexScanKernelName((LEX_SCAN_KERNELS) k) << right << setw(12) << found << setw(12) << bestMs
+            << setw(12) << len / 1e6 / (bestMs / 1e3) << endl;
+        }
+    }
+
+    setLexScanKernel(best);
+    return 0;
+}
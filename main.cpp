@@ -6,7 +6,8 @@
 using namespace std;
 
 
-int main() {
+//the script to run can be given as the argument, - reads it from stdin and runs it as it arrives
+int main(int argc, char **argv) {
 //    string file="./Test4JS/var.js";
 //    string file="./Test4JS/json.js";
 //    string file="./Test4JS/closure.js";
@@ -14,11 +15,51 @@ int main() {
 //    string file="./Test4JS/recursion.js";
 //    string file="./Test4JS/this_and_new.js";
     string file="./Test4JS/eval.js";
+    if (argc > 1) {
+        file = argv[1];
+    }
 
+    if (getenv("TINYJS_LEX_THREADS")) {
+        Lex::lexThreads = atoi(getenv("TINYJS_LEX_THREADS"));
+    }
+    vector<long long> pairCounts;
+    if (getenv("TINYJS_PAIR_REPORT")) {
+        Lex::pairCounts = &pairCounts;
+    }
     Interpreter interpreter(file);
+    interpreter.jit = getenv("TINYJS_JIT") != nullptr;
+    if (getenv("TINYJS_CACHE")) {
+        interpreter.cacheDir = getenv("TINYJS_CACHE");
+    }
+    if (getenv("TINYJS_COMPILE_THREADS")) {
+        interpreter.compileThreads = atoi(getenv("TINYJS_COMPILE_THREADS"));
+    }
+    //TINYJS_SNAPSHOT starts from a saved heap instead of an empty one, TINYJS_SAVE_SNAPSHOT saves the heap
+    //the script leaves
+    if (getenv("TINYJS_SNAPSHOT") && !interpreter.loadSnapshot(getenv("TINYJS_SNAPSHOT"))) {
+        return 1;
+    }
     interpreter.execute();
+    if (getenv("TINYJS_SAVE_SNAPSHOT")) {
+        interpreter.saveSnapshot(getenv("TINYJS_SAVE_SNAPSHOT"));
+    }
 
     cout << interpreter.root->findChild("result")->var->getString() << endl;
+    if (getenv("TINYJS_OPT_REPORT")) {
+        interpreter.optimizerReport(cerr);
+    }
+    if (getenv("TINYJS_CACHE_REPORT")) {
+        cerr << "token cache: " << interpreter.cacheStats.hits << " hits, " << interpreter.cacheStats.misses
+        << " misses, " << interpreter.cacheStats.rejected << " rejected, " << interpreter.cacheStats.stores
+        << " stored" << endl;
+    }
+    if (getenv("TINYJS_TIER_REPORT")) {
+        interpreter.tierReport(cerr);
+    }
+    if (getenv("TINYJS_PAIR_REPORT")) {
+        Lex::pairReport(cerr, atoi(getenv("TINYJS_PAIR_REPORT")) > 1 ? atoi(getenv("TINYJS_PAIR_REPORT")) : 20);
+        Lex::pairCounts = nullptr;
+    }
     return 0;
 }
 
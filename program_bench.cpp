@@ -0,0 +1,166 @@
+//
+// One rule script over many records: a fresh interpreter per record, one interpreter running the file again
+// per record, and a Program with the record bound as globals or passed as arguments.
+//
+
+#include "Program.h"
+#include <chrono>
+#include <iomanip>
+#include <fstream>
+#include <stdlib.h>
+
+using namespace std;
+
+static const char *ruleScript =
+        "function rule(amount, country, age) {\n"
+        "    var score = 0;\n"
+        "    if (amount > 1000) {\n"
+        "        score = score + 3;\n"
+        "    }\n"
+        "    if (country == \"NL\") {\n"
+        "        score = score + 2;\n"
+        "    }\n"
+        "    if (age < 25) {\n"
+        "        score = score + 1;\n"
+        "    }\n"
+        "    return score;\n"
+        "}\n"
+        "var score = 0;\n"
+        "if (amount > 1000) {\n"
+        "    score = score + 3;\n"
+        "}\n"
+        "if (country == \"NL\") {\n"
+        "    score = score + 2;\n"
+        "}\n"
+        "if (age < 25) {\n"
+        "    score = score + 1;\n"
+        "}\n"
+        "result = score;\n";
+
+struct Record {
+    int amount;
+    string country;
+    int age;
+};
+
+static Record record(int i) {
+    return {i * 7919 % 2000, i % 3 ? "DE" : "NL", 18 + i % 50};
+}
+
+static long long expectedSum(int n) {
+    long long sum = 0;
+    for (int i = 0; i < n; i++) {
+        Record r = record(i);
+        sum += (r.amount > 1000 ? 3 : 0) + (r.country == "NL" ? 2 : 0) + (r.age < 25 ? 1 : 0);
+    }
+    return sum;
+}
+
+static void setGlobals(Interpreter &interpreter, const Record &r) {
+    interpreter.root->findChildOrCreate("amount")->replaceWith(new Var(r.amount));
+    interpreter.root->findChildOrCreate("country")->replaceWith(new Var(r.country));
+    interpreter.root->findChildOrCreate("age")->replaceWith(new Var(r.age));
+}
+
+static int resultOf(Interpreter &interpreter) {
+    auto link = interpreter.root->findChild("result");
+    return link ? link->var->getInt() : 0;
+}
+
+static bool report(const string &name, int n, double ms, long long sum) {
+    long long expected = expectedSum(n);
+    if (sum != expected) {
+        cout << name << " gave " << sum << " instead of " << expected << endl;
+        return false;
+    }
+    cout << left << setw(36) << name << right << setw(9) << n << " records" << setw(10) << ms * 1000 / n
+    << " us a record" << setw(12) << (long long) (n / (ms / 1000)) << " a second" << endl;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    bool jit = getenv("TINYJS_JIT") != nullptr;
+    const string file = "program_bench_rule.js";
+    ofstream(file) << ruleScript;
+    cout << (jit ? "jit\n" : "") << fixed << setprecision(2);
+    bool ok = true;
+
+    //the record written into the globals of a new interpreter, which lexes the script again
+    int few = max(1, n / 100);
+    auto start = chrono::steady_clock::now();
+    long long sum = 0;
+    for (int i = 0; i < few; i++) {
+        Interpreter interpreter(file);
+        interpreter.jit = jit;
+        setGlobals(interpreter, record(i));
+        interpreter.execute();
+        sum += resultOf(interpreter);
+    }
+    ok = report("new interpreter per record", few, chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count(), sum) && ok;
+
+    //one interpreter, the file mapped and matched against the scripts it ran before per record
+    {
+        Interpreter interpreter;
+        interpreter.jit = jit;
+        start = chrono::steady_clock::now();
+        sum = 0;
+        for (int i = 0; i < few * 10; i++) {
+            setGlobals(interpreter, record(i));
+            interpreter.execute(file);
+            sum += resultOf(interpreter);
+        }
+        ok = report("execute(file) per record", few * 10, chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count(), sum) && ok;
+    }
+
+    //the records are made before the clock starts for the programs, they only set them
+    vector<Record> records;
+    records.reserve(n);
+    for (int i = 0; i < n; i++) {
+        records.push_back(record(i));
+    }
+
+    {
+        Program program(file);
+        program.interpreter->jit = jit;
+        int amount = program.bind("amount");
+        int country = program.bind("country");
+        int age = program.bind("age");
+        start = chrono::steady_clock::now();
+        sum = 0;
+        for (auto &r: records) {
+            program.set(amount, r.amount);
+            program.set(country, r.country);
+            program.set(age, r.age);
+            sum += program.run()->getInt();
+        }
+        ok = report("Program::run, inputs bound as globals", n, chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count(), sum) && ok;
+    }
+
+    {
+        Program program(file);
+        program.interpreter->jit = jit;
+        int amount = program.parameter();
+        int country = program.parameter();
+        int age = program.parameter();
+        //the first run declares rule
+        program.run();
+        int rule = program.function("rule");
+        start = chrono::steady_clock::now();
+        sum = 0;
+        for (auto &r: records) {
+            program.set(amount, r.amount);
+            program.set(country, r.country);
+            program.set(age, r.age);
+            sum += program.call(rule)->getInt();
+        }
+        ok = report("Program::call, inputs as arguments", n, chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count(), sum) && ok;
+    }
+
+    remove(file.c_str());
+    return ok ? 0 : 1;
+}
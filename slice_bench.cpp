@@ -0,0 +1,213 @@
+//
+// Time slicing: scripts interleaved on one thread by a round-robin scheduler, next to the same scripts run
+// one after the other. A runaway loop among them is terminated by its hard limit, another one by a watchdog
+// thread, and neither holds up the rest for longer than a slice.
+//
+
+#include "Interpreter.h"
+#include <thread>
+#include <chrono>
+#include <iomanip>
+#include <fstream>
+#include <memory>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace std;
+
+struct SliceJob {
+    const char *file;
+    const char *text;
+    string expected; //result of a run from start to end, filled in first
+};
+
+static SliceJob jobs[] = {
+        {"slice_bench_fib.js",
+                "function fib(n) {\n"
+                "    if (n < 2) {\n"
+                "        return n;\n"
+                "    }\n"
+                "    return fib(n - 1) + fib(n - 2);\n"
+                "}\n"
+                "result = fib(20);\n",
+                ""},
+        {"slice_bench_loop.js",
+                "var sum = 0;\n"
+                "for (var i = 0; i < 200000; i++) {\n"
+                "    sum = (sum + i * 7) % 1000003;\n"
+                "}\n"
+                "result = sum;\n",
+                ""},
+        {"slice_bench_points.js",
+                "var points = [];\n"
+                "for (var i = 0; i < 2000; i++) {\n"
+                "    points[i] = {x: i, y: i * 2};\n"
+                "}\n"
+                "var sum = 0;\n"
+                "for (var i = 0; i < points.length; i++) {\n"
+                "    sum = sum + points[i].x * points[i].y;\n"
+                "}\n"
+                "result = sum;\n",
+                ""},
+        {"slice_bench_nested.js",
+                "function count(n) {\n"
+                "    var c = 0;\n"
+                "    var j = 0;\n"
+                "    while (j < n) {\n"
+                "        c = c + j % 3;\n"
+                "        j = j + 1;\n"
+                "    }\n"
+                "    return c;\n"
+                "}\n"
+                "var total = 0;\n"
+                "for (var i = 0; i < 300; i++) {\n"
+                "    total = total + count(i);\n"
+                "}\n"
+                "result = total;\n",
+                ""},
+};
+
+static const char *runawayFile = "slice_bench_runaway.js";
+static const char *runawayText =
+        "var k = 0;\n"
+        "result = \"running\";\n"
+        "while (k >= 0) {\n"
+        "    k = (k + 1) % 1000;\n"
+        "}\n"
+        "result = \"never\";\n";
+
+static bool jit = false;
+
+static string resultOf(Interpreter &interpreter) {
+    auto link = interpreter.root->findChild("result");
+    return link ? link->var->getString() : "";
+}
+
+static Interpreter *make(const string &file) {
+    auto interpreter = new Interpreter(file);
+    interpreter->jit = jit;
+    return interpreter;
+}
+
+static double msSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// the total, then the median, 99th percentile and longest of the turns
+static void row(const string &name, double total, vector<double> &turns, const char *note) {
+    sort(turns.begin(), turns.end());
+    cout << left << setw(26) << name << right << setw(12) << total << setw(10) << turns.size() << setw(12)
+    << turns[turns.size() / 2] << setw(12) << turns[turns.size() * 99 / 100] << setw(12) << turns.back() << note
+    << endl;
+}
+
+// every job copies times over, with the runaway among them when limitNs is set. sliceOps or sliceNs per turn
+static void schedule(int copies, long long sliceOps, long long sliceNs, long long limitNs, bool &ok) {
+    vector<unique_ptr<Interpreter>> running;
+    vector<string> expected;
+    for (int c = 0; c < copies; c++) {
+        for (auto &job: jobs) {
+            running.emplace_back(make(job.file));
+            expected.push_back(job.expected);
+        }
+    }
+    if (limitNs) {
+        running.emplace_back(make(runawayFile));
+        running.back()->maxNs = limitNs;
+        expected.push_back("running");
+    }
+    vector<bool> started(running.size(), false), done(running.size(), false);
+    vector<double> turns;
+    size_t unfinished = running.size();
+    ok = true;
+    auto start = chrono::steady_clock::now();
+    while (unfinished) {
+        for (size_t i = 0; i < running.size(); i++) {
+            if (done[i]) {
+                continue;
+            }
+            Interpreter &interpreter = *running[i];
+            interpreter.sliceOps = sliceOps;
+            interpreter.sliceNs = sliceNs;
+            auto turn = chrono::steady_clock::now();
+            RUN_RESULTS result = started[i] ? interpreter.resume() : interpreter.start();
+            started[i] = true;
+            turns.push_back(msSince(turn));
+            if (result != RUN_SUSPENDED) {
+                done[i] = true;
+                unfinished--;
+                bool runaway = limitNs && i + 1 == running.size();
+                ok = ok && (result == RUN_TERMINATED) == runaway && resultOf(interpreter) == expected[i];
+            }
+        }
+    }
+    double total = msSince(start);
+    string name = sliceNs ? to_string(sliceNs / 1000) + " us slices" : to_string(sliceOps) + " op slices";
+    row(name + (limitNs ? " + runaway" : ""), total, turns, ok ? "" : "  wrong result");
+}
+
+int main(int argc, char **argv) {
+    int copies = argc > 1 ? atoi(argv[1]) : 4;
+    jit = getenv("TINYJS_JIT") != nullptr;
+    for (auto &job: jobs) {
+        ofstream(job.file) << job.text;
+    }
+    ofstream(runawayFile) << runawayText;
+
+    cout << copies << " copies of " << sizeof(jobs) / sizeof(jobs[0]) << " scripts" << (jit ? ", jit" : "")
+    << endl;
+    cout << left << setw(26) << "run" << right << setw(12) << "total(ms)" << setw(10) << "turns" << setw(12)
+    << "median(ms)" << setw(12) << "p99(ms)" << setw(12) << "max(ms)" << endl;
+    cout << fixed << setprecision(3);
+
+    //one after the other, each to its end
+    bool allOk = true;
+    vector<double> turns;
+    auto start = chrono::steady_clock::now();
+    for (int c = 0; c < copies; c++) {
+        for (auto &job: jobs) {
+            auto turn = chrono::steady_clock::now();
+            unique_ptr<Interpreter> interpreter(make(job.file));
+            interpreter->execute();
+            turns.push_back(msSince(turn));
+            if (job.expected.empty()) {
+                job.expected = resultOf(*interpreter);
+            }
+            allOk = allOk && resultOf(*interpreter) == job.expected;
+        }
+    }
+    row("to the end", msSince(start), turns, "");
+
+    bool ok;
+    for (long long ops: {1000LL, 100000LL}) {
+        schedule(copies, ops, 0, 0, ok);
+        allOk = allOk && ok;
+    }
+    for (long long ns: {100000LL, 1000000LL}) {
+        schedule(copies, 0, ns, 0, ok);
+        allOk = allOk && ok;
+    }
+    schedule(copies, 0, 1000000, 50000000, ok);
+    allOk = allOk && ok;
+
+    //terminated from another thread while it runs to its end on this one
+    unique_ptr<Interpreter> runaway(make(runawayFile));
+    thread watchdog([&runaway]() {
+        this_thread::sleep_for(chrono::milliseconds(50));
+        runaway->terminate();
+    });
+    start = chrono::steady_clock::now();
+    runaway->execute();
+    double stopped = msSince(start);
+    watchdog.join();
+    ok = runaway->wasTerminated() && resultOf(*runaway) == "running";
+    cout << left << setw(26) << "watchdog after 50 ms" << right << setw(12) << stopped << "  after "
+    << runaway->opsRun() << " ops" << (ok ? "" : ", not terminated") << endl;
+    allOk = allOk && ok;
+
+    for (auto &job: jobs) {
+        remove(job.file);
+    }
+    remove(runawayFile);
+    return allOk ? 0 : 1;
+}
@@ -1,4 +1,5 @@
 #include "Var.h"
+#include <string.h>
 
 VarLink::VarLink(Var *var, const std::string &name) {
     this->name = name;
@@ -6,6 +7,7 @@ VarLink::VarLink(Var *var, const std::string &name) {
     this->nextSibling = nullptr;
     this->var = var->ref();
     this->owned = false;
+    this->owner = nullptr;
 }
 
 VarLink::VarLink(const VarLink &link) {
@@ -14,6 +16,7 @@ VarLink::VarLink(const VarLink &link) {
     this->nextSibling = nullptr;
     this->var = link.var->ref();
     this->owned = false;
+    this->owner = nullptr;
 }
 
 VarLink::~VarLink() {
@@ -21,6 +24,7 @@ VarLink::~VarLink() {
 }
 
 void VarLink::replaceWith(Var *var) {
+    assert(!owner || !owner->frozen);
     Var *temp = this->var;
     this->var = var->ref();
     temp->unref();
@@ -35,22 +39,33 @@ void VarLink::replaceWith(shared_ptr<VarLink> varLink) {
 
 
 void Var::init() {
-    refNum = 0;
+    refNum.store(0, std::memory_order_relaxed);
     firstChild = nullptr;
     lastChild = nullptr;
     type = 0;
+    frozen = false;
     intData = 0;
     doubleData = 0;
     stringData = "";
 }
 
+// a frozen var is shared by forks that may run on other threads and is counted with atomic adds, any other
+// belongs to one interpreter and a plain load and store do
 Var *Var::ref() {
-    refNum++;
+    if (frozen)
+        refNum.fetch_add(1, std::memory_order_relaxed);
+    else
+        refNum.store(refNum.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     return this;
 }
 
 void Var::unref() {
-    if (--refNum == 0)
+    int left;
+    if (frozen)
+        left = refNum.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    else
+        refNum.store(left = refNum.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    if (left == 0)
         delete this;
 }
 
@@ -149,6 +164,7 @@ std::string Var::getString() {
 
 
 void Var::setInt(int _int) {
+    assert(!frozen);
     type = VAR_INTEGER;
     intData = _int;
     doubleData = 0;
@@ -156,6 +172,7 @@ void Var::setInt(int _int) {
 }
 
 void Var::setDouble(double _double) {
+    assert(!frozen);
     type = VAR_DOUBLE;
     intData = 0;
     doubleData = _double;
@@ -163,6 +180,7 @@ void Var::setDouble(double _double) {
 }
 
 void Var::setBool(bool _bool) {
+    assert(!frozen);
     type = VAR_BOOLEAN;
     intData = _bool;
     doubleData = 0;
@@ -170,6 +188,7 @@ void Var::setBool(bool _bool) {
 }
 
 void Var::setString(const std::string &_string) {
+    assert(!frozen);
     type = VAR_STRING;
     intData = 0;
     doubleData = 0;
@@ -177,6 +196,7 @@ void Var::setString(const std::string &_string) {
 }
 
 void Var::setUndefined() {
+    assert(!frozen);
     type = VAR_UNDEFINED;
     intData = 0;
     doubleData = 0;
@@ -313,12 +333,21 @@ Var *Var::mathOp(Var *b, TOKEN_TYPES op) {
     return 0;
 }
 
+// the walk goes by reference, only the link found is copied: copying every link on the way costs two atomic
+// adds each, on the same counts in every fork that reads a shared var
 std::shared_ptr<VarLink> Var::findChild(const std::string &childName) {
-    auto v = firstChild;
-    while (v) {
-        if (v->name == childName)
-            return v;
-        v = v->nextSibling;
+    for (const std::shared_ptr<VarLink> *v = &firstChild; *v; v = &(*v)->nextSibling) {
+        if ((*v)->name == childName)
+            return *v;
+    }
+    return nullptr;
+}
+
+// lookup by a name that is not a string of its own, such as a token's text
+std::shared_ptr<VarLink> Var::findChild(const char *childName, size_t length) {
+    for (const std::shared_ptr<VarLink> *v = &firstChild; *v; v = &(*v)->nextSibling) {
+        if ((*v)->name.size() == length && memcmp((*v)->name.data(), childName, length) == 0)
+            return *v;
     }
     return nullptr;
 }
@@ -332,6 +361,7 @@ std::shared_ptr<VarLink> Var::findChildOrCreate(const std::string &childName, in
 }
 
 std::shared_ptr<VarLink> Var::addChild(const std::string &childName, Var *child) {
+    assert(!frozen);
     if (isUndefined())
         type = VAR_OBJECT;
     if (!child)
@@ -339,6 +369,7 @@ std::shared_ptr<VarLink> Var::addChild(const std::string &childName, Var *child)
 
     std::shared_ptr<VarLink> link(new VarLink(child, childName));
     link->owned = true;
+    link->owner = this;
     if (lastChild) {
         lastChild->nextSibling = link;
         link->prevSibling = lastChild;
@@ -378,6 +409,7 @@ void Var::removeChild(Var *child) {
 
 void Var::removeLink(std::shared_ptr<VarLink> link) {
     if (!link) return;
+    assert(!frozen);
     if (link->nextSibling)
         link->nextSibling->prevSibling = link->prevSibling;
     if (link->prevSibling)
@@ -390,11 +422,13 @@ void Var::removeLink(std::shared_ptr<VarLink> link) {
 }
 
 void Var::removeAllChildren() {
+    //siblings hold each other both ways, the chain has to be cut for any link (and the var it holds) to go
     auto link = firstChild;
     while (link) {
-        auto temp = link;
-        link = link->nextSibling;
-        temp.reset();
+        auto next = link->nextSibling;
+        link->prevSibling = nullptr;
+        link->nextSibling = nullptr;
+        link = next;
     }
     firstChild = nullptr;
     lastChild = nullptr;
@@ -433,6 +467,19 @@ Var *Var::copyThis() {
     return ret;
 }
 
+Var *Var::shallowCopy() {
+    Var *ret = new Var();
+
+    ret->copy(this);
+
+    auto link = firstChild;
+    while (link) {
+        ret->addChild(link->name, link->var);
+        link = link->nextSibling;
+    }
+    return ret;
+}
+
 void Var::copy(Var *var) {
     this->stringData = var->stringData;
     this->intData = var->intData;
@@ -7,6 +7,7 @@
 
 #include <unordered_map>
 #include <memory>
+#include <atomic>
 #include <string>
 #include <stdlib.h>
 #include <assert.h>
@@ -21,11 +22,12 @@ class VarLink;
 
 
 #define JS_RETURN_VAR   "__builtin__return"
-#define JS_FUNCBODY_VAR "__builtin__body"
+#define JS_FUNCINFO_VAR "__builtin__info"
 #define JS_ARGC_VAR     "__builtin__argc"
 #define JS_ARGV_VAR     "__builtin__argv"
 #define JS_SCOPE        "__builtin__scope"
 #define JS_SCOPE_NUM    "__builtin__scope__num"
+#define JS_NATIVE_VAR   "__builtin__native"
 #define JS_THIS_VAR     "this"
 #define ANONYMOUS_VAR   ""
 #define VAR_BLANK       ""
@@ -46,7 +48,7 @@ enum VAR_TYPES {
 
 class Var {
 protected:
-    int refNum;
+    std::atomic<int> refNum; //atomic for frozen vars only, see ref
     std::string stringData;
     int intData; //int and bool
     double doubleData;
@@ -55,6 +57,7 @@ protected:
 
 public:
     int type;
+    bool frozen; //shared by forked interpreters, never changed again: see Interpreter::fork
     std::shared_ptr<VarLink> firstChild;
     std::shared_ptr<VarLink> lastChild;
 
@@ -93,6 +96,8 @@ public:
 
     bool isBasic() { return (firstChild == nullptr); }
 
+    int getRefNum() { return refNum.load(std::memory_order_relaxed); }
+
     int getInt();
 
     bool getBool();
@@ -115,10 +120,15 @@ public:
 
     Var *copyThis();
 
+    //a var of its own with the same value, whose children are links to the same vars
+    Var *shallowCopy();
+
     void copy(Var *var);
 
     std::shared_ptr<VarLink> findChild(const std::string &childName);
 
+    std::shared_ptr<VarLink> findChild(const char *childName, size_t length);
+
     std::shared_ptr<VarLink> findChildOrCreate(const std::string &childName, int childType = VAR_UNDEFINED);
 
     std::shared_ptr<VarLink> addChild(const std::string &childName, Var *child = NULL);
@@ -150,6 +160,7 @@ public:
     std::shared_ptr<VarLink> nextSibling;
     Var *var;
     bool owned;
+    Var *owner; //the var this is a child of, nullptr for a link of its own
 
     VarLink(Var *var, const std::string &name = ANONYMOUS_VAR);
 
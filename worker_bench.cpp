@@ -0,0 +1,167 @@
+//
+// Workers: an array of numbers sent to a worker and back, moved or cloned; small messages one way; and one
+// script fanning a sum out to several workers.
+//
+
+#include "EventLoop.h"
+#include <chrono>
+#include <iomanip>
+#include <fstream>
+#include <stdlib.h>
+
+using namespace std;
+
+//round trips of a, moved or cloned as the parent says
+static const char *echoScript =
+        "var rounds = receiveMessage(parent);\n"
+        "for (var r = 0; r < rounds; r++) {\n"
+        "    var m = receiveMessage(parent);\n"
+        "    postMessage(parent, m.data, m.move);\n"
+        "}\n";
+
+//a is made by the host: a script building an array looks up each new index among the ones before
+static const char *pingScript =
+        "var w = worker(\"worker_bench_echo.js\");\n"
+        "postMessage(w, rounds);\n"
+        "for (var r = 0; r < rounds; r++) {\n"
+        "    postMessage(w, {data: a, move: transfer}, transfer);\n"
+        "    a = receiveMessage(w);\n"
+        "}\n"
+        "result = a.length + \",\" + a[n - 1];\n";
+
+//small messages one way, one reply at the end
+static const char *countScript =
+        "var count = receiveMessage(parent);\n"
+        "var sum = 0;\n"
+        "for (var i = 0; i < count; i++) {\n"
+        "    var m = receiveMessage(parent);\n"
+        "    sum = sum + m.id;\n"
+        "}\n"
+        "postMessage(parent, sum);\n";
+
+static const char *sendScript =
+        "var w = worker(\"worker_bench_count.js\");\n"
+        "postMessage(w, count);\n"
+        "for (var i = 0; i < count; i++) {\n"
+        "    postMessage(w, {id: i, x: 1.5, tag: \"point\"});\n"
+        "}\n"
+        "result = receiveMessage(w);\n";
+
+//each worker sums its part of the data reps times
+static const char *sumScript =
+        "var reps = receiveMessage(parent);\n"
+        "var part = receiveMessage(parent);\n"
+        "var sum = 0;\n"
+        "for (var r = 0; r < reps; r++) {\n"
+        "    for (var i = 0; i < part.length; i++) {\n"
+        "        sum = sum + part[i];\n"
+        "    }\n"
+        "}\n"
+        "postMessage(parent, sum);\n";
+
+static const char *fanScript =
+        "var ws = [];\n"
+        "for (var k = 0; k < workers; k++) {\n"
+        "    ws[k] = worker(\"worker_bench_sum.js\");\n"
+        "}\n"
+        "for (var k = 0; k < workers; k++) {\n"
+        "    postMessage(ws[k], reps);\n"
+        "    postMessage(ws[k], parts[k], true);\n"
+        "}\n"
+        "var total = 0;\n"
+        "for (var k = 0; k < workers; k++) {\n"
+        "    total = total + receiveMessage(ws[k]);\n"
+        "}\n"
+        "result = total;\n";
+
+// an array of n numbers, each value or its index
+static Var *numbers(int n, int value = -1) {
+    Var *array = new Var("", VAR_ARRAY);
+    for (int i = 0; i < n; i++) {
+        array->addChild(to_string(i), new Var(value < 0 ? i : value));
+    }
+    return array;
+}
+
+// run file with the globals set, the time taken in ms, or -1 when result is not expected. arrays are
+// globals made before the clock starts
+static double run(const string &file, const vector<pair<string, int>> &globals, bool jit, const string &expected,
+                  const vector<pair<string, Var *>> &arrays = {}) {
+    EventLoop loop;
+    Interpreter *interpreter = loop.add(file);
+    interpreter->jit = jit;
+    for (auto &global: globals) {
+        interpreter->root->addChild(global.first, new Var(global.second));
+    }
+    for (auto &array: arrays) {
+        interpreter->root->addChild(array.first, array.second);
+    }
+    auto start = chrono::steady_clock::now();
+    loop.run();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    auto link = interpreter->root->findChild("result");
+    string result = link ? link->var->getString() : "";
+    if (result != expected) {
+        cout << file << " gave " << result << " instead of " << expected << endl;
+        return -1;
+    }
+    return ms;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 100000;
+    bool jit = getenv("TINYJS_JIT") != nullptr;
+    ofstream("worker_bench_echo.js") << echoScript;
+    ofstream("worker_bench_ping.js") << pingScript;
+    ofstream("worker_bench_count.js") << countScript;
+    ofstream("worker_bench_send.js") << sendScript;
+    ofstream("worker_bench_sum.js") << sumScript;
+    ofstream("worker_bench_fan.js") << fanScript;
+    cout << (jit ? "jit\n" : "") << fixed << setprecision(2);
+    bool ok = true;
+
+    //the time for 10 round trips less the time for none is what the messages cost
+    const int rounds = 10;
+    string pong = to_string(n) + "," + to_string(n - 1);
+    for (int transfer = 1; transfer >= 0; transfer--) {
+        double none = run("worker_bench_ping.js", {{"n", n}, {"rounds", 0}, {"transfer", transfer}}, jit, pong,
+                          {{"a", numbers(n)}});
+        double some = run("worker_bench_ping.js", {{"n", n}, {"rounds", rounds}, {"transfer", transfer}}, jit, pong,
+                          {{"a", numbers(n)}});
+        ok = ok && none >= 0 && some >= 0;
+        cout << left << setw(40) << (to_string(n) + " numbers " + (transfer ? "moved" : "cloned")) << right
+        << setw(10) << max(0.0, some - none) / rounds << " ms a round trip" << endl;
+    }
+
+    const int count = 20000;
+    double sent = run("worker_bench_send.js", {{"count", count}}, jit, to_string((long long) count * (count - 1) / 2));
+    ok = ok && sent >= 0;
+    Message probe;
+    Var *point = (new Var())->ref();
+    point->addChild("id", new Var(count));
+    point->addChild("x", new Var(1.5));
+    point->addChild("tag", new Var(string("point")));
+    probe.write(point, {});
+    point->unref();
+    cout << left << setw(40) << (to_string(count) + " small messages") << right << setw(10) << sent * 1000 / count
+    << " us a message, " << probe.size() << " bytes" << endl;
+
+    //the same sum split over more workers, on as many cores as there are
+    const int reps = 5;
+    for (int workers = 1; workers <= 4; workers *= 2) {
+        Var *parts = new Var("", VAR_ARRAY);
+        for (int k = 0; k < workers; k++) {
+            parts->addChild(to_string(k), numbers(n / workers, 1));
+        }
+        double ms = run("worker_bench_fan.js", {{"workers", workers}, {"reps", reps}}, jit,
+                        to_string(n / workers * workers * reps), {{"parts", parts}});
+        ok = ok && ms >= 0;
+        cout << left << setw(40) << ("sum over " + to_string(workers) + " workers") << right << setw(10) << ms
+        << " ms, " << thread::hardware_concurrency() << " cores" << endl;
+    }
+
+    for (auto name: {"echo", "ping", "count", "send", "sum", "fan"}) {
+        remove(("worker_bench_" + string(name) + ".js").c_str());
+    }
+    return ok ? 0 : 1;
+}